@@ -240,3 +240,196 @@ run_raidz_benchmark(void)
 
 	bench_fini_raidz_maps();
 }
+
+/*
+ * Benchmark sweep (-B -S): time parity generation and reconstruction for
+ * every supported math implementation over a grid of layouts, widths,
+ * parity levels, sector sizes and block sizes, and report the results in
+ * text, CSV or JSON (-f).  Each point runs for a fixed amount of time so a
+ * full sweep completes in a predictable time regardless of how fast an
+ * implementation is.  All work is done on one thread, so the reported
+ * bandwidth is per core.
+ *
+ * dRAID groups are fixed width and every allocation is padded out to a
+ * full group stripe, so the "draid" layout is modelled as a raidz map of
+ * the same width whose size is rounded up to a multiple of the stripe.
+ */
+#define	SWEEP_BENCH_NSEC	MSEC2NSEC(20)
+#define	SWEEP_MIN_BS_SHIFT	12
+#define	SWEEP_BS_SHIFT_STEP	2
+
+typedef enum sweep_layout {
+	SWEEP_RAIDZ,
+	SWEEP_DRAID,
+	SWEEP_NUM_LAYOUTS
+} sweep_layout_t;
+
+static const char *const sweep_layout_names[SWEEP_NUM_LAYOUTS] = {
+	"raidz",
+	"draid"
+};
+static const size_t sweep_dcols[] = { 4, 8, 16 };
+static const size_t sweep_ashift[] = { 9, 12 };
+
+static boolean_t sweep_first;
+
+static void
+sweep_header(void)
+{
+	switch (rto_opts.rto_format) {
+	case BENCH_FMT_JSON:
+		(void) printf("[");
+		break;
+	case BENCH_FMT_CSV:
+		(void) printf("impl,op,layout,dcols,parity,ashift,blocksize,"
+		    "iterations,ns_per_op,gbps_per_core\n");
+		break;
+	case BENCH_FMT_TEXT:
+	default:
+		(void) printf("%-12s %-4s %-6s %5s %6s %6s %9s %10s %12s "
+		    "%10s\n", "impl", "op", "layout", "dcols", "parity",
+		    "ashift", "blocksize", "iterations", "ns/op",
+		    "GB/s/core");
+		break;
+	}
+	sweep_first = B_TRUE;
+}
+
+static void
+sweep_footer(void)
+{
+	if (rto_opts.rto_format == BENCH_FMT_JSON)
+		(void) printf("\n]\n");
+}
+
+static void
+sweep_report(const char *impl, const char *op, sweep_layout_t layout,
+    size_t dcols, size_t parity, size_t ashift, uint64_t bs, uint64_t iter,
+    hrtime_t elapsed)
+{
+	double ns_per_op = (double)elapsed / (double)iter;
+	double gbps = (double)bs * (double)iter / (double)elapsed;
+
+	switch (rto_opts.rto_format) {
+	case BENCH_FMT_JSON:
+		(void) printf("%s\n  {\"impl\": \"%s\", \"op\": \"%s\", "
+		    "\"layout\": \"%s\", \"dcols\": %zu, \"parity\": %zu, "
+		    "\"ashift\": %zu, \"blocksize\": %llu, "
+		    "\"iterations\": %llu, \"ns_per_op\": %.1f, "
+		    "\"gbps_per_core\": %.3f}", sweep_first ? "" : ",",
+		    impl, op, sweep_layout_names[layout], dcols, parity,
+		    ashift, (u_longlong_t)bs, (u_longlong_t)iter, ns_per_op,
+		    gbps);
+		break;
+	case BENCH_FMT_CSV:
+		(void) printf("%s,%s,%s,%zu,%zu,%zu,%llu,%llu,%.1f,%.3f\n",
+		    impl, op, sweep_layout_names[layout], dcols, parity,
+		    ashift, (u_longlong_t)bs, (u_longlong_t)iter, ns_per_op,
+		    gbps);
+		break;
+	case BENCH_FMT_TEXT:
+	default:
+		(void) printf("%-12s %-4s %-6s %5zu %6zu %6zu %9llu %10llu "
+		    "%12.1f %10.3f\n", impl, op, sweep_layout_names[layout],
+		    dcols, parity, ashift, (u_longlong_t)bs, (u_longlong_t)iter,
+		    ns_per_op, gbps);
+		break;
+	}
+	sweep_first = B_FALSE;
+}
+
+static void
+run_sweep_bench_point(const char *impl, sweep_layout_t layout, size_t dcols,
+    size_t parity, size_t ashift, uint64_t bs)
+{
+	int tgts[VDEV_RAIDZ_MAXPARITY];
+	int nbad;
+	uint64_t iter;
+	hrtime_t start, elapsed;
+
+	zio_bench.io_size = bs;
+	rm_bench = vdev_raidz_map_alloc(&zio_bench, ashift, dcols + parity,
+	    parity);
+
+	/* parity generation */
+	iter = 0;
+	start = gethrtime();
+	do {
+		vdev_raidz_generate_parity(rm_bench);
+		iter++;
+	} while ((elapsed = gethrtime() - start) < SWEEP_BENCH_NSEC);
+	sweep_report(impl, "gen", layout, dcols, parity, ashift, bs, iter,
+	    elapsed);
+
+	/* reconstruct as many data columns as the parity level allows */
+	nbad = MIN(parity, raidz_ncols(rm_bench) - raidz_parity(rm_bench));
+	for (int i = 0; i < nbad; i++)
+		tgts[i] = parity + i;
+
+	iter = 0;
+	start = gethrtime();
+	do {
+		vdev_raidz_reconstruct(rm_bench, tgts, nbad);
+		iter++;
+	} while ((elapsed = gethrtime() - start) < SWEEP_BENCH_NSEC);
+	sweep_report(impl, "rec", layout, dcols, parity, ashift, bs, iter,
+	    elapsed);
+
+	vdev_raidz_map_free(rm_bench);
+}
+
+static void
+run_sweep_bench_geometry(const char *impl, sweep_layout_t layout,
+    size_t dcols, size_t parity)
+{
+	for (int a = 0; a < ARRAY_SIZE(sweep_ashift); a++) {
+		for (int bs = SWEEP_MIN_BS_SHIFT; bs <= SPA_MAXBLOCKSHIFT;
+		    bs += SWEEP_BS_SHIFT_STEP) {
+			uint64_t size = 1ULL << bs;
+
+			if (layout == SWEEP_DRAID) {
+				size = P2ROUNDUP(size,
+				    (uint64_t)dcols << sweep_ashift[a]);
+				if (size > max_data_size)
+					continue;
+			}
+
+			run_sweep_bench_point(impl, layout, dcols, parity,
+			    sweep_ashift[a], size);
+		}
+	}
+}
+
+static void
+run_sweep_bench_impl(const char *impl)
+{
+	for (int l = 0; l < SWEEP_NUM_LAYOUTS; l++) {
+		for (int d = 0; d < ARRAY_SIZE(sweep_dcols); d++) {
+			for (size_t p = PARITY_P; p <= PARITY_PQR; p++) {
+				run_sweep_bench_geometry(impl, l,
+				    sweep_dcols[d], p);
+			}
+		}
+	}
+}
+
+void
+run_raidz_benchmark_sweep(void)
+{
+	char **impl_name;
+
+	bench_init_raidz_map();
+	sweep_header();
+
+	for (impl_name = (char **)raidz_impl_names; *impl_name != NULL;
+	    impl_name++) {
+
+		if (vdev_raidz_impl_set(*impl_name) != 0)
+			continue;
+
+		run_sweep_bench_impl(*impl_name);
+	}
+
+	sweep_footer();
+	bench_fini_raidz_maps();
+}
@@ -118,6 +118,7 @@ static void usage(boolean_t requested)
 	    "\t[-S parameter sweep (default: %s)]\n"
 	    "\t[-t timeout for parameter sweep test]\n"
 	    "\t[-B benchmark all raidz implementations]\n"
+	    "\t[-f benchmark sweep output format: text, csv or json]\n"
 	    "\t[-e use expanded raidz map (default: %s)]\n"
 	    "\t[-r expanded raidz map reflow offset (default: %llx)]\n"
 	    "\t[-v increase verbosity (default: %d)]\n"
@@ -145,7 +146,7 @@ static void process_options(int argc, char **argv)
 
 	memcpy(o, &rto_opts_defaults, sizeof (*o));
 
-	while ((opt = getopt(argc, argv, "TDBSvha:er:o:d:s:t:")) != -1) {
+	while ((opt = getopt(argc, argv, "TDBSvha:er:o:d:s:t:f:")) != -1) {
 		switch (opt) {
 		case 'a':
 			value = strtoull(optarg, NULL, 0);
@@ -183,6 +184,19 @@ static void process_options(int argc, char **argv)
 		case 'B':
 			o->rto_benchmark = 1;
 			break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0) {
+				o->rto_format = BENCH_FMT_TEXT;
+			} else if (strcmp(optarg, "csv") == 0) {
+				o->rto_format = BENCH_FMT_CSV;
+			} else if (strcmp(optarg, "json") == 0) {
+				o->rto_format = BENCH_FMT_JSON;
+			} else {
+				ERR("raidz_test: unknown format '%s'\n",
+				    optarg);
+				usage(B_FALSE);
+			}
+			break;
 		case 'D':
 			o->rto_gdb = 1;
 			break;
@@ -1009,7 +1023,9 @@ main(int argc, char **argv)
 
 	mprotect(rand_data, SPA_MAXBLOCKSIZE, PROT_READ);
 
-	if (rto_opts.rto_benchmark) {
+	if (rto_opts.rto_benchmark && rto_opts.rto_sweep) {
+		run_raidz_benchmark_sweep();
+	} else if (rto_opts.rto_benchmark) {
 		run_raidz_benchmark();
 	} else if (rto_opts.rto_sweep) {
 		err = run_sweep();
@@ -36,6 +36,8 @@ static const char *const raidz_impl_names[] = {
 	"avx2",
 	"avx512f",
 	"avx512bw",
+	"avx2gfni",
+	"avx512gfni",
 	"aarch64_neon",
 	"aarch64_neonx2",
 	"powerpc_altivec",
@@ -48,6 +50,12 @@ enum raidz_verbosity {
 	D_DEBUG,
 };
 
+enum raidz_bench_format {
+	BENCH_FMT_TEXT,
+	BENCH_FMT_CSV,
+	BENCH_FMT_JSON,
+};
+
 typedef struct raidz_test_opts {
 	size_t rto_ashift;
 	uint64_t rto_offset;
@@ -57,6 +65,7 @@ typedef struct raidz_test_opts {
 	size_t rto_sweep;
 	size_t rto_sweep_timeout;
 	size_t rto_benchmark;
+	enum raidz_bench_format rto_format;
 	size_t rto_expand;
 	uint64_t rto_expand_offset;
 	size_t rto_sanity;
@@ -77,6 +86,7 @@ static const raidz_test_opts_t rto_opts_defaults = {
 	.rto_v = D_ALL,
 	.rto_sweep = 0,
 	.rto_benchmark = 0,
+	.rto_format = BENCH_FMT_TEXT,
 	.rto_expand = 0,
 	.rto_expand_offset = -1ULL,
 	.rto_sanity = 0,
@@ -118,6 +128,7 @@ static inline size_t ilog2(size_t a)
 void init_zio_abd(zio_t *zio);
 
 void run_raidz_benchmark(void);
+void run_raidz_benchmark_sweep(void);
 
 struct raidz_map *vdev_raidz_map_alloc_expanded(abd_t *, uint64_t, uint64_t,
     uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
@@ -326,7 +326,7 @@ sublivelist_verify_func(void *args, dsl_deadlist_entry_t *dle)
 	int err;
 	struct sublivelist_verify *sv = args;
 
-	zfs_btree_create(&sv->sv_pair, sublivelist_block_refcnt_compare,
+	zfs_btree_create(&sv->sv_pair, sublivelist_block_refcnt_compare, NULL,
 	    sizeof (sublivelist_verify_block_refcnt_t));
 
 	err = bpobj_iterate_nofree(&dle->dle_bpobj, sublivelist_verify_blkptr,
@@ -390,7 +390,7 @@ sublivelist_verify_lightweight(void *args, dsl_deadlist_entry_t *dle)
 {
 	(void) args;
 	sublivelist_verify_t sv;
-	zfs_btree_create(&sv.sv_leftover, livelist_block_compare,
+	zfs_btree_create(&sv.sv_leftover, livelist_block_compare, NULL,
 	    sizeof (sublivelist_verify_block_t));
 	int err = sublivelist_verify_func(&sv, dle);
 	zfs_btree_clear(&sv.sv_leftover);
@@ -682,7 +682,7 @@ livelist_metaslab_validate(spa_t *spa)
 	(void) printf("Verifying deleted livelist entries\n");
 
 	sublivelist_verify_t sv;
-	zfs_btree_create(&sv.sv_leftover, livelist_block_compare,
+	zfs_btree_create(&sv.sv_leftover, livelist_block_compare, NULL,
 	    sizeof (sublivelist_verify_block_t));
 	iterate_deleted_livelists(spa, livelist_verify, &sv);
 
@@ -716,7 +716,7 @@ livelist_metaslab_validate(spa_t *spa)
 			mv.mv_start = m->ms_start;
 			mv.mv_end = m->ms_start + m->ms_size;
 			zfs_btree_create(&mv.mv_livelist_allocs,
-			    livelist_block_compare,
+			    livelist_block_compare, NULL,
 			    sizeof (sublivelist_verify_block_t));
 
 			mv_populate_livelist_allocs(&mv, &sv);
@@ -1706,6 +1706,19 @@ dump_metaslab(metaslab_t *msp)
 		    SPACE_MAP_HISTOGRAM_SIZE, sm->sm_shift);
 	}
 
+	uint64_t max_free[SPACE_MAP_SUMMARY_SIZE];
+	if (dump_opt['m'] > 1 && sm != NULL &&
+	    space_map_summary_get(sm, max_free)) {
+		(void) printf("	Largest free segments (txg %llu):",
+		    (u_longlong_t)sm->sm_phys->smp_summary_txg);
+		for (int i = 0; i < SPACE_MAP_SUMMARY_SIZE; i++) {
+			char maxbuf[32];
+			zdb_nicenum(max_free[i], maxbuf, sizeof (maxbuf));
+			(void) printf(" %s", maxbuf);
+		}
+		(void) printf("\n");
+	}
+
 	if (vd->vdev_ops == &vdev_draid_ops)
 		ASSERT3U(msp->ms_size, <=, 1ULL << vd->vdev_ms_shift);
 	else
@@ -2035,6 +2048,27 @@ dump_ddt(ddt_t *ddt, enum ddt_type type, enum ddt_class class)
 	(void) printf("\n");
 }
 
+static void
+dump_ddt_log(ddt_t *ddt)
+{
+	char name[DDT_NAMELEN];
+
+	for (int n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		if (ddl->ddl_length == 0)
+			continue;
+
+		ddt_log_name(ddt, n, name);
+		(void) printf("%s: %llu entries, %llu bytes, "
+		    "first txg %llu%s\n", name,
+		    (u_longlong_t)avl_numnodes(&ddl->ddl_tree),
+		    (u_longlong_t)ddl->ddl_length,
+		    (u_longlong_t)ddl->ddl_first_txg,
+		    ddl == ddt->ddt_log_flushing ? " (flushing)" : "");
+	}
+}
+
 static void
 dump_all_ddts(spa_t *spa)
 {
@@ -2049,6 +2083,7 @@ dump_all_ddts(spa_t *spa)
 				dump_ddt(ddt, type, class);
 			}
 		}
+		dump_ddt_log(ddt);
 	}
 
 	ddt_get_dedup_stats(spa, &dds_total);
@@ -5430,21 +5465,29 @@ zdb_count_block(zdb_cb_t *zcb, zilog_t *zilog, const blkptr_t *bp,
 	if (BP_GET_DEDUP(bp)) {
 		ddt_t *ddt;
 		ddt_entry_t *dde;
+		ddt_phys_t *ddp = NULL;
+		ddt_key_t ddk;
 
 		ddt = ddt_select(zcb->zcb_spa, bp);
-		ddt_enter(ddt);
+		ddt_key_fill(&ddk, bp);
+		ddt_enter(ddt, &ddk);
 		dde = ddt_lookup(ddt, bp, B_FALSE);
+		if (dde != NULL)
+			ddp = ddt_phys_select(dde, bp);
 
-		if (dde == NULL) {
+		/*
+		 * A block whose unique entry was pruned is an ordinary block,
+		 * even if the same data has since been deduplicated again.
+		 */
+		if (ddp == NULL) {
 			refcnt = 0;
 		} else {
-			ddt_phys_t *ddp = ddt_phys_select(dde, bp);
 			ddt_phys_decref(ddp);
 			refcnt = ddp->ddp_refcnt;
 			if (ddt_phys_total_refcnt(dde) == 0)
 				ddt_remove(ddt, dde);
 		}
-		ddt_exit(ddt);
+		ddt_exit(ddt, &ddk);
 	}
 
 	VERIFY3U(zio_wait(zio_claim(NULL, zcb->zcb_spa,
@@ -5793,9 +5836,9 @@ zdb_ddt_leak_init(spa_t *spa, zdb_cb_t *zcb)
 			}
 		}
 		ddt_t *ddt = spa->spa_ddt[ddb.ddb_checksum];
-		ddt_enter(ddt);
+		ddt_enter(ddt, &dde.dde_key);
 		VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
-		ddt_exit(ddt);
+		ddt_exit(ddt, &dde.dde_key);
 	}
 
 	ASSERT(error == ENOENT);
@@ -7522,6 +7565,7 @@ dump_mos_leaks(spa_t *spa)
 	mos_obj_refd(spa->spa_pool_props_object);
 	mos_obj_refd(spa->spa_config_object);
 	mos_obj_refd(spa->spa_ddt_stat_object);
+	mos_obj_refd(spa->spa_ddt_txg_time_object);
 	mos_obj_refd(spa->spa_feat_desc_obj);
 	mos_obj_refd(spa->spa_feat_enabled_txg_obj);
 	mos_obj_refd(spa->spa_feat_for_read_obj);
@@ -7590,6 +7634,12 @@ dump_mos_leaks(spa_t *spa)
 		}
 	}
 
+	for (uint64_t cksum = 0; cksum < ZIO_CHECKSUM_FUNCTIONS; cksum++) {
+		ddt_t *ddt = spa->spa_ddt[cksum];
+		mos_obj_refd(ddt->ddt_log[0].ddl_object);
+		mos_obj_refd(ddt->ddt_log[1].ddl_object);
+	}
+
 	/*
 	 * Visit all allocated objects and make sure they are referenced.
 	 */
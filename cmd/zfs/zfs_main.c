@@ -121,6 +121,7 @@ static int zfs_do_project(int argc, char **argv);
 static int zfs_do_version(int argc, char **argv);
 static int zfs_do_redact(int argc, char **argv);
 static int zfs_do_wait(int argc, char **argv);
+static int zfs_do_rewrite(int argc, char **argv);
 
 #ifdef __FreeBSD__
 static int zfs_do_jail(int argc, char **argv);
@@ -189,6 +190,7 @@ typedef enum {
 	HELP_JAIL,
 	HELP_UNJAIL,
 	HELP_WAIT,
+	HELP_REWRITE,
 	HELP_ZONE,
 	HELP_UNZONE,
 } zfs_help_t;
@@ -256,6 +258,7 @@ static zfs_command_t command_table[] = {
 	{ "change-key",	zfs_do_change_key,	HELP_CHANGE_KEY		},
 	{ "redact",	zfs_do_redact,		HELP_REDACT		},
 	{ "wait",	zfs_do_wait,		HELP_WAIT		},
+	{ "rewrite",	zfs_do_rewrite,		HELP_REWRITE		},
 
 #ifdef __FreeBSD__
 	{ "jail",	zfs_do_jail,		HELP_JAIL		},
@@ -329,8 +332,10 @@ get_usage(zfs_help_t idx)
 	case HELP_SEND:
 		return (gettext("\tsend [-DLPbcehnpsvw] "
 		    "[-i|-I snapshot]\n"
-		    "\t     [-R [-X dataset[,dataset]...]]     <snapshot>\n"
-		    "\tsend [-DnvPLecw] [-i snapshot|bookmark] "
+		    "\t     [-R [-X dataset[,dataset]...]]\n"
+		    "\t     [--stream-compress lz4|zstd] <snapshot>\n"
+		    "\tsend [-DnvPLecw] [-i snapshot|bookmark]\n"
+		    "\t     [--stream-compress lz4|zstd] "
 		    "<filesystem|volume|snapshot>\n"
 		    "\tsend [-DnPpvLec] [-i bookmark|snapshot] "
 		    "--redact <bookmark> <snapshot>\n"
@@ -427,6 +432,8 @@ get_usage(zfs_help_t idx)
 		return (gettext("\tunjail <jailid|jailname> <filesystem>\n"));
 	case HELP_WAIT:
 		return (gettext("\twait [-t <activity>] <filesystem>\n"));
+	case HELP_REWRITE:
+		return (gettext("\trewrite [-s] <filesystem|volume>\n"));
 	case HELP_ZONE:
 		return (gettext("\tzone <nsfile> <filesystem>\n"));
 	case HELP_UNZONE:
@@ -4367,6 +4374,8 @@ zfs_do_send_exclude(zfs_handle_t *zhp, void *context)
 /*
  * Send a backup stream to stdout.
  */
+#define	STREAM_COMPRESS_OPT	1024
+
 static int
 zfs_do_send(int argc, char **argv)
 {
@@ -4399,6 +4408,8 @@ zfs_do_send(int argc, char **argv)
 		{"holds",	no_argument,		NULL, 'h'},
 		{"saved",	no_argument,		NULL, 'S'},
 		{"exclude",	required_argument,	NULL, 'X'},
+		{"stream-compress", required_argument,	NULL,
+		    STREAM_COMPRESS_OPT},
 		{0, 0, 0, 0}
 	};
 
@@ -4486,6 +4497,21 @@ zfs_do_send(int argc, char **argv)
 		case 'S':
 			flags.saved = B_TRUE;
 			break;
+		case STREAM_COMPRESS_OPT:
+			flags.stream_lz4 = B_FALSE;
+			flags.stream_zstd = B_FALSE;
+			if (strcmp(optarg, "lz4") == 0) {
+				flags.stream_lz4 = B_TRUE;
+			} else if (strcmp(optarg, "zstd") == 0) {
+				flags.stream_zstd = B_TRUE;
+			} else {
+				(void) fprintf(stderr, gettext("invalid "
+				    "stream compression '%s': must be 'lz4' "
+				    "or 'zstd'\n"), optarg);
+				free(excludes.list);
+				usage(B_FALSE);
+			}
+			break;
 		case ':':
 			/*
 			 * If a parameter was not passed, optopt contains the
@@ -8632,6 +8658,77 @@ found:;
 	return (error);
 }
 
+/*
+ * zfs rewrite [-s] <filesystem|volume>
+ *
+ *	-s	Stop the rewrite in progress.
+ *
+ * Rewrite the blocks of a filesystem or volume in the background, so that
+ * they are reallocated from the pool's current free space.
+ */
+static int
+zfs_do_rewrite(int argc, char **argv)
+{
+	zfs_rewrite_func_t func = ZFS_REWRITE_START;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "s")) != -1) {
+		switch (c) {
+		case 's':
+			func = ZFS_REWRITE_STOP;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argv += optind;
+	argc -= optind;
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing dataset argument\n"));
+		usage(B_FALSE);
+	}
+	if (argc > 1) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	zfs_handle_t *zhp = zfs_open(g_zfs, argv[0],
+	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME);
+	if (zhp == NULL)
+		return (1);
+
+	err = lzc_rewrite(zfs_get_name(zhp), func);
+	if (err != 0) {
+		switch (err) {
+		case EBUSY:
+			(void) fprintf(stderr, gettext("cannot rewrite '%s': "
+			    "a rewrite is already in progress in this pool\n"),
+			    zfs_get_name(zhp));
+			break;
+		case ENOENT:
+			(void) fprintf(stderr, gettext("cannot stop rewrite "
+			    "of '%s': no rewrite in progress\n"),
+			    zfs_get_name(zhp));
+			break;
+		case EACCES:
+			(void) fprintf(stderr, gettext("cannot rewrite '%s': "
+			    "encryption key not loaded\n"), zfs_get_name(zhp));
+			break;
+		default:
+			(void) fprintf(stderr, gettext("cannot rewrite '%s': "
+			    "%s\n"), zfs_get_name(zhp), strerror(err));
+			break;
+		}
+	}
+
+	zfs_close(zhp);
+
+	return (err != 0);
+}
+
 /*
  * Display version message
  */
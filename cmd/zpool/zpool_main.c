@@ -98,6 +98,7 @@ static int zpool_do_clear(int, char **);
 static int zpool_do_reopen(int, char **);
 
 static int zpool_do_reguid(int, char **);
+static int zpool_do_ddt_prune(int, char **);
 
 static int zpool_do_attach(int, char **);
 static int zpool_do_detach(int, char **);
@@ -178,6 +179,7 @@ typedef enum {
 	HELP_SPLIT,
 	HELP_SYNC,
 	HELP_REGUID,
+	HELP_DDT_PRUNE,
 	HELP_REOPEN,
 	HELP_VERSION,
 	HELP_WAIT
@@ -319,6 +321,7 @@ static zpool_command_t command_table[] = {
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
 	{ "upgrade",	zpool_do_upgrade,	HELP_UPGRADE		},
 	{ "reguid",	zpool_do_reguid,	HELP_REGUID		},
+	{ "ddtprune",	zpool_do_ddt_prune,	HELP_DDT_PRUNE		},
 	{ NULL },
 	{ "history",	zpool_do_history,	HELP_HISTORY		},
 	{ "events",	zpool_do_events,	HELP_EVENTS		},
@@ -401,7 +404,7 @@ get_usage(zpool_help_t idx)
 		return (gettext("\tinitialize [-c | -s] [-w] <pool> "
 		    "[<device> ...]\n"));
 	case HELP_SCRUB:
-		return (gettext("\tscrub [-s | -p] [-w] <pool> ...\n"));
+		return (gettext("\tscrub [-s | -p] [-w] [-C] <pool> ...\n"));
 	case HELP_RESILVER:
 		return (gettext("\tresilver <pool> ...\n"));
 	case HELP_TRIM:
@@ -428,6 +431,8 @@ get_usage(zpool_help_t idx)
 		    "[<device> ...]\n"));
 	case HELP_REGUID:
 		return (gettext("\treguid <pool>\n"));
+	case HELP_DDT_PRUNE:
+		return (gettext("\tddtprune -d <days> <pool>\n"));
 	case HELP_SYNC:
 		return (gettext("\tsync [pool] ...\n"));
 	case HELP_VERSION:
@@ -7128,6 +7133,75 @@ zpool_do_reguid(int argc, char **argv)
 	return (ret);
 }
 
+/*
+ * zpool ddtprune -d <days> <pool>
+ *
+ *	-d	Prune the unique entries of blocks written more than this many
+ *		days ago.
+ *
+ * Remove old unique entries from the dedup tables of the pool.
+ */
+int
+zpool_do_ddt_prune(int argc, char **argv)
+{
+	int c;
+	char *poolname, *end;
+	zpool_handle_t *zhp;
+	uint64_t days = 0;
+	boolean_t daysflag = B_FALSE;
+	int ret = 0;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "d:")) != -1) {
+		switch (c) {
+		case 'd':
+			errno = 0;
+			days = strtoull(optarg, &end, 10);
+			if (errno != 0 || *end != '\0' || *optarg == '-' ||
+			    days > DDT_PRUNE_DAYS_MAX) {
+				(void) fprintf(stderr,
+				    gettext("invalid number of days '%s'\n"),
+				    optarg);
+				usage(B_FALSE);
+			}
+			daysflag = B_TRUE;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (!daysflag) {
+		(void) fprintf(stderr, gettext("missing -d option\n"));
+		usage(B_FALSE);
+	}
+
+	/* get pool name and check number of arguments */
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name\n"));
+		usage(B_FALSE);
+	}
+
+	if (argc > 1) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	poolname = argv[0];
+	if ((zhp = zpool_open(g_zfs, poolname)) == NULL)
+		return (1);
+
+	ret = zpool_ddt_prune(zhp, days);
+
+	zpool_close(zhp);
+	return (ret);
+}
+
 
 /*
  * zpool reopen <pool>
@@ -7230,11 +7304,13 @@ wait_callback(zpool_handle_t *zhp, void *data)
 }
 
 /*
- * zpool scrub [-s | -p] [-w] <pool> ...
+ * zpool scrub [-s | -p] [-w] [-C] <pool> ...
  *
  *	-s	Stop.  Stops any in-progress scrub.
  *	-p	Pause. Pause in-progress scrub.
  *	-w	Wait.  Blocks until scrub has completed.
+ *	-C	Scrub from last scrubbed txg.  Only scrub blocks born after
+ *		the last completed scrub.
  */
 int
 zpool_do_scrub(int argc, char **argv)
@@ -7242,23 +7318,28 @@ zpool_do_scrub(int argc, char **argv)
 	int c;
 	scrub_cbdata_t cb;
 	boolean_t wait = B_FALSE;
+	boolean_t is_pause = B_FALSE;
+	boolean_t is_from_last = B_FALSE;
 	int error;
 
 	cb.cb_type = POOL_SCAN_SCRUB;
 	cb.cb_scrub_cmd = POOL_SCRUB_NORMAL;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "spw")) != -1) {
+	while ((c = getopt(argc, argv, "spwC")) != -1) {
 		switch (c) {
 		case 's':
 			cb.cb_type = POOL_SCAN_NONE;
 			break;
 		case 'p':
-			cb.cb_scrub_cmd = POOL_SCRUB_PAUSE;
+			is_pause = B_TRUE;
 			break;
 		case 'w':
 			wait = B_TRUE;
 			break;
+		case 'C':
+			is_from_last = B_TRUE;
+			break;
 		case '?':
 			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
 			    optopt);
@@ -7266,13 +7347,23 @@ zpool_do_scrub(int argc, char **argv)
 		}
 	}
 
-	if (cb.cb_type == POOL_SCAN_NONE &&
-	    cb.cb_scrub_cmd == POOL_SCRUB_PAUSE) {
+	if (cb.cb_type == POOL_SCAN_NONE && is_pause) {
 		(void) fprintf(stderr, gettext("invalid option combination: "
 		    "-s and -p are mutually exclusive\n"));
 		usage(B_FALSE);
 	}
 
+	if (is_from_last && (cb.cb_type == POOL_SCAN_NONE || is_pause)) {
+		(void) fprintf(stderr, gettext("invalid option combination: "
+		    "-C cannot be used with -p or -s\n"));
+		usage(B_FALSE);
+	}
+
+	if (is_pause)
+		cb.cb_scrub_cmd = POOL_SCRUB_PAUSE;
+	else if (is_from_last)
+		cb.cb_scrub_cmd = POOL_SCRUB_FROM_LAST_TXG;
+
 	if (wait && (cb.cb_type == POOL_SCAN_NONE ||
 	    cb.cb_scrub_cmd == POOL_SCRUB_PAUSE)) {
 		(void) fprintf(stderr, gettext("invalid option combination: "
@@ -7498,7 +7589,7 @@ secs_to_dhms(uint64_t total, char *buf)
  * Print out detailed scrub status.
  */
 static void
-print_scan_scrub_resilver_status(pool_scan_stat_t *ps)
+print_scan_scrub_resilver_status(pool_scan_stat_t *ps, uint_t c)
 {
 	time_t start, end, pause;
 	uint64_t pass_scanned, scanned, pass_issued, issued, total;
@@ -7609,6 +7700,15 @@ print_scan_scrub_resilver_status(pool_scan_stat_t *ps)
 		    scanned_buf, issued_buf, total_buf);
 	}
 
+	/* older kernels do not report the latency throttle */
+	if (pause == 0 && c > offsetof(pool_scan_stat_t,
+	    pss_issue_limit_pct) / sizeof (uint64_t) &&
+	    ps->pss_issue_limit_pct < 100) {
+		(void) printf(gettext("\tissue throttled to %llu%% of its "
+		    "limit to meet the sync I/O latency target\n"),
+		    (u_longlong_t)ps->pss_issue_limit_pct);
+	}
+
 	if (ps->pss_func == POOL_SCAN_RESILVER) {
 		(void) printf(gettext("\t%s resilvered, %.2f%% done"),
 		    processed_buf, 100 * fraction_done);
@@ -7840,7 +7940,7 @@ print_scan_status(zpool_handle_t *zhp, nvlist_t *nvroot)
 
 	/* Always print the scrub status when available. */
 	if (have_scrub)
-		print_scan_scrub_resilver_status(ps);
+		print_scan_scrub_resilver_status(ps, c);
 
 	/*
 	 * When there is an active resilver or rebuild print its status.
@@ -7848,7 +7948,7 @@ print_scan_status(zpool_handle_t *zhp, nvlist_t *nvroot)
 	 */
 	if (active_resilver || (!active_rebuild && have_resilver &&
 	    resilver_end_time && resilver_end_time > rebuild_end_time)) {
-		print_scan_scrub_resilver_status(ps);
+		print_scan_scrub_resilver_status(ps, c);
 	} else if (active_rebuild || (!active_resilver && have_rebuild &&
 	    rebuild_end_time && rebuild_end_time > resilver_end_time)) {
 		print_rebuild_status(zhp, nvroot);
@@ -0,0 +1,520 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+#include <err.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/zfs_ioctl.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/zstd/zstd.h>
+#include <zfs_prop.h>
+#include "zfs_fletcher.h"
+#include "zstream.h"
+
+/*
+ * Records are read in order into a ring of slots.  Worker threads take the
+ * slots in the same order and recompress the payloads of WRITE records,
+ * while the main thread writes out each slot, and updates the stream
+ * checksum, as soon as every slot before it has been written.
+ */
+typedef struct recompress_slot {
+	dmu_replay_record_t	rs_drr;
+	char			*rs_buf;	/* record payload */
+	size_t			rs_bufsz;
+	char			*rs_tmp;	/* scratch space for a worker */
+	size_t			rs_tmpsz;
+	uint64_t		rs_payload_size;
+	boolean_t		rs_raw;		/* part of a raw stream */
+	boolean_t		rs_done;
+} recompress_slot_t;
+
+typedef struct recompress {
+	pthread_mutex_t		rc_lock;
+	pthread_cond_t		rc_work_cv;	/* slot filled, or EOF */
+	pthread_cond_t		rc_done_cv;	/* slot recompressed */
+	recompress_slot_t	*rc_slots;
+	uint64_t		rc_nslots;
+	uint64_t		rc_head;	/* next slot to write out */
+	uint64_t		rc_next;	/* next slot to recompress */
+	uint64_t		rc_tail;	/* next slot to fill */
+	boolean_t		rc_eof;
+	enum zio_compress	rc_type;
+	uint8_t			rc_level;
+	uint64_t		rc_writes;
+	uint64_t		rc_compressed;
+	uint64_t		rc_bytes_in;
+	uint64_t		rc_bytes_out;
+} recompress_t;
+
+#define	RECOMPRESS_SLOT(rc, i)	(&(rc)->rc_slots[(i) % (rc)->rc_nslots])
+
+static int
+dump_record(dmu_replay_record_t *drr, void *payload, int payload_len,
+    zio_cksum_t *zc, int outfd)
+{
+	assert(offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum)
+	    == sizeof (dmu_replay_record_t) - sizeof (zio_cksum_t));
+	fletcher_4_incremental_native(drr,
+	    offsetof(dmu_replay_record_t, drr_u.drr_checksum.drr_checksum), zc);
+	if (drr->drr_type != DRR_BEGIN) {
+		assert(ZIO_CHECKSUM_IS_ZERO(&drr->drr_u.
+		    drr_checksum.drr_checksum));
+		drr->drr_u.drr_checksum.drr_checksum = *zc;
+	}
+	fletcher_4_incremental_native(&drr->drr_u.drr_checksum.drr_checksum,
+	    sizeof (zio_cksum_t), zc);
+	if (write(outfd, drr, sizeof (*drr)) == -1)
+		return (errno);
+	if (payload_len != 0) {
+		fletcher_4_incremental_native(payload, payload_len, zc);
+		if (write(outfd, payload, payload_len) == -1)
+			return (errno);
+	}
+	return (0);
+}
+
+static void
+buf_reserve(char **bufp, size_t *bufszp, size_t size)
+{
+	if (size > *bufszp) {
+		free(*bufp);
+		*bufp = safe_malloc(size);
+		*bufszp = size;
+	}
+}
+
+/*
+ * Recompress the payload of a WRITE record in place, leaving it
+ * uncompressed if the new compression doesn't save at least 1/8 of it.
+ * Metadata is always left uncompressed, as zfs send leaves it, so that
+ * the receiver can byteswap it.  The output is never marked as stream
+ * compressed: the receiver stores the blocks with the new compression.
+ * Returns B_TRUE if the payload was stored compressed.
+ */
+static boolean_t
+recompress_write(recompress_t *rc, recompress_slot_t *rs)
+{
+	struct drr_write *drrw = &rs->rs_drr.drr_u.drr_write;
+	uint64_t lsize = drrw->drr_logical_size;
+	char *data = rs->rs_buf;
+	char *dst;
+
+	if (lsize > SPA_MAXBLOCKSIZE ||
+	    drrw->drr_compressiontype >= ZIO_COMPRESS_FUNCTIONS) {
+		warnx("invalid WRITE record for ino %llu offset %llu",
+		    (u_longlong_t)drrw->drr_object,
+		    (u_longlong_t)drrw->drr_offset);
+		return (DRR_WRITE_COMPRESSED(drrw));
+	}
+
+	enum zio_compress type = rc->rc_type;
+	if (DMU_OT_IS_METADATA(drrw->drr_type))
+		type = ZIO_COMPRESS_OFF;
+
+	if (DRR_WRITE_COMPRESSED(drrw)) {
+		drrw->drr_flags &= ~DRR_WRITE_STREAM_COMPRESSED;
+
+		/* There's nothing to gain from redoing most compressions */
+		if (drrw->drr_compressiontype == type &&
+		    type != ZIO_COMPRESS_ZSTD)
+			return (B_TRUE);
+
+		buf_reserve(&rs->rs_tmp, &rs->rs_tmpsz, lsize);
+		if (zio_decompress_data_buf(drrw->drr_compressiontype,
+		    rs->rs_buf, rs->rs_tmp, rs->rs_payload_size, lsize,
+		    NULL) != 0) {
+			warnx("decompression failed for ino %llu offset %llu",
+			    (u_longlong_t)drrw->drr_object,
+			    (u_longlong_t)drrw->drr_offset);
+			return (B_TRUE);
+		}
+		data = rs->rs_tmp;
+		buf_reserve(&rs->rs_buf, &rs->rs_bufsz, lsize);
+		dst = rs->rs_buf;
+	} else {
+		if (type == ZIO_COMPRESS_OFF)
+			return (B_FALSE);
+		buf_reserve(&rs->rs_tmp, &rs->rs_tmpsz, lsize);
+		dst = rs->rs_tmp;
+	}
+
+	size_t c_len = lsize;
+	if (type != ZIO_COMPRESS_OFF) {
+		zio_compress_info_t *ci = &zio_compress_table[type];
+		size_t d_len = lsize - (lsize >> 3);
+
+		c_len = ci->ci_compress(data, dst, lsize, d_len, rc->rc_level);
+		if (c_len > d_len ||
+		    P2ROUNDUP(c_len, SPA_MINBLOCKSIZE) >= lsize) {
+			c_len = lsize;
+		} else {
+			memset(dst + c_len, 0,
+			    P2ROUNDUP(c_len, SPA_MINBLOCKSIZE) - c_len);
+			c_len = P2ROUNDUP(c_len, SPA_MINBLOCKSIZE);
+		}
+	}
+
+	boolean_t compressed = (c_len < lsize);
+	if (compressed) {
+		drrw->drr_compressiontype = type;
+		drrw->drr_compressed_size = c_len;
+	} else {
+		drrw->drr_compressiontype = 0;
+		drrw->drr_compressed_size = 0;
+		dst = data;
+	}
+	rs->rs_payload_size = c_len;
+
+	if (dst != rs->rs_buf) {
+		char *buf = rs->rs_buf;
+		size_t bufsz = rs->rs_bufsz;
+
+		rs->rs_buf = rs->rs_tmp;
+		rs->rs_bufsz = rs->rs_tmpsz;
+		rs->rs_tmp = buf;
+		rs->rs_tmpsz = bufsz;
+	}
+
+	return (compressed);
+}
+
+static void *
+recompress_worker(void *arg)
+{
+	recompress_t *rc = arg;
+
+	(void) pthread_mutex_lock(&rc->rc_lock);
+	for (;;) {
+		while (rc->rc_next == rc->rc_tail && !rc->rc_eof)
+			(void) pthread_cond_wait(&rc->rc_work_cv, &rc->rc_lock);
+		if (rc->rc_next == rc->rc_tail)
+			break;
+
+		recompress_slot_t *rs = RECOMPRESS_SLOT(rc, rc->rc_next);
+		rc->rc_next++;
+		(void) pthread_mutex_unlock(&rc->rc_lock);
+
+		uint64_t bytes_in = rs->rs_payload_size;
+		boolean_t is_write = (rs->rs_drr.drr_type == DRR_WRITE &&
+		    !rs->rs_raw);
+		boolean_t compressed = B_FALSE;
+		if (is_write)
+			compressed = recompress_write(rc, rs);
+
+		(void) pthread_mutex_lock(&rc->rc_lock);
+		if (is_write) {
+			rc->rc_writes++;
+			if (compressed)
+				rc->rc_compressed++;
+			rc->rc_bytes_in += bytes_in;
+			rc->rc_bytes_out += rs->rs_payload_size;
+		}
+		rs->rs_done = B_TRUE;
+		(void) pthread_cond_broadcast(&rc->rc_done_cv);
+	}
+	(void) pthread_mutex_unlock(&rc->rc_lock);
+
+	return (NULL);
+}
+
+/*
+ * Write out the slot at the head of the ring, regenerating its checksum.
+ */
+static void
+recompress_output(recompress_slot_t *rs, zio_cksum_t *stream_cksum)
+{
+	dmu_replay_record_t *drr = &rs->rs_drr;
+
+	if (drr->drr_type == DRR_BEGIN)
+		ZIO_SET_CHECKSUM(stream_cksum, 0, 0, 0, 0);
+
+	if (drr->drr_type == DRR_END) {
+		struct drr_end *drre = &drr->drr_u.drr_end;
+		/*
+		 * Use the recalculated checksum, unless this is
+		 * the END record of a stream package, which has
+		 * no checksum.
+		 */
+		if (!ZIO_CHECKSUM_IS_ZERO(&drre->drr_checksum))
+			drre->drr_checksum = *stream_cksum;
+	}
+
+	/*
+	 * We need to recalculate the checksum, and it needs to be
+	 * initially zero to do that.  BEGIN records don't have
+	 * a checksum.
+	 */
+	if (drr->drr_type != DRR_BEGIN) {
+		memset(&drr->drr_u.drr_checksum.drr_checksum, 0,
+		    sizeof (drr->drr_u.drr_checksum.drr_checksum));
+	}
+	if (dump_record(drr, rs->rs_buf, rs->rs_payload_size,
+	    stream_cksum, STDOUT_FILENO) != 0) {
+		err(1, "write");
+	}
+
+	/*
+	 * A stream package ends with two END records.  The last END
+	 * record's checksum starts from zero.
+	 */
+	if (drr->drr_type == DRR_END)
+		ZIO_SET_CHECKSUM(stream_cksum, 0, 0, 0, 0);
+}
+
+/*
+ * Read the payload of the record in the given slot from stdin.
+ */
+static void
+recompress_read_payload(recompress_slot_t *rs)
+{
+	dmu_replay_record_t *drr = &rs->rs_drr;
+	uint64_t payload_size = 0;
+
+	switch (drr->drr_type) {
+	case DRR_BEGIN:
+		payload_size = drr->drr_payloadlen;
+		break;
+	case DRR_OBJECT:
+		if (drr->drr_u.drr_object.drr_bonuslen > 0) {
+			payload_size =
+			    DRR_OBJECT_PAYLOAD_SIZE(&drr->drr_u.drr_object);
+		}
+		break;
+	case DRR_SPILL:
+		payload_size = DRR_SPILL_PAYLOAD_SIZE(&drr->drr_u.drr_spill);
+		break;
+	case DRR_WRITE:
+		payload_size = DRR_WRITE_PAYLOAD_SIZE(&drr->drr_u.drr_write);
+		break;
+	case DRR_WRITE_EMBEDDED:
+		payload_size = P2ROUNDUP(
+		    (uint64_t)drr->drr_u.drr_write_embedded.drr_psize, 8);
+		break;
+	case DRR_WRITE_BYREF:
+		errx(1, "Deduplicated streams are not supported");
+		break;
+	case DRR_END:
+	case DRR_FREEOBJECTS:
+	case DRR_FREE:
+	case DRR_OBJECT_RANGE:
+	case DRR_REDACT:
+		break;
+	default:
+		errx(1, "INVALID record type 0x%x", drr->drr_type);
+	}
+
+	if (payload_size > INT_MAX)
+		errx(1, "invalid payload size %llu",
+		    (u_longlong_t)payload_size);
+	buf_reserve(&rs->rs_buf, &rs->rs_bufsz, payload_size);
+	if (payload_size != 0 && sfread(rs->rs_buf, payload_size, stdin) == 0)
+		errx(1, "unexpected end-of-file");
+	rs->rs_payload_size = payload_size;
+}
+
+int
+zstream_do_recompress(int argc, char *argv[])
+{
+	recompress_t rc = { 0 };
+	zio_cksum_t stream_cksum = { { 0 } };
+	boolean_t raw = B_FALSE;
+	boolean_t verbose = B_FALSE;
+	char *compress = NULL;
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	char *end;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:t:v")) != -1) {
+		switch (c) {
+		case 'c':
+			compress = optarg;
+			break;
+		case 't':
+			errno = 0;
+			nthreads = strtol(optarg, &end, 0);
+			if (errno != 0 || *end != '\0' || nthreads < 1 ||
+			    nthreads > 1024)
+				errx(1, "invalid number of threads: %s",
+				    optarg);
+			break;
+		case 'v':
+			verbose = B_TRUE;
+			break;
+		case '?':
+			(void) fprintf(stderr, "invalid option '%c'\n",
+			    optopt);
+			zstream_usage();
+			break;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (compress == NULL || argc != 0)
+		zstream_usage();
+	if (nthreads < 1)
+		nthreads = 1;
+
+	uint64_t val;
+	zfs_prop_init();
+	if (zfs_prop_string_to_index(ZFS_PROP_COMPRESSION, compress,
+	    &val) != 0) {
+		errx(1, "invalid compression type %s", compress);
+	}
+	rc.rc_type = ZIO_COMPRESS_ALGO(val);
+	if (rc.rc_type == ZIO_COMPRESS_ON)
+		rc.rc_type = ZIO_COMPRESS_LZ4_ON_VALUE;
+	if (rc.rc_type == ZIO_COMPRESS_ZSTD) {
+		rc.rc_level = ZIO_COMPRESS_LEVEL(val);
+		if (rc.rc_level == ZIO_COMPLEVEL_INHERIT)
+			rc.rc_level = ZIO_ZSTD_LEVEL_DEFAULT;
+	} else {
+		rc.rc_level = zio_compress_table[rc.rc_type].ci_level;
+	}
+
+	if (isatty(STDIN_FILENO)) {
+		(void) fprintf(stderr,
+		    "Error: The send stream is a binary format "
+		    "and can not be read from a\n"
+		    "terminal.  Standard input must be redirected.\n");
+		exit(1);
+	}
+
+	fletcher_4_init();
+	zio_init();
+	zstd_init();
+
+	rc.rc_nslots = 4 * nthreads;
+	rc.rc_slots = safe_calloc(rc.rc_nslots * sizeof (recompress_slot_t));
+	VERIFY0(pthread_mutex_init(&rc.rc_lock, NULL));
+	VERIFY0(pthread_cond_init(&rc.rc_work_cv, NULL));
+	VERIFY0(pthread_cond_init(&rc.rc_done_cv, NULL));
+
+	pthread_t *threads = safe_calloc(nthreads * sizeof (pthread_t));
+	for (int i = 0; i < nthreads; i++) {
+		VERIFY0(pthread_create(&threads[i], NULL, recompress_worker,
+		    &rc));
+	}
+
+	(void) pthread_mutex_lock(&rc.rc_lock);
+	for (;;) {
+		/*
+		 * Write out the records that are done, and wait for the
+		 * oldest one if there is no free slot to read into.
+		 */
+		while (rc.rc_head != rc.rc_tail) {
+			recompress_slot_t *rs = RECOMPRESS_SLOT(&rc,
+			    rc.rc_head);
+			if (!rs->rs_done) {
+				if (rc.rc_tail - rc.rc_head < rc.rc_nslots &&
+				    !rc.rc_eof)
+					break;
+				(void) pthread_cond_wait(&rc.rc_done_cv,
+				    &rc.rc_lock);
+				continue;
+			}
+			(void) pthread_mutex_unlock(&rc.rc_lock);
+			recompress_output(rs, &stream_cksum);
+			(void) pthread_mutex_lock(&rc.rc_lock);
+			rc.rc_head++;
+		}
+		if (rc.rc_eof)
+			break;
+
+		/* Only this thread uses the slot until it is queued */
+		recompress_slot_t *rs = RECOMPRESS_SLOT(&rc, rc.rc_tail);
+		(void) pthread_mutex_unlock(&rc.rc_lock);
+
+		dmu_replay_record_t *drr = &rs->rs_drr;
+		boolean_t eof = (sfread(drr, sizeof (*drr), stdin) == 0);
+		if (!eof) {
+			if (drr->drr_type == DRR_BEGIN) {
+				struct drr_begin *drrb = &drr->drr_u.drr_begin;
+				uint64_t fflags =
+				    DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+
+				if (drrb->drr_magic != DMU_BACKUP_MAGIC)
+					errx(1, "Byteswapped streams are not "
+					    "supported");
+
+				/*
+				 * Raw streams can't be recompressed without
+				 * the key, so they are passed through as is.
+				 * Otherwise, tell the receiver about the
+				 * compression that the stream now uses.
+				 */
+				raw = !!(fflags & DMU_BACKUP_FEATURE_RAW);
+				if (!raw && rc.rc_type != ZIO_COMPRESS_OFF &&
+				    DMU_GET_STREAM_HDRTYPE(
+				    drrb->drr_versioninfo) == DMU_SUBSTREAM) {
+					fflags |= DMU_BACKUP_FEATURE_COMPRESSED;
+					if (rc.rc_type == ZIO_COMPRESS_LZ4)
+						fflags |=
+						    DMU_BACKUP_FEATURE_LZ4;
+					if (rc.rc_type == ZIO_COMPRESS_ZSTD)
+						fflags |=
+						    DMU_BACKUP_FEATURE_ZSTD;
+					DMU_SET_FEATUREFLAGS(
+					    drrb->drr_versioninfo, fflags);
+				}
+			}
+			recompress_read_payload(rs);
+			rs->rs_raw = raw;
+			rs->rs_done = B_FALSE;
+		}
+
+		(void) pthread_mutex_lock(&rc.rc_lock);
+		if (eof)
+			rc.rc_eof = B_TRUE;
+		else
+			rc.rc_tail++;
+		(void) pthread_cond_broadcast(&rc.rc_work_cv);
+	}
+	(void) pthread_mutex_unlock(&rc.rc_lock);
+
+	for (int i = 0; i < nthreads; i++)
+		VERIFY0(pthread_join(threads[i], NULL));
+
+	if (verbose) {
+		(void) fprintf(stderr, "%llu of %llu WRITE records "
+		    "compressed, payload %llu -> %llu bytes\n",
+		    (u_longlong_t)rc.rc_compressed,
+		    (u_longlong_t)rc.rc_writes,
+		    (u_longlong_t)rc.rc_bytes_in,
+		    (u_longlong_t)rc.rc_bytes_out);
+	}
+
+	for (uint64_t i = 0; i < rc.rc_nslots; i++) {
+		free(rc.rc_slots[i].rs_buf);
+		free(rc.rc_slots[i].rs_tmp);
+	}
+	free(rc.rc_slots);
+	free(threads);
+	VERIFY0(pthread_cond_destroy(&rc.rc_done_cv));
+	VERIFY0(pthread_cond_destroy(&rc.rc_work_cv));
+	VERIFY0(pthread_mutex_destroy(&rc.rc_lock));
+
+	zstd_fini();
+	zio_fini();
+	fletcher_4_fini();
+
+	return (0);
+}
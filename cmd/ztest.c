@@ -115,7 +115,9 @@
 #include <sys/dsl_prop.h>
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_destroy.h>
+#include <sys/dsl_rewrite.h>
 #include <sys/dsl_scan.h>
+#include <sys/ddt.h>
 #include <sys/zio_checksum.h>
 #include <sys/zfs_refcount.h>
 #include <sys/zfeature.h>
@@ -418,6 +420,9 @@ ztest_func_t ztest_device_removal;
 ztest_func_t ztest_spa_checkpoint_create_discard;
 ztest_func_t ztest_initialize;
 ztest_func_t ztest_trim;
+ztest_func_t ztest_rewrite;
+ztest_func_t ztest_ddt_prune;
+ztest_func_t ztest_spacemap_summary;
 ztest_func_t ztest_blake3;
 ztest_func_t ztest_fletcher;
 ztest_func_t ztest_fletcher_incr;
@@ -472,6 +477,9 @@ static ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_spa_checkpoint_create_discard, 1, &zopt_rarely),
 	ZTI_INIT(ztest_initialize, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_trim, 1, &zopt_sometimes),
+	ZTI_INIT(ztest_rewrite, 1, &zopt_sometimes),
+	ZTI_INIT(ztest_ddt_prune, 1, &zopt_sometimes),
+	ZTI_INIT(ztest_spacemap_summary, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_blake3, 1, &zopt_rarely),
 	ZTI_INIT(ztest_fletcher, 1, &zopt_rarely),
 	ZTI_INIT(ztest_fletcher_incr, 1, &zopt_rarely),
@@ -5854,6 +5862,13 @@ ztest_spa_prop_get_set(ztest_ds_t *zd, uint64_t id)
 
 	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_AUTOTRIM, ztest_random(2));
 
+	/*
+	 * Alternate between no DDT quota and a small one, which the DDT will
+	 * often reach.
+	 */
+	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_DEDUP_TABLE_QUOTA,
+	    ztest_random(2) ? 0 : ztest_random(1ULL << 20) + 1);
+
 	VERIFY0(spa_prop_get(ztest_spa, &props));
 
 	if (ztest_opts.zo_verbose >= 6)
@@ -6338,9 +6353,14 @@ ztest_scrub(ztest_ds_t *zd, uint64_t id)
 		return;
 
 	/*
-	 * Start a scrub, wait a moment, then force a restart.
+	 * Start a scrub, which is sometimes limited to the blocks born
+	 * after the last completed scrub, wait a moment, then force a
+	 * restart.
 	 */
-	(void) spa_scan(spa, POOL_SCAN_SCRUB);
+	if (ztest_random(2) == 0)
+		(void) spa_scan_from_last_txg(spa);
+	else
+		(void) spa_scan(spa, POOL_SCAN_SCRUB);
 	(void) poll(NULL, 0, 100);
 
 	error = ztest_scrub_impl(spa);
@@ -6892,6 +6912,109 @@ ztest_trim(ztest_ds_t *zd, uint64_t id)
 	mutex_exit(&ztest_vdev_lock);
 }
 
+/*
+ * Start or stop rewriting the blocks of this thread's dataset, racing the
+ * rewrite against the other tests and against pool export and import.
+ */
+void
+ztest_rewrite(ztest_ds_t *zd, uint64_t id)
+{
+	(void) id;
+	int error;
+
+	if (ztest_random(4) == 0)
+		error = dsl_rewrite_stop(zd->zd_name);
+	else
+		error = dsl_rewrite_start(zd->zd_name);
+
+	switch (error) {
+	case 0:
+	case EBUSY:	/* another dataset is being rewritten */
+	case ENOENT:	/* no rewrite of this dataset to stop */
+		break;
+	case ENOSPC:
+		ztest_record_enospc(FTAG);
+		break;
+	default:
+		fatal(B_FALSE, "rewrite(%s) = %d", zd->zd_name, error);
+	}
+
+	if (ztest_opts.zo_verbose >= 4)
+		(void) printf("rewrite %s = %d\n", zd->zd_name, error);
+}
+
+/*
+ * Prune every unique DDT entry, racing the pruning against dedup writes
+ * and frees of the same blocks.
+ */
+void
+ztest_ddt_prune(ztest_ds_t *zd, uint64_t id)
+{
+	(void) zd, (void) id;
+	int error;
+
+	(void) pthread_rwlock_rdlock(&ztest_name_lock);
+
+	error = ddt_prune_unique_entries(ztest_spa, 0);
+	if (error == ENOSPC)
+		ztest_record_enospc(FTAG);
+	else if (error != 0)
+		fatal(B_FALSE, "ddt_prune_unique_entries() = %d", error);
+
+	(void) pthread_rwlock_unlock(&ztest_name_lock);
+}
+
+/*
+ * Verify that a metaslab's space map summary is invalidated by changes to
+ * the space map that do not update it, as older software makes them.
+ * The changes are made to a copy of the space map header.
+ */
+void
+ztest_spacemap_summary(ztest_ds_t *zd, uint64_t id)
+{
+	(void) zd, (void) id;
+	spa_t *spa = ztest_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+
+	vdev_t *vd = rvd->vdev_child[ztest_random(rvd->vdev_children)];
+	if (vd->vdev_ms == NULL || vd->vdev_ms_count == 0) {
+		spa_config_exit(spa, SCL_VDEV, FTAG);
+		return;
+	}
+	metaslab_t *msp = vd->vdev_ms[ztest_random(vd->vdev_ms_count)];
+
+	mutex_enter(&msp->ms_sync_lock);
+	mutex_enter(&msp->ms_lock);
+	if (msp->ms_sm != NULL && space_map_summary_get(msp->ms_sm, NULL)) {
+		space_map_t sm = *msp->ms_sm;
+		space_map_phys_t smp = *msp->ms_sm->sm_phys;
+		int i = ztest_random(SPACE_MAP_HISTOGRAM_SIZE);
+
+		sm.sm_phys = &smp;
+		VERIFY(space_map_summary_get(&sm, NULL));
+
+		smp.smp_length += sizeof (uint64_t);
+		VERIFY(!space_map_summary_get(&sm, NULL));
+		smp.smp_length -= sizeof (uint64_t);
+
+		smp.smp_alloc += 1ULL << sm.sm_shift;
+		VERIFY(!space_map_summary_get(&sm, NULL));
+		smp.smp_alloc -= 1ULL << sm.sm_shift;
+
+		smp.smp_histogram[i]++;
+		VERIFY(!space_map_summary_get(&sm, NULL));
+		smp.smp_histogram[i]--;
+
+		VERIFY(space_map_summary_get(&sm, NULL));
+	}
+	mutex_exit(&msp->ms_lock);
+	mutex_exit(&msp->ms_sync_lock);
+
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+}
+
 /*
  * Verify pool integrity by running zdb.
  */
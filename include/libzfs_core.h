@@ -84,6 +84,8 @@ enum lzc_send_flags {
 	LZC_SEND_FLAG_COMPRESS = 1 << 2,
 	LZC_SEND_FLAG_RAW = 1 << 3,
 	LZC_SEND_FLAG_SAVED = 1 << 4,
+	LZC_SEND_FLAG_STREAM_LZ4 = 1 << 5,
+	LZC_SEND_FLAG_STREAM_ZSTD = 1 << 6,
 };
 
 _LIBZFS_CORE_H int lzc_send_wrapper(int (*)(int, void *), int, void *);
@@ -155,6 +157,9 @@ _LIBZFS_CORE_H int lzc_get_bootenv(const char *, nvlist_t **);
 _LIBZFS_CORE_H int lzc_get_vdev_prop(const char *, nvlist_t *, nvlist_t **);
 _LIBZFS_CORE_H int lzc_set_vdev_prop(const char *, nvlist_t *, nvlist_t **);
 
+_LIBZFS_CORE_H int lzc_rewrite(const char *, zfs_rewrite_func_t);
+_LIBZFS_CORE_H int lzc_ddt_prune(const char *, uint64_t);
+
 #ifdef	__cplusplus
 }
 #endif
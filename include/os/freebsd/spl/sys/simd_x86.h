@@ -173,6 +173,16 @@ zfs_avx2_available(void)
 	return (has_avx2 && __ymm_enabled());
 }
 
+/*
+ * Check if GFNI instruction set is available.  Only the legacy SSE encoded
+ * instructions are implied; check AVX or AVX512F for the wider forms.
+ */
+static inline boolean_t
+zfs_gfni_available(void)
+{
+	return ((cpu_stdext_feature2 & CPUID_STDEXT2_GFNI) != 0);
+}
+
 /*
  * AVX-512 family of instruction sets:
  *
@@ -53,6 +53,8 @@
  *	zfs_bmi1_available()
  *	zfs_bmi2_available()
  *
+ *	zfs_gfni_available()
+ *
  *	zfs_avx512f_available()
  *	zfs_avx512cd_available()
  *	zfs_avx512er_available()
@@ -586,6 +588,20 @@ zfs_movbe_available(void)
 #endif
 }
 
+/*
+ * Check if GFNI instruction set is available.  Only the legacy SSE encoded
+ * instructions are implied; check AVX or AVX512F for the wider forms.
+ */
+static inline boolean_t
+zfs_gfni_available(void)
+{
+#if defined(X86_FEATURE_GFNI)
+	return (!!boot_cpu_has(X86_FEATURE_GFNI));
+#else
+	return (B_FALSE);
+#endif
+}
+
 /*
  * AVX-512 family of instruction sets:
  *
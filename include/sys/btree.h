@@ -105,8 +105,13 @@ typedef struct zfs_btree_index {
 	boolean_t	bti_before;
 } zfs_btree_index_t;
 
-typedef struct btree {
+typedef struct btree zfs_btree_t;
+typedef void * (*bt_find_in_buf_f) (zfs_btree_t *, uint8_t *, uint32_t,
+    const void *, zfs_btree_index_t *);
+
+struct btree {
 	int (*bt_compar) (const void *, const void *);
+	bt_find_in_buf_f	bt_find_in_buf;
 	size_t			bt_elem_size;
 	size_t			bt_leaf_size;
 	uint32_t		bt_leaf_cap;
@@ -115,7 +120,42 @@ typedef struct btree {
 	uint64_t		bt_num_nodes;
 	zfs_btree_hdr_t		*bt_root;
 	zfs_btree_leaf_t	*bt_bulk; // non-null if bulk loading
-} zfs_btree_t;
+};
+
+/*
+ * Implements a branch-free binary search of the elements of a node, for use
+ * as the bt_find_in_buf function of trees whose elements are of type T and
+ * compared by COMP.  Because COMP is called directly rather than through
+ * bt_compar it can be inlined.  Without branches the CPU can no longer
+ * speculate the next load, so both possible next probes are prefetched
+ * instead.  That loses to the generic search when lookups are predictable,
+ * so measure before using it (see btree_test -b).  This must be expanded
+ * in the file which defines COMP.
+ */
+#define	ZFS_BTREE_FIND_IN_BUF_FUNC(NAME, T, COMP)			\
+static void *								\
+NAME(zfs_btree_t *tree, uint8_t *buf, uint32_t nelems,			\
+    const void *value, zfs_btree_index_t *where)			\
+{									\
+	T *i = (T *)buf;						\
+	(void) tree;							\
+	if (nelems == 0) {						\
+		where->bti_offset = 0;					\
+		where->bti_before = B_TRUE;				\
+		return (NULL);						\
+	}								\
+	while (nelems > 1) {						\
+		uint32_t half = nelems / 2;				\
+		nelems -= half;						\
+		__builtin_prefetch(&i[nelems / 2]);			\
+		__builtin_prefetch(&i[half + nelems / 2]);		\
+		i += (COMP(&i[half - 1], value) < 0) * half;		\
+	}								\
+	int comp = COMP(i, value);					\
+	where->bti_offset = (i - (T *)buf) + (comp < 0);		\
+	where->bti_before = (comp != 0);				\
+	return (comp == 0 ? i : NULL);					\
+}
 
 /*
  * Allocate and deallocate caches for btree nodes.
@@ -129,13 +169,16 @@ void zfs_btree_fini(void);
  * tree   - the tree to be initialized
  * compar - function to compare two nodes, it must return exactly: -1, 0, or +1
  *          -1 for <, 0 for ==, and +1 for >
+ * find   - optional function to search the elements of a node, usually
+ *          generated with ZFS_BTREE_FIND_IN_BUF_FUNC; NULL uses a binary
+ *          search calling compar
  * size   - the value of sizeof(struct my_type)
  * lsize  - custom leaf size
  */
 void zfs_btree_create(zfs_btree_t *, int (*) (const void *, const void *),
-    size_t);
+    bt_find_in_buf_f, size_t);
 void zfs_btree_create_custom(zfs_btree_t *, int (*)(const void *, const void *),
-    size_t, size_t);
+    bt_find_in_buf_f, size_t, size_t);
 
 /*
  * Find a node with a matching value in the tree. Returns the matching node
@@ -131,26 +131,111 @@ struct ddt_entry {
 	avl_node_t	dde_node;
 };
 
+/*
+ * Number of physical entries kept by the DDT log.  Entries that have been
+ * synced never have a DDT_PHYS_DITTO entry, so the log only keeps the
+ * entries from DDT_PHYS_SINGLE on.
+ */
+#define	DDT_LOG_PHYS_TYPES	(DDT_PHYS_TYPES - DDT_PHYS_SINGLE)
+
+/*
+ * On-disk DDT log record.  The log holds after-images: the last record for
+ * a key supersedes any earlier record for it and any entry in the DDT
+ * objects.  A record whose physical entries are all empty removes the key.
+ */
+typedef struct ddt_log_record {
+	ddt_key_t	dlr_key;
+	ddt_phys_t	dlr_phys[DDT_LOG_PHYS_TYPES];
+} ddt_log_record_t;
+
+/*
+ * On-disk DDT log header, stored in the bonus buffer of the log object.
+ */
+typedef struct ddt_log_phys {
+	uint64_t	dlp_length;	/* bytes of records in the log */
+	uint64_t	dlp_first_txg;	/* txg of the first record */
+} ddt_log_phys_t;
+
+/*
+ * On-disk sample of the pool's txg-to-time map, used to find the DDT
+ * entries older than a given age.  The number of samples is stored in the
+ * bonus buffer of the object.
+ */
+typedef struct ddt_txg_time {
+	uint64_t	dtt_txg;
+	uint64_t	dtt_time;	/* seconds since the epoch */
+} ddt_txg_time_t;
+
+/*
+ * In-core DDT log entry.  This is the compact, fixed-size form in which
+ * entries are cached between txgs.  The entry's key must be its first
+ * member, so that it can be compared with ddt_entry_compare().
+ */
+typedef struct ddt_log_entry {
+	ddt_key_t	dle_key;
+	ddt_phys_t	dle_phys[DDT_LOG_PHYS_TYPES];
+	uint8_t		dle_type;	/* DDT object holding the key, */
+	uint8_t		dle_class;	/* or DDT_TYPES if there is none */
+	avl_node_t	dle_node;
+} ddt_log_entry_t;
+
+/*
+ * In-core DDT log.  Each DDT has two: new records are appended to the
+ * active log while the entries of the flushing log are written into the
+ * DDT objects a few at a time, in key order.  Once the flushing log is
+ * empty, the two are swapped.
+ */
+typedef struct ddt_log {
+	avl_tree_t	ddl_tree;	/* latest entry for each key */
+	uint64_t	ddl_object;	/* on-disk log object */
+	uint64_t	ddl_length;	/* bytes of records */
+	uint64_t	ddl_first_txg;	/* txg of the first record */
+} ddt_log_t;
+
+/*
+ * The in-core entries of a DDT which are being changed in the syncing txg
+ * are split into shards by the hash of their key, each with its own lock,
+ * so that concurrent dedup writes and frees rarely contend.
+ */
+#define	DDT_SHARD_SHIFT		5
+#define	DDT_SHARDS		(1 << DDT_SHARD_SHIFT)
+
+typedef struct ddt_shard {
+	kmutex_t	dds_lock;
+	avl_tree_t	dds_tree;
+} ____cacheline_aligned ddt_shard_t;
+
 /*
  * In-core ddt
  */
 struct ddt {
-	kmutex_t	ddt_lock;
-	avl_tree_t	ddt_tree;
+	ddt_shard_t	ddt_shard[DDT_SHARDS];
+	kmutex_t	ddt_lock;		/* protects ddt_repair_tree */
 	avl_tree_t	ddt_repair_tree;
 	enum zio_checksum ddt_checksum;
 	spa_t		*ddt_spa;
 	objset_t	*ddt_os;
 	uint64_t	ddt_stat_object;
 	uint64_t	ddt_object[DDT_TYPES][DDT_CLASSES];
+	kmutex_t	ddt_stat_lock;		/* protects ddt_histogram */
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	krwlock_t	ddt_log_lock;		/* protects the DDT log */
+	ddt_log_t	ddt_log[2];
+	ddt_log_t	*ddt_log_active;	/* log being appended to */
+	ddt_log_t	*ddt_log_flushing;	/* log being flushed */
+	uint64_t	ddt_log_flush_rate;	/* entries flushed per txg */
+	uint64_t	ddt_log_flush_txg;	/* last txg flushed */
+	uint64_t	ddt_log_drain_swaps;	/* swaps while draining */
+	uint64_t	ddt_log_walk_cursor;	/* ddt_walk() resume hint */
+	ddt_log_entry_t	*ddt_log_walk_entry;
 	avl_node_t	ddt_node;
 };
 
 /*
- * In-core and on-disk bookmark for DDT walks
+ * In-core and on-disk bookmark for DDT walks.  A ddb_type of DDT_TYPES
+ * walks the entries which are only in the DDT log.
  */
 typedef struct ddt_bookmark {
 	uint64_t	ddb_class;
@@ -219,13 +304,16 @@ extern void ddt_get_dedup_stats(spa_t *spa, ddt_stat_t *dds_total);
 
 extern uint64_t ddt_get_dedup_dspace(spa_t *spa);
 extern uint64_t ddt_get_pool_dedup_ratio(spa_t *spa);
+extern uint64_t ddt_get_ddt_dsize(spa_t *spa);
+extern boolean_t ddt_over_quota(spa_t *spa);
 
 extern size_t ddt_compress(void *src, uchar_t *dst, size_t s_len, size_t d_len);
 extern void ddt_decompress(uchar_t *src, void *dst, size_t s_len, size_t d_len);
 
 extern ddt_t *ddt_select(spa_t *spa, const blkptr_t *bp);
-extern void ddt_enter(ddt_t *ddt);
-extern void ddt_exit(ddt_t *ddt);
+extern void ddt_enter(ddt_t *ddt, const ddt_key_t *ddk);
+extern void ddt_exit(ddt_t *ddt, const ddt_key_t *ddk);
+extern uint64_t ddt_numnodes(ddt_t *ddt);
 extern void ddt_init(void);
 extern void ddt_fini(void);
 extern ddt_entry_t *ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add);
@@ -244,7 +332,10 @@ extern void ddt_create(spa_t *spa);
 extern int ddt_load(spa_t *spa);
 extern void ddt_unload(spa_t *spa);
 extern void ddt_sync(spa_t *spa, uint64_t txg);
+extern boolean_t ddt_log_drained(spa_t *spa);
+extern void ddt_log_name(ddt_t *ddt, int n, char *name);
 extern int ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde);
+extern int ddt_prune_unique_entries(spa_t *spa, uint64_t days);
 extern int ddt_object_update(ddt_t *ddt, enum ddt_type type,
     enum ddt_class clazz, ddt_entry_t *dde, dmu_tx_t *tx);
 
@@ -0,0 +1,57 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_DSL_REWRITE_H
+#define	_SYS_DSL_REWRITE_H
+
+#include <sys/spa.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * On-disk state of a block rewrite, stored in the MOS directory as
+ * DMU_POOL_REWRITE. At most one dataset per pool is rewritten at a time.
+ * When adding new fields they must be added to the end of the structure.
+ */
+typedef struct dsl_rewrite_phys {
+	uint64_t	drp_state;	/* dsl_scan_state_t */
+	uint64_t	drp_dsobj;	/* dataset being rewritten */
+	uint64_t	drp_max_txg;	/* blocks born after this are new */
+	uint64_t	drp_object;	/* resume object */
+	uint64_t	drp_offset;	/* resume offset within drp_object */
+	uint64_t	drp_start_time;	/* start time */
+	uint64_t	drp_end_time;	/* end time */
+	uint64_t	drp_blocks;	/* blocks rewritten */
+	uint64_t	drp_bytes;	/* logical bytes rewritten */
+} dsl_rewrite_phys_t;
+
+extern int dsl_rewrite_init(spa_t *spa);
+extern void dsl_rewrite_start_thread(spa_t *spa);
+extern int dsl_rewrite_start(const char *dsname);
+extern int dsl_rewrite_stop(const char *dsname);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DSL_REWRITE_H */
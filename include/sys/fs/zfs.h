@@ -253,6 +253,8 @@ typedef enum {
 	ZPOOL_PROP_LOAD_GUID,
 	ZPOOL_PROP_AUTOTRIM,
 	ZPOOL_PROP_COMPATIBILITY,
+	ZPOOL_PROP_DEDUP_TABLE_SIZE,
+	ZPOOL_PROP_DEDUP_TABLE_QUOTA,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -1036,6 +1038,7 @@ typedef enum pool_scan_func {
 typedef enum pool_scrub_cmd {
 	POOL_SCRUB_NORMAL = 0,
 	POOL_SCRUB_PAUSE,
+	POOL_SCRUB_FROM_LAST_TXG,
 	POOL_SCRUB_FLAGS_END
 } pool_scrub_cmd_t;
 
@@ -1090,6 +1093,8 @@ typedef struct pool_scan_stat {
 	uint64_t	pss_pass_scrub_spent_paused;
 	uint64_t	pss_pass_issued; /* issued bytes per scan pass */
 	uint64_t	pss_issued;	/* total bytes checked by scanner */
+	/* % of the scan I/O limit left by the latency throttle */
+	uint64_t	pss_issue_limit_pct;
 } pool_scan_stat_t;
 
 typedef struct pool_removal_stat {
@@ -1269,6 +1274,15 @@ typedef enum pool_trim_func {
 	POOL_TRIM_FUNCS
 } pool_trim_func_t;
 
+/*
+ * Block rewrite functions.
+ */
+typedef enum zfs_rewrite_func {
+	ZFS_REWRITE_START,
+	ZFS_REWRITE_STOP,
+	ZFS_REWRITE_FUNCS
+} zfs_rewrite_func_t;
+
 /*
  * DDT statistics.  Note: all fields should be 64-bit because this
  * is passed between kernel and userland as an nvlist uint64 array.
@@ -1445,6 +1459,8 @@ typedef enum zfs_ioc {
 	ZFS_IOC_WAIT_FS,			/* 0x5a54 */
 	ZFS_IOC_VDEV_GET_PROPS,			/* 0x5a55 */
 	ZFS_IOC_VDEV_SET_PROPS,			/* 0x5a56 */
+	ZFS_IOC_REWRITE,			/* 0x5a57 */
+	ZFS_IOC_DDT_PRUNE,			/* 0x5a58 */
 
 	/*
 	 * Per-platform (Optional) - 8/128 numbers reserved.
@@ -1649,6 +1665,17 @@ typedef enum {
 #define	ZFS_WAIT_ACTIVITY		"wait_activity"
 #define	ZFS_WAIT_WAITED			"wait_waited"
 
+/*
+ * The following are names used when invoking ZFS_IOC_REWRITE.
+ */
+#define	ZFS_REWRITE_COMMAND		"rewrite_command"
+
+/*
+ * The following are names used when invoking ZFS_IOC_DDT_PRUNE.
+ */
+#define	DDT_PRUNE_DAYS			"ddt_prune_days"
+#define	DDT_PRUNE_DAYS_MAX		36500
+
 /*
  * Flags for ZFS_IOC_VDEV_SET_STATE
  */
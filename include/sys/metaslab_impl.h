@@ -202,6 +202,9 @@ struct metaslab_class {
 	uint64_t		mc_dspace;	/* total deflated space */
 	uint64_t		mc_histogram[RANGE_TREE_HISTOGRAM_SIZE];
 
+	/* moving average of allocating write latency (ns) */
+	uint64_t		mc_write_latency;
+
 	/*
 	 * List of all loaded metaslabs in the class, sorted in order of most
 	 * recent use.
@@ -247,6 +250,14 @@ struct metaslab_group {
 
 	uint64_t		mg_free_capacity;	/* percentage free */
 	int64_t			mg_bias;
+
+	/*
+	 * Moving average of the time taken to complete allocating writes
+	 * to this group in nanoseconds, and the part of mg_bias derived
+	 * from it.  See metaslab_group_latency_bias().
+	 */
+	uint64_t		mg_write_latency;
+	int64_t			mg_latency_bias;
 	int64_t			mg_activation_count;
 	metaslab_class_t	*mg_class;
 	vdev_t			*mg_vd;
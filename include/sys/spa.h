@@ -819,6 +819,7 @@ extern void spa_l2cache_drop(spa_t *spa);
 
 /* scanning */
 extern int spa_scan(spa_t *spa, pool_scan_func_t func);
+extern int spa_scan_from_last_txg(spa_t *spa);
 extern int spa_scan_stop(spa_t *spa);
 extern int spa_scrub_pause_resume(spa_t *spa, pool_scrub_cmd_t flag);
 
@@ -900,6 +901,10 @@ typedef struct spa_stats {
 	spa_history_kstat_t	state;		/* pool state */
 	spa_history_kstat_t	guid;		/* pool guid */
 	spa_history_kstat_t	iostats;
+	spa_history_kstat_t	mirror;		/* mirror read balance */
+	spa_history_kstat_t	queue;		/* vdev queue deadlines */
+	spa_history_kstat_t	latency;	/* metaslab write latency */
+	spa_history_kstat_t	rewrite;	/* block rewrite progress */
 } spa_stats_t;
 
 typedef enum txg_state {
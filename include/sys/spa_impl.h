@@ -51,6 +51,7 @@
 #include <sys/zfeature.h>
 #include <sys/zthr.h>
 #include <sys/dsl_deadlist.h>
+#include <sys/dsl_rewrite.h>
 #include <zfeature_common.h>
 
 #ifdef	__cplusplus
@@ -333,6 +334,11 @@ struct spa {
 	uint64_t	spa_livelists_to_delete; /* set of livelists to free */
 	livelist_condense_entry_t	spa_to_condense; /* next to condense */
 
+	dsl_rewrite_phys_t spa_rewrite_phys;	/* on-disk rewrite state */
+	dsl_rewrite_phys_t spa_rewrite_progress[TXG_SIZE]; /* per-txg */
+	kmutex_t	spa_rewrite_lock;	/* protects the above */
+	zthr_t		*spa_rewrite_zthr;	/* zthr doing rewrite */
+
 	char		*spa_root;		/* alternate root directory */
 	uint64_t	spa_ena;		/* spa-wide ereport ENA */
 	int		spa_last_open_failed;	/* error if last open failed */
@@ -379,6 +385,11 @@ struct spa {
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_dspace;	/* Cache get_dedup_dspace() */
 	uint64_t	spa_dedup_checksum;	/* default dedup checksum */
+	uint64_t	spa_dedup_table_quota;	/* property DDT maximum size */
+	uint64_t	spa_dedup_dsize;	/* cached on-disk size of DDT */
+	uint64_t	spa_ddt_txg_time_object; /* DDT txg-to-time map */
+	uint64_t	spa_ddt_txg_time_count;	/* samples in the map */
+	uint64_t	spa_ddt_txg_time_last;	/* time of the last sample */
 	uint64_t	spa_dspace;		/* dspace in normal class */
 	kmutex_t	spa_vdev_top_lock;	/* dueling offline/remove */
 	kmutex_t	spa_proc_lock;		/* protects spa_proc* */
@@ -46,6 +46,11 @@ extern "C" {
 #define	SPACE_MAP_SIZE_V0	(3 * sizeof (uint64_t))
 #define	SPACE_MAP_HISTOGRAM_SIZE	32
 
+/*
+ * Number of largest free segment sizes recorded in the space map summary.
+ */
+#define	SPACE_MAP_SUMMARY_SIZE	3
+
 /*
  * The space_map_phys is the on-disk representation of the space map.
  * Consumers of space maps should never reference any of the members of this
@@ -64,8 +69,23 @@ typedef struct space_map_phys {
 	/* space allocated from the map */
 	int64_t		smp_alloc;
 
-	/* reserved */
-	uint64_t	smp_pad[5];
+	/*
+	 * Summary of the largest free regions, recorded by the metaslab
+	 * code whenever the map is synced while loaded in-core (see
+	 * metaslab_sync()). smp_max_free holds the sizes of the largest
+	 * free regions in descending order as of smp_summary_txg. They
+	 * are lower bounds, since regions freed afterwards may have grown
+	 * them, but nothing can be allocated without loading the map.
+	 *
+	 * These words were reserved (and zero) in older versions, which
+	 * update the histogram without maintaining the summary. The
+	 * summary is therefore only valid while smp_summary_check matches
+	 * a checksum of smp_length, smp_alloc and smp_histogram [see
+	 * space_map_summary_get()].
+	 */
+	uint64_t	smp_summary_check;
+	uint64_t	smp_summary_txg;
+	uint64_t	smp_max_free[SPACE_MAP_SUMMARY_SIZE];
 
 	/*
 	 * The smp_histogram maintains a histogram of free regions. Each
@@ -220,6 +240,10 @@ void space_map_histogram_clear(space_map_t *sm);
 void space_map_histogram_add(space_map_t *sm, range_tree_t *rt,
     dmu_tx_t *tx);
 
+boolean_t space_map_summary_get(space_map_t *sm, uint64_t *max_free);
+void space_map_summary_set(space_map_t *sm, const uint64_t *max_free,
+    dmu_tx_t *tx);
+
 uint64_t space_map_object(space_map_t *sm);
 int64_t space_map_allocated(space_map_t *sm);
 uint64_t space_map_length(space_map_t *sm);
@@ -172,6 +172,10 @@ struct vdev_queue {
 	uint32_t	vq_nia_credit;	/* Non-interactive I/Os credit. */
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
+	/* I/Os completed later than their class deadline. */
+	uint64_t	vq_deadline_missed[ZIO_PRIORITY_NUM_QUEUEABLE];
+	/* Latency of sync I/Os completed since last collected by the scan. */
+	uint64_t	vq_sync_lat_histo[VDEV_L_HISTO_BUCKETS];
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
 };
@@ -278,6 +282,14 @@ struct vdev {
 	kthread_t	*vdev_validate_thread; /* thread validating children */
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
 
+	/*
+	 * Mirror child read balancing, see vdev_mirror_child_select().
+	 * Updated without locking; a lost sample is harmless.
+	 */
+	uint64_t	vdev_mirror_lat_ewma; /* read latency EWMA (ns)	*/
+	hrtime_t	vdev_mirror_lat_ts; /* time of last latency sample */
+	uint64_t	vdev_mirror_reads; /* reads directed to this child */
+
 	/*
 	 * Top-level vdev state.
 	 */
@@ -57,20 +57,39 @@ typedef struct vdev_rebuild_phys {
 	uint64_t	vrp_errors;		/* errors during rebuild */
 } vdev_rebuild_phys_t;
 
+struct vdev_rebuild;
+
+/*
+ * Each rebuild worker scans one metaslab at a time.  Metaslabs are handed
+ * out in order so the lowest offset of all active workers is the point
+ * below which everything has been rebuilt.
+ */
+typedef struct vdev_rebuild_worker {
+	struct vdev_rebuild *vrw_rebuild;	/* owning rebuild */
+	metaslab_t	*vrw_scan_msp;		/* scanning disabled metaslab */
+	range_tree_t	*vrw_scan_tree;		/* scan ranges (in metaslab) */
+	uint64_t	vrw_offset;		/* next offset to issue */
+	boolean_t	vrw_active;		/* scanning vrw_scan_msp */
+} vdev_rebuild_worker_t;
+
 /*
  * The vdev_rebuild_t describes the current state and how a top-level vdev
- * should be rebuilt.  The core elements are the top-vdev, the metaslab being
- * rebuilt, range tree containing the allocated extents and the on-disk state.
+ * should be rebuilt.  The core elements are the top-vdev, the workers and
+ * the metaslabs they are rebuilding, and the on-disk state.
  */
 typedef struct vdev_rebuild {
 	vdev_t		*vr_top_vdev;		/* top-level vdev to rebuild */
-	metaslab_t	*vr_scan_msp;		/* scanning disabled metaslab */
-	range_tree_t	*vr_scan_tree;		/* scan ranges (in metaslab) */
+	vdev_rebuild_worker_t *vr_workers;	/* per-worker scan state */
+	int		vr_nworkers;		/* number of workers */
+	int		vr_error;		/* first worker error */
+	uint64_t	vr_next_ms;		/* next metaslab to scan */
+	uint64_t	vr_update_est_time;	/* last bytes_est update */
 	kmutex_t	vr_io_lock;		/* inflight IO lock */
 	kcondvar_t	vr_io_cv;		/* inflight IO cv */
 
 	/* In-core state and progress */
 	uint64_t	vr_scan_offset[TXG_SIZE];
+	uint64_t	vr_scan_txg;		/* newest txg issued to */
 	uint64_t	vr_prev_scan_time_ms;	/* any previous scan time */
 	uint64_t	vr_bytes_inflight_max;	/* maximum bytes inflight */
 	uint64_t	vr_bytes_inflight;	/* current bytes inflight */
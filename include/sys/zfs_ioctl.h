@@ -212,6 +212,15 @@ typedef enum dmu_send_resume_token_version {
 #define	DRR_RAW_BYTESWAP	(1<<1)
 #define	DRR_OBJECT_SPILL	(1<<2) /* OBJECT record has a spill block */
 #define	DRR_SPILL_UNMODIFIED	(1<<2) /* SPILL record for unmodified block */
+/*
+ * The payload of this WRITE record was compressed by zfs send
+ * (--stream-compress) rather than being sent as it is stored on disk.  The
+ * receiver decompresses it and writes the block as if it had been sent
+ * uncompressed, so it is compressed according to the target's properties.
+ * Receivers which do not know this flag store the block compressed with
+ * drr_compressiontype, as for any other compressed WRITE record.
+ */
+#define	DRR_WRITE_STREAM_COMPRESSED	(1<<3)
 
 #define	DRR_IS_DEDUP_CAPABLE(flags)	((flags) & DRR_CHECKSUM_DEDUP)
 #define	DRR_IS_RAW_BYTESWAPPED(flags)	((flags) & DRR_RAW_BYTESWAP)
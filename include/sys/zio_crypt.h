@@ -42,6 +42,9 @@ struct zbookmark_phys;
 
 #define	ZIO_CRYPT_KEY_CURRENT_VERSION	1ULL
 
+/* number of previous-salt keys kept with prebuilt templates per key */
+#define	ZIO_CRYPT_TMPL_CACHE_SIZE	8
+
 typedef enum zio_crypt_type {
 	ZC_TYPE_NONE = 0,
 	ZC_TYPE_CCM,
@@ -72,6 +75,27 @@ typedef struct zio_crypt_info {
 
 extern const zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS];
 
+#if !defined(__FreeBSD__) || !defined(_KERNEL)
+/*
+ * Encryption key derived from a salt other than the current one, kept
+ * together with its prebuilt context template so that blocks written
+ * under older salts do not pay for HKDF and the key schedule every time.
+ */
+typedef struct zio_crypt_tmpl_ent {
+	/* salt this entry was derived from */
+	uint8_t zte_salt[ZIO_DATA_SALT_LEN];
+
+	/* buffer for the derived encryption key */
+	uint8_t zte_keydata[MASTER_KEY_MAX_LEN];
+
+	/* illumos crypto api key, ck_data is NULL for an unused entry */
+	crypto_key_t zte_key;
+
+	/* template of the derived key for illumos crypto api */
+	crypto_ctx_template_t zte_tmpl;
+} zio_crypt_tmpl_ent_t;
+#endif
+
 /* in memory representation of an unwrapped key that is loaded into memory */
 typedef struct zio_crypt_key {
 	/* encryption algorithm */
@@ -107,6 +131,12 @@ typedef struct zio_crypt_key {
 #else
 	/* template of current encryption key for illumos crypto api */
 	crypto_ctx_template_t zk_current_tmpl;
+
+	/* keys and templates for recently used non-current salts */
+	zio_crypt_tmpl_ent_t zk_tmpl_cache[ZIO_CRYPT_TMPL_CACHE_SIZE];
+
+	/* next zk_tmpl_cache slot to replace */
+	uint_t zk_tmpl_cache_next;
 #endif
 
 	/* illumos crypto api current hmac key */
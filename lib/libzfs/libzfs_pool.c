@@ -346,6 +346,25 @@ zpool_get_prop(zpool_handle_t *zhp, zpool_prop_t prop, char *buf,
 				(void) zfs_nicenum(intval, buf, len);
 			break;
 
+		case ZPOOL_PROP_DEDUP_TABLE_SIZE:
+			if (literal)
+				(void) snprintf(buf, len, "%llu",
+				    (u_longlong_t)intval);
+			else
+				(void) zfs_nicebytes(intval, buf, len);
+			break;
+
+		case ZPOOL_PROP_DEDUP_TABLE_QUOTA:
+			if (intval == 0) {
+				(void) strlcpy(buf, "none", len);
+			} else if (literal) {
+				(void) snprintf(buf, len, "%llu",
+				    (u_longlong_t)intval);
+			} else {
+				(void) zfs_nicebytes(intval, buf, len);
+			}
+			break;
+
 		case ZPOOL_PROP_EXPANDSZ:
 		case ZPOOL_PROP_CHECKPOINT:
 			if (intval == 0) {
@@ -2560,10 +2579,10 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func, pool_scrub_cmd_t cmd)
 
 	/* ECANCELED on a scrub means we resumed a paused scrub */
 	if (err == ECANCELED && func == POOL_SCAN_SCRUB &&
-	    cmd == POOL_SCRUB_NORMAL)
+	    cmd != POOL_SCRUB_PAUSE)
 		return (0);
 
-	if (err == ENOENT && func != POOL_SCAN_NONE && cmd == POOL_SCRUB_NORMAL)
+	if (err == ENOENT && func != POOL_SCAN_NONE && cmd != POOL_SCRUB_PAUSE)
 		return (0);
 
 	if (func == POOL_SCAN_SCRUB) {
@@ -2572,7 +2591,8 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func, pool_scrub_cmd_t cmd)
 			    dgettext(TEXT_DOMAIN, "cannot pause scrubbing %s"),
 			    zc.zc_name);
 		} else {
-			assert(cmd == POOL_SCRUB_NORMAL);
+			assert(cmd == POOL_SCRUB_NORMAL ||
+			    cmd == POOL_SCRUB_FROM_LAST_TXG);
 			(void) snprintf(errbuf, sizeof (errbuf),
 			    dgettext(TEXT_DOMAIN, "cannot scrub %s"),
 			    zc.zc_name);
@@ -3952,6 +3972,27 @@ zpool_reguid(zpool_handle_t *zhp)
 	return (zpool_standard_error(hdl, errno, errbuf));
 }
 
+/*
+ * Prune the unique entries older than the given number of days from the
+ * pool's dedup tables.
+ */
+int
+zpool_ddt_prune(zpool_handle_t *zhp, uint64_t days)
+{
+	char errbuf[ERRBUFLEN];
+	int error;
+
+	error = lzc_ddt_prune(zhp->zpool_name, days);
+	if (error == 0)
+		return (0);
+
+	(void) snprintf(errbuf, sizeof (errbuf),
+	    dgettext(TEXT_DOMAIN, "cannot prune dedup table on '%s'"),
+	    zhp->zpool_name);
+
+	return (zpool_standard_error(zhp->zpool_hdl, error, errbuf));
+}
+
 /*
  * Reopen the pool.
  */
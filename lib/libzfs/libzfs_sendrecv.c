@@ -733,6 +733,7 @@ typedef struct send_dump_data {
 	boolean_t seenfrom, seento, replicate, doall, fromorigin;
 	boolean_t dryrun, parsable, progress, embed_data, std_out;
 	boolean_t large_block, compress, raw, holds;
+	boolean_t stream_lz4, stream_zstd;
 	int outfd;
 	boolean_t err;
 	nvlist_t *fss;
@@ -1083,6 +1084,10 @@ dump_snapshot(zfs_handle_t *zhp, void *arg)
 		flags |= LZC_SEND_FLAG_COMPRESS;
 	if (sdd->raw)
 		flags |= LZC_SEND_FLAG_RAW;
+	if (sdd->stream_lz4)
+		flags |= LZC_SEND_FLAG_STREAM_LZ4;
+	if (sdd->stream_zstd)
+		flags |= LZC_SEND_FLAG_STREAM_ZSTD;
 
 	if (!sdd->doall && !isfromsnap && !istosnap) {
 		if (sdd->replicate) {
@@ -1499,6 +1504,10 @@ lzc_flags_from_sendflags(const sendflags_t *flags)
 		lzc_flags |= LZC_SEND_FLAG_RAW;
 	if (flags->saved)
 		lzc_flags |= LZC_SEND_FLAG_SAVED;
+	if (flags->stream_lz4)
+		lzc_flags |= LZC_SEND_FLAG_STREAM_LZ4;
+	if (flags->stream_zstd)
+		lzc_flags |= LZC_SEND_FLAG_STREAM_ZSTD;
 
 	return (lzc_flags);
 }
@@ -2288,6 +2297,8 @@ zfs_send_cb_impl(zfs_handle_t *zhp, const char *fromsnap, const char *tosnap,
 	sdd.embed_data = flags->embed_data;
 	sdd.compress = flags->compress;
 	sdd.raw = flags->raw;
+	sdd.stream_lz4 = flags->stream_lz4;
+	sdd.stream_zstd = flags->stream_zstd;
 	sdd.holds = flags->holds;
 	sdd.filter_cb = filter_func;
 	sdd.filter_cb_arg = cb_arg;
@@ -746,6 +746,11 @@ lzc_send_wrapper(int (*func)(int, void *), int orig_fd, void *data)
  * If "flags" contains LZC_SEND_FLAG_RAW, the stream is generated, for encrypted
  * datasets, by sending data exactly as it exists on disk.  This allows backups
  * to be taken even if encryption keys are not currently loaded.
+ *
+ * If "flags" contains LZC_SEND_FLAG_STREAM_LZ4 or LZC_SEND_FLAG_STREAM_ZSTD,
+ * WRITE records which would otherwise be sent uncompressed have their payload
+ * compressed with that algorithm.  The receiving system decompresses them
+ * again, so the received blocks are compressed according to its properties.
  */
 int
 lzc_send(const char *snapname, const char *from, int fd,
@@ -807,6 +812,10 @@ lzc_send_resume_redacted_cb_impl(const char *snapname, const char *from, int fd,
 		fnvlist_add_boolean(args, "rawok");
 	if (flags & LZC_SEND_FLAG_SAVED)
 		fnvlist_add_boolean(args, "savedok");
+	if (flags & LZC_SEND_FLAG_STREAM_LZ4)
+		fnvlist_add_uint64(args, "stream_compress", ZIO_COMPRESS_LZ4);
+	else if (flags & LZC_SEND_FLAG_STREAM_ZSTD)
+		fnvlist_add_uint64(args, "stream_compress", ZIO_COMPRESS_ZSTD);
 	if (resumeobj != 0 || resumeoff != 0) {
 		fnvlist_add_uint64(args, "resume_object", resumeobj);
 		fnvlist_add_uint64(args, "resume_offset", resumeoff);
@@ -1889,3 +1898,39 @@ lzc_get_bootenv(const char *pool, nvlist_t **outnvl)
 {
 	return (lzc_ioctl(ZFS_IOC_GET_BOOTENV, pool, NULL, outnvl));
 }
+
+/*
+ * Start or stop rewriting the blocks of the given filesystem or volume in
+ * the background, so that they are reallocated from the pool's current
+ * free space.
+ */
+int
+lzc_rewrite(const char *fsname, zfs_rewrite_func_t func)
+{
+	int error;
+
+	nvlist_t *args = fnvlist_alloc();
+	fnvlist_add_uint64(args, ZFS_REWRITE_COMMAND, (uint64_t)func);
+	error = lzc_ioctl(ZFS_IOC_REWRITE, fsname, args, NULL);
+	fnvlist_free(args);
+
+	return (error);
+}
+
+/*
+ * Remove the unique entries of blocks written more than the given number of
+ * days ago from the dedup tables of the pool.  Those blocks become ordinary,
+ * non-dedup blocks.  Zero days prunes every unique entry.
+ */
+int
+lzc_ddt_prune(const char *pool, uint64_t days)
+{
+	int error;
+
+	nvlist_t *args = fnvlist_alloc();
+	fnvlist_add_uint64(args, DDT_PRUNE_DAYS, days);
+	error = lzc_ioctl(ZFS_IOC_DDT_PRUNE, pool, args, NULL);
+	fnvlist_free(args);
+
+	return (error);
+}
@@ -76,6 +76,9 @@ typedef struct abd_stats {
 	kstat_named_t abdstat_scatter_page_multi_zone;
 	kstat_named_t abdstat_scatter_page_alloc_retry;
 	kstat_named_t abdstat_scatter_sg_table_retry;
+	kstat_named_t abdstat_scatter_huge_chunks;
+	kstat_named_t abdstat_scatter_huge_data_size;
+	kstat_named_t abdstat_scatter_huge_fallback;
 } abd_stats_t;
 
 static abd_stats_t abd_stats = {
@@ -130,6 +133,20 @@ static abd_stats_t abd_stats = {
 	 *  allocate the sg table for an ABD.
 	 */
 	{ "scatter_sg_table_retry",		KSTAT_DATA_UINT64 },
+	/*
+	 * The number of currently allocated chunks which are at least
+	 * ABD_HUGE_CHUNK_SIZE (2M) in size, and the amount of memory they
+	 * hold.  Large records built from huge chunks need far fewer
+	 * scatterlist entries to iterate over and to map into bios.
+	 */
+	{ "scatter_huge_chunks",		KSTAT_DATA_UINT64 },
+	{ "scatter_huge_data_size",		KSTAT_DATA_UINT64 },
+	/*
+	 * The total number of scatter ABDs which were large enough for
+	 * huge chunks, but had to fall back to smaller chunks because
+	 * no physically contiguous huge chunk was available.
+	 */
+	{ "scatter_huge_fallback",		KSTAT_DATA_UINT64 },
 };
 
 static struct {
@@ -144,6 +161,9 @@ static struct {
 	wmsum_t abdstat_scatter_page_multi_zone;
 	wmsum_t abdstat_scatter_page_alloc_retry;
 	wmsum_t abdstat_scatter_sg_table_retry;
+	wmsum_t abdstat_scatter_huge_chunks;
+	wmsum_t abdstat_scatter_huge_data_size;
+	wmsum_t abdstat_scatter_huge_fallback;
 } abd_sums;
 
 #define	abd_for_each_sg(abd, sg, n, i)	\
@@ -224,6 +244,27 @@ abd_free_struct_impl(abd_t *abd)
 #ifdef _KERNEL
 static unsigned zfs_abd_scatter_max_order = MAX_ORDER - 1;
 
+/*
+ * Allocate scatter ABDs of at least ABD_HUGE_CHUNK_SIZE from huge (2M)
+ * compound pages, waking kswapd and kcompactd when none are free so that
+ * they become available for later allocations.
+ */
+static int zfs_abd_scatter_huge_chunks = 1;
+
+#define	ABD_HUGE_CHUNK_SHIFT	21
+#define	ABD_HUGE_CHUNK_SIZE	(1UL << ABD_HUGE_CHUNK_SHIFT)
+#define	ABD_HUGE_CHUNK_ORDER	(ABD_HUGE_CHUNK_SHIFT - PAGE_SHIFT)
+
+static inline void
+abd_huge_chunk_stat(int order, int delta)
+{
+	if (order >= ABD_HUGE_CHUNK_ORDER) {
+		ABDSTAT_INCR(abdstat_scatter_huge_chunks, delta);
+		ABDSTAT_INCR(abdstat_scatter_huge_data_size,
+		    delta * (int64_t)(PAGESIZE << order));
+	}
+}
+
 /*
  * Mark zfs data pages so they can be excluded from kernel crash dumps
  */
@@ -256,12 +297,21 @@ abd_unmark_zfs_page(struct page *page)
 #define	__GFP_RECLAIM		__GFP_WAIT
 #endif
 
+#ifndef __GFP_KSWAPD_RECLAIM
+#define	__GFP_KSWAPD_RECLAIM	0
+#endif
+
 /*
  * The goal is to minimize fragmentation by preferentially populating ABDs
  * with higher order compound pages from a single zone.  Allocation size is
  * progressively decreased until it can be satisfied without performing
  * reclaim or compaction.  When necessary this function will degenerate to
  * allocating individual pages and allowing reclaim to satisfy allocations.
+ *
+ * Chunks of ABD_HUGE_CHUNK_ORDER and above are additionally allowed to
+ * wake kswapd, and with it kcompactd, when zfs_abd_scatter_huge_chunks
+ * is set.  This never stalls the caller, but keeps huge chunks available
+ * for large records instead of letting them decay into order-0 pages.
  */
 void
 abd_alloc_chunks(abd_t *abd, size_t size)
@@ -272,15 +322,23 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 	struct page *page, *tmp_page = NULL;
 	gfp_t gfp = __GFP_NOWARN | GFP_NOIO;
 	gfp_t gfp_comp = (gfp | __GFP_NORETRY | __GFP_COMP) & ~__GFP_RECLAIM;
+	gfp_t gfp_huge = gfp_comp;
 	int max_order = MIN(zfs_abd_scatter_max_order, MAX_ORDER - 1);
 	int nr_pages = abd_chunkcnt_for_bytes(size);
 	int chunks = 0, zones = 0;
 	size_t remaining_size;
 	int nid = NUMA_NO_NODE;
 	int alloc_pages = 0;
+	boolean_t huge = B_FALSE;
 
 	INIT_LIST_HEAD(&pages);
 
+	if (zfs_abd_scatter_huge_chunks && size >= ABD_HUGE_CHUNK_SIZE &&
+	    max_order >= ABD_HUGE_CHUNK_ORDER) {
+		gfp_huge |= __GFP_KSWAPD_RECLAIM;
+		huge = B_TRUE;
+	}
+
 	while (alloc_pages < nr_pages) {
 		unsigned chunk_pages;
 		int order;
@@ -288,7 +346,8 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 		order = MIN(highbit64(nr_pages - alloc_pages) - 1, max_order);
 		chunk_pages = (1U << order);
 
-		page = alloc_pages_node(nid, order ? gfp_comp : gfp, order);
+		page = alloc_pages_node(nid, order >= ABD_HUGE_CHUNK_ORDER ?
+		    gfp_huge : order ? gfp_comp : gfp, order);
 		if (page == NULL) {
 			if (order == 0) {
 				ABDSTAT_BUMP(abdstat_scatter_page_alloc_retry);
@@ -296,6 +355,10 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 			} else {
 				max_order = MAX(0, order - 1);
 			}
+			if (huge && order == ABD_HUGE_CHUNK_ORDER) {
+				ABDSTAT_BUMP(abdstat_scatter_huge_fallback);
+				huge = B_FALSE;
+			}
 			continue;
 		}
 
@@ -306,6 +369,7 @@ abd_alloc_chunks(abd_t *abd, size_t size)
 
 		nid = page_to_nid(page);
 		ABDSTAT_BUMP(abdstat_scatter_orders[order]);
+		abd_huge_chunk_stat(order, 1);
 		chunks++;
 		alloc_pages += chunk_pages;
 	}
@@ -455,6 +519,7 @@ abd_free_chunks(abd_t *abd)
 		__free_pages(page, order);
 		ASSERT3U(sg->length, <=, PAGE_SIZE << order);
 		ABDSTAT_BUMPDOWN(abdstat_scatter_orders[order]);
+		abd_huge_chunk_stat(order, -1);
 	}
 	abd_free_sg_table(abd);
 }
@@ -739,6 +804,12 @@ abd_kstats_update(kstat_t *ksp, int rw)
 	    wmsum_value(&abd_sums.abdstat_scatter_page_alloc_retry);
 	as->abdstat_scatter_sg_table_retry.value.ui64 =
 	    wmsum_value(&abd_sums.abdstat_scatter_sg_table_retry);
+	as->abdstat_scatter_huge_chunks.value.ui64 =
+	    wmsum_value(&abd_sums.abdstat_scatter_huge_chunks);
+	as->abdstat_scatter_huge_data_size.value.ui64 =
+	    wmsum_value(&abd_sums.abdstat_scatter_huge_data_size);
+	as->abdstat_scatter_huge_fallback.value.ui64 =
+	    wmsum_value(&abd_sums.abdstat_scatter_huge_fallback);
 	return (0);
 }
 
@@ -762,6 +833,9 @@ abd_init(void)
 	wmsum_init(&abd_sums.abdstat_scatter_page_multi_zone, 0);
 	wmsum_init(&abd_sums.abdstat_scatter_page_alloc_retry, 0);
 	wmsum_init(&abd_sums.abdstat_scatter_sg_table_retry, 0);
+	wmsum_init(&abd_sums.abdstat_scatter_huge_chunks, 0);
+	wmsum_init(&abd_sums.abdstat_scatter_huge_data_size, 0);
+	wmsum_init(&abd_sums.abdstat_scatter_huge_fallback, 0);
 
 	abd_ksp = kstat_create("zfs", 0, "abdstats", "misc", KSTAT_TYPE_NAMED,
 	    sizeof (abd_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
@@ -802,6 +876,9 @@ abd_fini(void)
 	wmsum_fini(&abd_sums.abdstat_scatter_page_multi_zone);
 	wmsum_fini(&abd_sums.abdstat_scatter_page_alloc_retry);
 	wmsum_fini(&abd_sums.abdstat_scatter_sg_table_retry);
+	wmsum_fini(&abd_sums.abdstat_scatter_huge_chunks);
+	wmsum_fini(&abd_sums.abdstat_scatter_huge_data_size);
+	wmsum_fini(&abd_sums.abdstat_scatter_huge_fallback);
 
 	if (abd_cache) {
 		kmem_cache_destroy(abd_cache);
@@ -1152,4 +1229,7 @@ MODULE_PARM_DESC(zfs_abd_scatter_min_size,
 module_param(zfs_abd_scatter_max_order, uint, 0644);
 MODULE_PARM_DESC(zfs_abd_scatter_max_order,
 	"Maximum order allocation used for a scatter ABD.");
+module_param(zfs_abd_scatter_huge_chunks, int, 0644);
+MODULE_PARM_DESC(zfs_abd_scatter_huge_chunks,
+	"Wake kswapd and kcompactd to keep 2M chunks available for large ABDs");
 #endif
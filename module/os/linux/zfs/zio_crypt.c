@@ -206,6 +206,51 @@ const zio_crypt_info_t zio_crypt_table[ZIO_CRYPT_FUNCTIONS] = {
 	{SUN_CKM_AES_GCM,	ZC_TYPE_GCM,	32,	"aes-256-gcm"}
 };
 
+/*
+ * Find the cached key for a salt that is not the current one. The caller
+ * must hold zk_salt_lock, and the entry is only valid while it is held.
+ */
+static zio_crypt_tmpl_ent_t *
+zio_crypt_tmpl_cache_lookup(zio_crypt_key_t *key, const uint8_t *salt)
+{
+	for (int i = 0; i < ZIO_CRYPT_TMPL_CACHE_SIZE; i++) {
+		zio_crypt_tmpl_ent_t *zte = &key->zk_tmpl_cache[i];
+
+		if (zte->zte_key.ck_data != NULL &&
+		    memcmp(zte->zte_salt, salt, ZIO_DATA_SALT_LEN) == 0)
+			return (zte);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Add a derived key and its template to the cache, replacing the oldest
+ * entry. The cache takes ownership of the template. The caller must hold
+ * zk_salt_lock as writer.
+ */
+static void
+zio_crypt_tmpl_cache_insert(zio_crypt_key_t *key, const uint8_t *salt,
+    const uint8_t *keydata, crypto_ctx_template_t tmpl)
+{
+	uint_t keydata_len = zio_crypt_table[key->zk_crypt].ci_keylen;
+	zio_crypt_tmpl_ent_t *zte;
+
+	ASSERT(RW_WRITE_HELD(&key->zk_salt_lock));
+
+	zte = &key->zk_tmpl_cache[key->zk_tmpl_cache_next];
+	key->zk_tmpl_cache_next =
+	    (key->zk_tmpl_cache_next + 1) % ZIO_CRYPT_TMPL_CACHE_SIZE;
+
+	crypto_destroy_ctx_template(zte->zte_tmpl);
+
+	memcpy(zte->zte_salt, salt, ZIO_DATA_SALT_LEN);
+	memcpy(zte->zte_keydata, keydata, keydata_len);
+	zte->zte_key.ck_data = zte->zte_keydata;
+	zte->zte_key.ck_length = CRYPTO_BYTES2BITS(keydata_len);
+	zte->zte_tmpl = tmpl;
+}
+
 void
 zio_crypt_key_destroy(zio_crypt_key_t *key)
 {
@@ -214,6 +259,8 @@ zio_crypt_key_destroy(zio_crypt_key_t *key)
 	/* free crypto templates */
 	crypto_destroy_ctx_template(key->zk_current_tmpl);
 	crypto_destroy_ctx_template(key->zk_hmac_tmpl);
+	for (int i = 0; i < ZIO_CRYPT_TMPL_CACHE_SIZE; i++)
+		crypto_destroy_ctx_template(key->zk_tmpl_cache[i].zte_tmpl);
 
 	/* zero out sensitive data */
 	memset(key, 0, sizeof (zio_crypt_key_t));
@@ -310,6 +357,16 @@ zio_crypt_key_change_salt(zio_crypt_key_t *key)
 	if (key->zk_salt_count < ZFS_CURRENT_MAX_SALT_USES)
 		goto out_unlock;
 
+	/*
+	 * Blocks written under the outgoing salt are likely to be read back
+	 * soon, so hand its key and template over to the cache.
+	 */
+	if (key->zk_current_tmpl != NULL) {
+		zio_crypt_tmpl_cache_insert(key, key->zk_salt,
+		    key->zk_current_keydata, key->zk_current_tmpl);
+		key->zk_current_tmpl = NULL;
+	}
+
 	/* derive the current key from the master key and the new salt */
 	ret = hkdf_sha512(key->zk_master_keydata, keydata_len, NULL, 0,
 	    salt, ZIO_DATA_SALT_LEN, key->zk_current_keydata, keydata_len);
@@ -320,8 +377,9 @@ zio_crypt_key_change_salt(zio_crypt_key_t *key)
 	memcpy(key->zk_salt, salt, ZIO_DATA_SALT_LEN);
 	key->zk_salt_count = 0;
 
-	/* destroy the old context template and create the new one */
-	crypto_destroy_ctx_template(key->zk_current_tmpl);
+	/* create the context template for the new key */
+	mech.cm_type =
+	    crypto_mech2id(zio_crypt_table[key->zk_crypt].ci_mechname);
 	ret = crypto_create_ctx_template(&mech, &key->zk_current_key,
 	    &key->zk_current_tmpl);
 	if (ret != CRYPTO_SUCCESS)
@@ -1888,17 +1946,20 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 	zfs_uio_t puio, cuio;
 	uint8_t enc_keydata[MASTER_KEY_MAX_LEN];
 	crypto_key_t tmp_ckey, *ckey = NULL;
-	crypto_ctx_template_t tmpl;
+	crypto_ctx_template_t tmpl = NULL;
+	crypto_mechanism_t mech;
+	zio_crypt_tmpl_ent_t *zte;
 	uint8_t *authbuf = NULL;
 
 	memset(&puio, 0, sizeof (puio));
 	memset(&cuio, 0, sizeof (cuio));
 
 	/*
-	 * If the needed key is the current one, just use it. Otherwise we
-	 * need to generate a temporary one from the given salt + master key.
-	 * If we are encrypting, we must return a copy of the current salt
-	 * so that it can be stored in the blkptr_t.
+	 * If the needed key is the current one, just use it. If it was
+	 * derived from a recently used salt, use the cached copy. Otherwise
+	 * we need to generate a temporary one from the given salt + master
+	 * key. If we are encrypting, we must return a copy of the current
+	 * salt so that it can be stored in the blkptr_t.
 	 */
 	rw_enter(&key->zk_salt_lock, RW_READER);
 	locked = B_TRUE;
@@ -1906,6 +1967,9 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 	if (memcmp(salt, key->zk_salt, ZIO_DATA_SALT_LEN) == 0) {
 		ckey = &key->zk_current_key;
 		tmpl = key->zk_current_tmpl;
+	} else if ((zte = zio_crypt_tmpl_cache_lookup(key, salt)) != NULL) {
+		ckey = &zte->zte_key;
+		tmpl = zte->zte_tmpl;
 	} else {
 		rw_exit(&key->zk_salt_lock);
 		locked = B_FALSE;
@@ -1919,7 +1983,6 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 		tmp_ckey.ck_length = CRYPTO_BYTES2BITS(keydata_len);
 
 		ckey = &tmp_ckey;
-		tmpl = NULL;
 	}
 
 	/*
@@ -1960,6 +2023,19 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 	if (ret != 0)
 		goto error;
 
+	/*
+	 * Build a template for a freshly derived key. This costs the same
+	 * key schedule the software path would compute anyway, and lets us
+	 * cache it for the following blocks that share this salt.
+	 */
+	if (ckey == &tmp_ckey) {
+		mech.cm_type =
+		    crypto_mech2id(zio_crypt_table[crypt].ci_mechname);
+		if (crypto_create_ctx_template(&mech, ckey,
+		    &tmpl) != CRYPTO_SUCCESS)
+			tmpl = NULL;
+	}
+
 	/* perform the encryption / decryption in software */
 	ret = zio_do_crypt_uio(encrypt, key->zk_crypt, ckey, tmpl, iv, enc_len,
 	    &puio, &cuio, authbuf, auth_len);
@@ -1970,6 +2046,24 @@ zio_do_crypt_data(boolean_t encrypt, zio_crypt_key_t *key,
 		rw_exit(&key->zk_salt_lock);
 	}
 
+	/*
+	 * Opportunistically cache the new key and template. If the lock
+	 * is contended or another thread got there first, just drop ours.
+	 */
+	if (ckey == &tmp_ckey && tmpl != NULL) {
+		if (rw_tryenter(&key->zk_salt_lock, RW_WRITER)) {
+			if (memcmp(salt, key->zk_salt,
+			    ZIO_DATA_SALT_LEN) != 0 &&
+			    zio_crypt_tmpl_cache_lookup(key, salt) == NULL) {
+				zio_crypt_tmpl_cache_insert(key, salt,
+				    enc_keydata, tmpl);
+				tmpl = NULL;
+			}
+			rw_exit(&key->zk_salt_lock);
+		}
+		crypto_destroy_ctx_template(tmpl);
+	}
+
 	if (authbuf != NULL)
 		zio_buf_free(authbuf, datalen);
 	if (ckey == &tmp_ckey)
@@ -1984,8 +2078,10 @@ error:
 		rw_exit(&key->zk_salt_lock);
 	if (authbuf != NULL)
 		zio_buf_free(authbuf, datalen);
-	if (ckey == &tmp_ckey)
+	if (ckey == &tmp_ckey) {
+		crypto_destroy_ctx_template(tmpl);
 		memset(enc_keydata, 0, keydata_len);
+	}
 	zio_crypt_destroy_uio(&puio);
 	zio_crypt_destroy_uio(&cuio);
 
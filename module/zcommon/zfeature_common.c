@@ -725,6 +725,12 @@ zpool_feature_init(void)
 		    blake3_deps, sfeatures);
 	}
 
+	zfeature_register(SPA_FEATURE_DDT_LOG,
+	    "org.openzfs:ddt_log", "ddt_log",
+	    "Journal dedup table updates in an append-only log.",
+	    ZFEATURE_FLAG_READONLY_COMPAT, ZFEATURE_TYPE_BOOLEAN, NULL,
+	    sfeatures);
+
 	zfs_mod_list_supported_free(sfeatures);
 }
 
@@ -36,10 +36,12 @@
 #include <sys/zio_checksum.h>
 #include <sys/zio_compress.h>
 #include <sys/dsl_scan.h>
+#include <sys/dsl_synctask.h>
 #include <sys/abd.h>
 
 static kmem_cache_t *ddt_cache;
 static kmem_cache_t *ddt_entry_cache;
+static kmem_cache_t *ddt_log_entry_cache;
 
 /*
  * Enable/disable prefetching of dedup-ed blocks which are going to be freed.
@@ -155,9 +157,11 @@ ddt_object_sync(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 
 	ddt_object_name(ddt, type, class, name);
 
+	mutex_enter(&ddt->ddt_stat_lock);
 	VERIFY(zap_update(ddt->ddt_os, ddt->ddt_spa->spa_ddt_stat_object, name,
 	    sizeof (uint64_t), sizeof (ddt_histogram_t) / sizeof (uint64_t),
 	    &ddt->ddt_histogram[type][class], tx) == 0);
+	mutex_exit(&ddt->ddt_stat_lock);
 
 	/*
 	 * Cache DDT statistics; this is the only time they'll change.
@@ -258,6 +262,635 @@ ddt_object_name(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 	    ddt_ops[type]->ddt_op_name, ddt_class_name[class]);
 }
 
+/*
+ * DDT log
+ *
+ * Updating the DDT objects in place scatters small random writes across
+ * them every txg, which is what makes dedup slow on large pools.  Instead,
+ * when the ddt_log feature is enabled, ddt_sync_table() appends the new
+ * state of each changed entry to a log object, and keeps the latest state
+ * of every logged key in memory.  Each txg, a batch of entries from the
+ * older (flushing) log is written back into the DDT objects, in key order,
+ * so that an entry changed in many txgs is written to its DDT object once,
+ * and neighbouring updates share ZAP blocks.  When the flushing log is
+ * empty it is truncated and the two logs are swapped.
+ *
+ * Lookups consult the logs before the DDT objects: the active log holds
+ * newer state than the flushing log, which holds newer state than the
+ * DDT objects.
+ *
+ * The DDT phase of a scan walks the DDT objects directly, and relies on
+ * ddt_sync_entry() to scan entries whose class decreases behind its
+ * bookmark.  While that phase is in progress, each log is drained: the
+ * active log is swapped in as soon as the flushing one is empty, and each
+ * swap spreads its entries over half as many txgs as the previous one, so
+ * the logs empty out within about twice zfs_dedup_log_flush_txgs txgs
+ * while flushing only about twice as many entries per txg as are logged.
+ * Once a log is empty it is bypassed, and its DDT objects are updated in
+ * place as before.  The walk starts when every log is empty.
+ */
+
+/*
+ * Minimum number of log entries written back to the DDT objects per txg.
+ */
+static uint_t zfs_dedup_log_flush_entries_min = 1000;
+
+/*
+ * Number of txgs over which the entries of the flushing log are spread.
+ */
+static uint_t zfs_dedup_log_flush_txgs = 100;
+
+/*
+ * Number of txgs the active log accumulates before it starts flushing.
+ */
+static uint_t zfs_dedup_log_txg_max = 8;
+
+/*
+ * dle_type of a replayed entry, whose DDT object has not been looked up.
+ */
+#define	DDT_LOG_TYPE_UNKNOWN	UINT8_MAX
+
+#define	DDT_LOG_BUF_RECORDS	\
+	(SPA_OLD_MAXBLOCKSIZE / sizeof (ddt_log_record_t))
+
+/*
+ * Records staged for appending to the active log.
+ */
+typedef struct ddt_log_update {
+	ddt_log_record_t	*dlu_buf;
+	uint64_t		dlu_count;
+} ddt_log_update_t;
+
+void
+ddt_log_name(ddt_t *ddt, int n, char *name)
+{
+	(void) snprintf(name, DDT_NAMELEN, DMU_POOL_DDT_LOG,
+	    zio_checksum_table[ddt->ddt_checksum].ci_name, n);
+}
+
+/*
+ * Returns the class of a logged entry, or DDT_CLASSES if the entry records
+ * the removal of its key.
+ */
+static enum ddt_class
+ddt_log_entry_class(const ddt_log_entry_t *dle)
+{
+	uint64_t refcnt = 0;
+
+	for (int p = 0; p < DDT_LOG_PHYS_TYPES; p++)
+		refcnt += dle->dle_phys[p].ddp_refcnt;
+
+	if (refcnt == 0)
+		return (DDT_CLASSES);
+
+	return (refcnt > 1 ? DDT_CLASS_DUPLICATE : DDT_CLASS_UNIQUE);
+}
+
+/*
+ * Copy the physical entries of a log entry into an in-core entry.
+ */
+static void
+ddt_log_entry_fill(const ddt_log_entry_t *dle, ddt_entry_t *dde)
+{
+	ddt_phys_clear(&dde->dde_phys[DDT_PHYS_DITTO]);
+	memcpy(&dde->dde_phys[DDT_PHYS_SINGLE], dle->dle_phys,
+	    sizeof (dle->dle_phys));
+}
+
+static boolean_t
+ddt_log_empty(ddt_t *ddt)
+{
+	return (avl_numnodes(&ddt->ddt_log_active->ddl_tree) == 0 &&
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) == 0);
+}
+
+/*
+ * Look up the key of dde in the logs.  If it is there, copy its latest
+ * physical entries into dde and return its class in *classp.
+ */
+static boolean_t
+ddt_log_lookup(ddt_t *ddt, ddt_entry_t *dde, enum ddt_class *classp)
+{
+	ddt_log_entry_t *dle;
+
+	rw_enter(&ddt->ddt_log_lock, RW_READER);
+	dle = avl_find(&ddt->ddt_log_active->ddl_tree, dde, NULL);
+	if (dle == NULL)
+		dle = avl_find(&ddt->ddt_log_flushing->ddl_tree, dde, NULL);
+	if (dle != NULL) {
+		ddt_log_entry_fill(dle, dde);
+		*classp = ddt_log_entry_class(dle);
+	}
+	rw_exit(&ddt->ddt_log_lock);
+
+	return (dle != NULL);
+}
+
+static boolean_t
+ddt_log_contains(ddt_t *ddt, ddt_entry_t *dde)
+{
+	boolean_t found;
+
+	rw_enter(&ddt->ddt_log_lock, RW_READER);
+	found = (avl_find(&ddt->ddt_log_active->ddl_tree, dde, NULL) != NULL ||
+	    avl_find(&ddt->ddt_log_flushing->ddl_tree, dde, NULL) != NULL);
+	rw_exit(&ddt->ddt_log_lock);
+
+	return (found);
+}
+
+/*
+ * Returns B_TRUE while the DDT phase of a scan is in progress, and the
+ * logs must be drained; see the comment at the top of this section.
+ */
+static boolean_t
+ddt_log_draining(spa_t *spa)
+{
+	dsl_scan_t *scn = spa->spa_dsl_pool->dp_scan;
+
+	return (scn != NULL && scn->scn_phys.scn_state == DSS_SCANNING &&
+	    scn->scn_phys.scn_ddt_bookmark.ddb_class <=
+	    scn->scn_phys.scn_ddt_class_max);
+}
+
+/*
+ * A log that is drained stays empty until the DDT phase of the scan is
+ * over, so that the walk never has to look at it.
+ */
+static boolean_t
+ddt_log_enabled(ddt_t *ddt)
+{
+	spa_t *spa = ddt->ddt_spa;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_DDT_LOG))
+		return (B_FALSE);
+
+	return (!ddt_log_empty(ddt) || !ddt_log_draining(spa));
+}
+
+static void
+ddt_log_sync_phys(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	ddt_log_phys_t *dlp;
+	dmu_buf_t *db;
+
+	VERIFY0(dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	dlp = db->db_data;
+	dlp->dlp_length = ddl->ddl_length;
+	dlp->dlp_first_txg = ddl->ddl_first_txg;
+	dmu_buf_rele(db, FTAG);
+}
+
+static void
+ddt_log_create(ddt_t *ddt, dmu_tx_t *tx)
+{
+	objset_t *os = ddt->ddt_os;
+	char name[DDT_NAMELEN];
+
+	for (int n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ASSERT0(ddl->ddl_object);
+		ddl->ddl_object = dmu_object_alloc(os,
+		    DMU_OTN_UINT64_METADATA, SPA_OLD_MAXBLOCKSIZE,
+		    DMU_OTN_UINT64_METADATA, sizeof (ddt_log_phys_t), tx);
+
+		ddt_log_name(ddt, n, name);
+		VERIFY0(zap_add(os, DMU_POOL_DIRECTORY_OBJECT, name,
+		    sizeof (uint64_t), 1, &ddl->ddl_object, tx));
+	}
+
+	spa_feature_incr(ddt->ddt_spa, SPA_FEATURE_DDT_LOG, tx);
+}
+
+static void
+ddt_log_destroy(ddt_t *ddt, dmu_tx_t *tx)
+{
+	objset_t *os = ddt->ddt_os;
+	char name[DDT_NAMELEN];
+
+	ASSERT(ddt_log_empty(ddt));
+
+	for (int n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ddt_log_name(ddt, n, name);
+		VERIFY0(zap_remove(os, DMU_POOL_DIRECTORY_OBJECT, name, tx));
+		VERIFY0(dmu_object_free(os, ddl->ddl_object, tx));
+
+		ddl->ddl_object = 0;
+		ddl->ddl_length = 0;
+		ddl->ddl_first_txg = 0;
+	}
+
+	spa_feature_decr(ddt->ddt_spa, SPA_FEATURE_DDT_LOG, tx);
+}
+
+static void
+ddt_log_truncate(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	ASSERT0(avl_numnodes(&ddl->ddl_tree));
+
+	if (ddl->ddl_length == 0)
+		return;
+
+	VERIFY0(dmu_free_range(ddt->ddt_os, ddl->ddl_object, 0,
+	    DMU_OBJECT_END, tx));
+	ddl->ddl_length = 0;
+	ddl->ddl_first_txg = 0;
+	ddt_log_sync_phys(ddt, ddl, tx);
+}
+
+/*
+ * Make the active log the flushing one, to be flushed over the given number
+ * of txgs.  The flushing log must be empty.
+ */
+static void
+ddt_log_swap(ddt_t *ddt, uint_t txgs, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+
+	ddt_log_truncate(ddt, ddl, tx);
+
+	rw_enter(&ddt->ddt_log_lock, RW_WRITER);
+	ddt->ddt_log_flushing = ddt->ddt_log_active;
+	ddt->ddt_log_active = ddl;
+	ddt->ddt_log_walk_entry = NULL;
+	rw_exit(&ddt->ddt_log_lock);
+
+	ddt->ddt_log_flush_rate =
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) / MAX(txgs, 1);
+}
+
+static void
+ddt_log_write(ddt_t *ddt, ddt_log_update_t *dlu, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	uint64_t size = dlu->dlu_count * sizeof (ddt_log_record_t);
+
+	if (size == 0)
+		return;
+
+	if (ddl->ddl_length == 0)
+		ddl->ddl_first_txg = tx->tx_txg;
+
+	dmu_write(ddt->ddt_os, ddl->ddl_object, ddl->ddl_length, size,
+	    dlu->dlu_buf, tx);
+	ddl->ddl_length += size;
+	dlu->dlu_count = 0;
+
+	ddt_log_sync_phys(ddt, ddl, tx);
+}
+
+/*
+ * Record the new state of dde in the active log.  otype and oclass give
+ * the DDT object holding the key when it was looked up.
+ */
+static void
+ddt_log_entry(ddt_t *ddt, ddt_entry_t *dde, enum ddt_type otype,
+    enum ddt_class oclass, ddt_log_update_t *dlu, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	ddt_log_entry_t *dle, *fdle;
+	ddt_log_record_t *dlr;
+	avl_index_t where;
+
+	ASSERT0(dde->dde_phys[DDT_PHYS_DITTO].ddp_phys_birth);
+
+	rw_enter(&ddt->ddt_log_lock, RW_WRITER);
+	dle = avl_find(&ddl->ddl_tree, dde, &where);
+	if (dle == NULL) {
+		dle = kmem_cache_alloc(ddt_log_entry_cache, KM_SLEEP);
+		dle->dle_key = dde->dde_key;
+
+		/*
+		 * If the key is in the flushing log, the DDT objects have
+		 * not caught up with it yet; flushing it will tell us where
+		 * it ends up.
+		 */
+		fdle = avl_find(&ddt->ddt_log_flushing->ddl_tree, dde, NULL);
+		if (fdle != NULL) {
+			dle->dle_type = fdle->dle_type;
+			dle->dle_class = fdle->dle_class;
+		} else {
+			dle->dle_type = otype;
+			dle->dle_class = oclass;
+		}
+		avl_insert(&ddl->ddl_tree, dle, where);
+		ddt->ddt_log_walk_entry = NULL;
+	}
+	memcpy(dle->dle_phys, &dde->dde_phys[DDT_PHYS_SINGLE],
+	    sizeof (dle->dle_phys));
+	rw_exit(&ddt->ddt_log_lock);
+
+	dlr = &dlu->dlu_buf[dlu->dlu_count++];
+	dlr->dlr_key = dde->dde_key;
+	memcpy(dlr->dlr_phys, dle->dle_phys, sizeof (dlr->dlr_phys));
+
+	if (dlu->dlu_count == DDT_LOG_BUF_RECORDS)
+		ddt_log_write(ddt, dlu, tx);
+}
+
+/*
+ * Write one entry of the flushing log back into the DDT objects.  dde is
+ * scratch space.
+ */
+static void
+ddt_log_flush_entry(ddt_t *ddt, ddt_log_entry_t *dle, ddt_entry_t *dde,
+    dmu_tx_t *tx)
+{
+	enum ddt_type otype = dle->dle_type;
+	enum ddt_type ntype = DDT_TYPE_CURRENT;
+	enum ddt_class oclass = dle->dle_class;
+	enum ddt_class nclass = ddt_log_entry_class(dle);
+	ddt_log_entry_t *adle;
+
+	dde->dde_key = dle->dle_key;
+
+	if (otype == DDT_LOG_TYPE_UNKNOWN) {
+		int error = ENOENT;
+
+		for (otype = 0; otype < DDT_TYPES; otype++) {
+			for (oclass = 0; oclass < DDT_CLASSES; oclass++) {
+				error = ddt_object_lookup(ddt, otype, oclass,
+				    dde);
+				if (error != ENOENT) {
+					ASSERT0(error);
+					break;
+				}
+			}
+			if (error != ENOENT)
+				break;
+		}
+	}
+
+	ddt_log_entry_fill(dle, dde);
+
+	if (otype != DDT_TYPES && (otype != ntype || oclass != nclass))
+		VERIFY0(ddt_object_remove(ddt, otype, oclass, dde, tx));
+
+	if (nclass != DDT_CLASSES) {
+		if (!ddt_object_exists(ddt, ntype, nclass))
+			ddt_object_create(ddt, ntype, nclass, tx);
+		VERIFY0(ddt_object_update(ddt, ntype, nclass, dde, tx));
+	} else {
+		ntype = DDT_TYPES;
+	}
+
+	rw_enter(&ddt->ddt_log_lock, RW_WRITER);
+	adle = avl_find(&ddt->ddt_log_active->ddl_tree, dle, NULL);
+	if (adle != NULL) {
+		adle->dle_type = ntype;
+		adle->dle_class = nclass;
+	}
+	avl_remove(&ddt->ddt_log_flushing->ddl_tree, dle);
+	ddt->ddt_log_walk_entry = NULL;
+	rw_exit(&ddt->ddt_log_lock);
+
+	kmem_cache_free(ddt_log_entry_cache, dle);
+}
+
+/*
+ * Write up to count entries of the flushing log back into the DDT objects,
+ * truncating the log once it is empty.
+ */
+static void
+ddt_log_flush(ddt_t *ddt, uint64_t count, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+	ddt_entry_t *dde = kmem_cache_alloc(ddt_entry_cache, KM_SLEEP);
+	ddt_log_entry_t *dle;
+	uint64_t n = 0;
+
+	/*
+	 * Start reading the ZAP blocks the whole batch will touch before
+	 * updating any of them.
+	 */
+	for (dle = avl_first(&ddl->ddl_tree); dle != NULL && n < count;
+	    dle = AVL_NEXT(&ddl->ddl_tree, dle), n++) {
+		dde->dde_key = dle->dle_key;
+		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+			for (enum ddt_class class = 0; class < DDT_CLASSES;
+			    class++) {
+				ddt_object_prefetch(ddt, type, class, dde);
+			}
+		}
+	}
+
+	while (n-- > 0)
+		ddt_log_flush_entry(ddt, avl_first(&ddl->ddl_tree), dde, tx);
+
+	kmem_cache_free(ddt_entry_cache, dde);
+
+	if (avl_numnodes(&ddl->ddl_tree) == 0)
+		ddt_log_truncate(ddt, ddl, tx);
+}
+
+/*
+ * Per-txg log maintenance, done once in the first sync pass.  If drain is
+ * set, the log is being emptied; see the comment at the top of this
+ * section.  Returns B_TRUE if any entries were written back to the DDT
+ * objects.
+ */
+static boolean_t
+ddt_log_sync(ddt_t *ddt, boolean_t drain, dmu_tx_t *tx)
+{
+	ddt_log_t *active = ddt->ddt_log_active;
+	uint64_t txg = tx->tx_txg;
+	uint_t txgs = zfs_dedup_log_flush_txgs;
+
+	if (spa_sync_pass(ddt->ddt_spa) > 1 || ddt->ddt_log_flush_txg == txg)
+		return (B_FALSE);
+	ddt->ddt_log_flush_txg = txg;
+
+	if (!drain)
+		ddt->ddt_log_drain_swaps = 0;
+
+	if (avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) == 0) {
+		if (avl_numnodes(&active->ddl_tree) == 0)
+			return (B_FALSE);
+		if (drain) {
+			txgs >>= MIN(ddt->ddt_log_drain_swaps, 31);
+			ddt->ddt_log_drain_swaps++;
+		} else if (txg < active->ddl_first_txg +
+		    zfs_dedup_log_txg_max) {
+			return (B_FALSE);
+		}
+		ddt_log_swap(ddt, txgs, tx);
+	}
+
+	ddt_log_flush(ddt, MAX(ddt->ddt_log_flush_rate,
+	    zfs_dedup_log_flush_entries_min), tx);
+
+	return (B_TRUE);
+}
+
+static int
+ddt_log_replay(ddt_t *ddt, ddt_log_t *ddl)
+{
+	size_t bufsize = DDT_LOG_BUF_RECORDS * sizeof (ddt_log_record_t);
+	ddt_log_record_t *buf = vmem_alloc(bufsize, KM_SLEEP);
+	int error = 0;
+
+	ASSERT0(ddl->ddl_length % sizeof (ddt_log_record_t));
+
+	for (uint64_t off = 0; off < ddl->ddl_length; off += bufsize) {
+		uint64_t size = MIN(bufsize, ddl->ddl_length - off);
+
+		error = dmu_read(ddt->ddt_os, ddl->ddl_object, off, size, buf,
+		    DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		for (int i = 0; i < size / sizeof (ddt_log_record_t); i++) {
+			ddt_log_record_t *dlr = &buf[i];
+			ddt_log_entry_t *dle;
+			avl_index_t where;
+
+			dle = avl_find(&ddl->ddl_tree, dlr, &where);
+			if (dle == NULL) {
+				dle = kmem_cache_alloc(ddt_log_entry_cache,
+				    KM_SLEEP);
+				dle->dle_key = dlr->dlr_key;
+				dle->dle_type = DDT_LOG_TYPE_UNKNOWN;
+				dle->dle_class = DDT_CLASSES;
+				avl_insert(&ddl->ddl_tree, dle, where);
+			}
+			memcpy(dle->dle_phys, dlr->dlr_phys,
+			    sizeof (dle->dle_phys));
+		}
+	}
+
+	vmem_free(buf, bufsize);
+
+	return (error);
+}
+
+static int
+ddt_log_load(ddt_t *ddt)
+{
+	ddt_log_t *ddl0 = &ddt->ddt_log[0];
+	ddt_log_t *ddl1 = &ddt->ddt_log[1];
+	char name[DDT_NAMELEN];
+	int error;
+
+	for (int n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+		dmu_buf_t *db;
+		ddt_log_phys_t *dlp;
+
+		ddt_log_name(ddt, n, name);
+		error = zap_lookup(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT,
+		    name, sizeof (uint64_t), 1, &ddl->ddl_object);
+		if (error != 0)
+			return (error);
+
+		error = dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG,
+		    &db);
+		if (error != 0)
+			return (error);
+		dlp = db->db_data;
+		ddl->ddl_length = dlp->dlp_length;
+		ddl->ddl_first_txg = dlp->dlp_first_txg;
+		dmu_buf_rele(db, FTAG);
+	}
+
+	/*
+	 * The older of the two logs is the one being flushed.
+	 */
+	if (ddl0->ddl_length != 0 && (ddl1->ddl_length == 0 ||
+	    ddl0->ddl_first_txg < ddl1->ddl_first_txg)) {
+		ddt->ddt_log_flushing = ddl0;
+		ddt->ddt_log_active = ddl1;
+	} else {
+		ddt->ddt_log_flushing = ddl1;
+		ddt->ddt_log_active = ddl0;
+	}
+
+	for (int n = 0; n < 2; n++) {
+		error = ddt_log_replay(ddt, &ddt->ddt_log[n]);
+		if (error != 0)
+			return (error);
+	}
+
+	ddt->ddt_log_flush_rate =
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) /
+	    MAX(zfs_dedup_log_flush_txgs, 1);
+
+	return (0);
+}
+
+/*
+ * Return the log entry following dle, which is at position pos in the
+ * concatenation of the active and flushing logs.
+ */
+static ddt_log_entry_t *
+ddt_log_walk_next(ddt_t *ddt, ddt_log_entry_t *dle, uint64_t pos)
+{
+	avl_tree_t *at = &ddt->ddt_log_active->ddl_tree;
+	avl_tree_t *ft = &ddt->ddt_log_flushing->ddl_tree;
+
+	if (pos + 1 < avl_numnodes(at))
+		return (AVL_NEXT(at, dle));
+	if (pos + 1 == avl_numnodes(at))
+		return (avl_first(ft));
+	return (AVL_NEXT(ft, dle));
+}
+
+/*
+ * Walk the entries of the given class which are only known to the logs,
+ * i.e. those which ddt_walk() skips in the DDT objects.  *walk is a
+ * position in the concatenation of the active and flushing logs; the
+ * entry following the last one returned is cached so that a walk does not
+ * have to skip over the entries it has already seen on every call.
+ */
+static int
+ddt_log_walk(ddt_t *ddt, enum ddt_class class, uint64_t *walk,
+    ddt_entry_t *dde)
+{
+	avl_tree_t *at;
+	ddt_log_entry_t *dle;
+	uint64_t pos;
+	int error = ENOENT;
+
+	/* The walk hint is updated too, so this takes the lock as writer. */
+	rw_enter(&ddt->ddt_log_lock, RW_WRITER);
+	at = &ddt->ddt_log_active->ddl_tree;
+
+	if (ddt->ddt_log_walk_entry != NULL &&
+	    ddt->ddt_log_walk_cursor == *walk) {
+		dle = ddt->ddt_log_walk_entry;
+		pos = *walk;
+	} else {
+		dle = avl_numnodes(at) != 0 ? avl_first(at) :
+		    avl_first(&ddt->ddt_log_flushing->ddl_tree);
+		for (pos = 0; dle != NULL && pos < *walk; pos++)
+			dle = ddt_log_walk_next(ddt, dle, pos);
+	}
+
+	for (; dle != NULL; pos++) {
+		ddt_log_entry_t *next = ddt_log_walk_next(ddt, dle, pos);
+
+		if (ddt_log_entry_class(dle) == class &&
+		    (pos < avl_numnodes(at) ||
+		    avl_find(at, dle, NULL) == NULL)) {
+			dde->dde_key = dle->dle_key;
+			ddt_log_entry_fill(dle, dde);
+			*walk = pos + 1;
+			ddt->ddt_log_walk_cursor = pos + 1;
+			ddt->ddt_log_walk_entry = next;
+			error = 0;
+			break;
+		}
+		dle = next;
+	}
+
+	rw_exit(&ddt->ddt_log_lock);
+
+	return (error);
+}
+
 void
 ddt_bp_fill(const ddt_phys_t *ddp, blkptr_t *bp, uint64_t txg)
 {
@@ -439,9 +1072,14 @@ ddt_stat_update(ddt_t *ddt, ddt_entry_t *dde, uint64_t neg)
 	bucket = highbit64(dds.dds_ref_blocks) - 1;
 	ASSERT(bucket >= 0);
 
+	/*
+	 * Entries in different shards are updated concurrently, so the
+	 * shard lock held by the caller doesn't protect the histogram.
+	 */
+	mutex_enter(&ddt->ddt_stat_lock);
 	ddh = &ddt->ddt_histogram[dde->dde_type][dde->dde_class];
-
 	ddt_stat_add(&ddh->ddh_stat[bucket], &dds, neg);
+	mutex_exit(&ddt->ddt_stat_lock);
 }
 
 void
@@ -552,6 +1190,45 @@ ddt_get_pool_dedup_ratio(spa_t *spa)
 	return (dds_total.dds_ref_dsize * 100 / dds_total.dds_dsize);
 }
 
+/*
+ * Returns the on-disk size of the DDT objects and logs of the pool.
+ */
+uint64_t
+ddt_get_ddt_dsize(spa_t *spa)
+{
+	uint64_t dsize = 0;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL)
+			continue;
+		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+			for (enum ddt_class class = 0; class < DDT_CLASSES;
+			    class++) {
+				ddt_object_t *ddo =
+				    &ddt->ddt_object_stats[type][class];
+				dsize += ddo->ddo_dspace;
+			}
+		}
+		dsize += ddt->ddt_log[0].ddl_length +
+		    ddt->ddt_log[1].ddl_length;
+	}
+
+	return (dsize);
+}
+
+/*
+ * Returns true if the DDT has reached the dedup_table_quota pool property,
+ * in which case no new entries are added to it.  The size is the one
+ * cached at the end of the last ddt_sync().
+ */
+boolean_t
+ddt_over_quota(spa_t *spa)
+{
+	return (spa->spa_dedup_table_quota != 0 &&
+	    spa->spa_dedup_dsize >= spa->spa_dedup_table_quota);
+}
+
 size_t
 ddt_compress(void *src, uchar_t *dst, size_t s_len, size_t d_len)
 {
@@ -599,16 +1276,40 @@ ddt_select(spa_t *spa, const blkptr_t *bp)
 	return (spa->spa_ddt[BP_GET_CHECKSUM(bp)]);
 }
 
+/*
+ * The checksum in the key is a hash of the block's contents, so its low
+ * bits spread the keys evenly over the shards.
+ */
+static ddt_shard_t *
+ddt_shard(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	return (&ddt->ddt_shard[ddk->ddk_cksum.zc_word[0] & (DDT_SHARDS - 1)]);
+}
+
 void
-ddt_enter(ddt_t *ddt)
+ddt_enter(ddt_t *ddt, const ddt_key_t *ddk)
 {
-	mutex_enter(&ddt->ddt_lock);
+	mutex_enter(&ddt_shard(ddt, ddk)->dds_lock);
 }
 
 void
-ddt_exit(ddt_t *ddt)
+ddt_exit(ddt_t *ddt, const ddt_key_t *ddk)
 {
-	mutex_exit(&ddt->ddt_lock);
+	mutex_exit(&ddt_shard(ddt, ddk)->dds_lock);
+}
+
+/*
+ * Returns the number of in-core entries to be synced.
+ */
+uint64_t
+ddt_numnodes(ddt_t *ddt)
+{
+	uint64_t n = 0;
+
+	for (int i = 0; i < DDT_SHARDS; i++)
+		n += avl_numnodes(&ddt->ddt_shard[i].dds_tree);
+
+	return (n);
 }
 
 void
@@ -618,11 +1319,14 @@ ddt_init(void)
 	    sizeof (ddt_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	ddt_entry_cache = kmem_cache_create("ddt_entry_cache",
 	    sizeof (ddt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_log_entry_cache = kmem_cache_create("ddt_log_entry_cache",
+	    sizeof (ddt_log_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 }
 
 void
 ddt_fini(void)
 {
+	kmem_cache_destroy(ddt_log_entry_cache);
 	kmem_cache_destroy(ddt_entry_cache);
 	kmem_cache_destroy(ddt_cache);
 }
@@ -659,9 +1363,11 @@ ddt_free(ddt_entry_t *dde)
 void
 ddt_remove(ddt_t *ddt, ddt_entry_t *dde)
 {
-	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+	ddt_shard_t *dds = ddt_shard(ddt, &dde->dde_key);
+
+	ASSERT(MUTEX_HELD(&dds->dds_lock));
 
-	avl_remove(&ddt->ddt_tree, dde);
+	avl_remove(&dds->dds_tree, dde);
 	ddt_free(dde);
 }
 
@@ -669,56 +1375,75 @@ ddt_entry_t *
 ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 {
 	ddt_entry_t *dde, dde_search;
+	ddt_shard_t *dds;
 	enum ddt_type type;
 	enum ddt_class class;
 	avl_index_t where;
 	int error;
 
-	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
-
 	ddt_key_fill(&dde_search.dde_key, bp);
+	dds = ddt_shard(ddt, &dde_search.dde_key);
+
+	ASSERT(MUTEX_HELD(&dds->dds_lock));
 
-	dde = avl_find(&ddt->ddt_tree, &dde_search, &where);
+	dde = avl_find(&dds->dds_tree, &dde_search, &where);
 	if (dde == NULL) {
 		if (!add)
 			return (NULL);
 		dde = ddt_alloc(&dde_search.dde_key);
-		avl_insert(&ddt->ddt_tree, dde, where);
+		avl_insert(&dds->dds_tree, dde, where);
 	}
 
 	while (dde->dde_loading)
-		cv_wait(&dde->dde_cv, &ddt->ddt_lock);
+		cv_wait(&dde->dde_cv, &dds->dds_lock);
 
 	if (dde->dde_loaded)
 		return (dde);
 
-	dde->dde_loading = B_TRUE;
+	/*
+	 * The DDT log holds the latest state of the entries in it, including
+	 * their removal, so only go to the DDT objects if it has none.
+	 */
+	if (ddt_log_lookup(ddt, dde, &class)) {
+		if (class == DDT_CLASSES) {
+			memset(dde->dde_phys, 0, sizeof (dde->dde_phys));
+			type = DDT_TYPES;
+			error = ENOENT;
+		} else {
+			type = DDT_TYPE_CURRENT;
+			error = 0;
+		}
+	} else {
+		dde->dde_loading = B_TRUE;
 
-	ddt_exit(ddt);
+		mutex_exit(&dds->dds_lock);
 
-	error = ENOENT;
+		error = ENOENT;
 
-	for (type = 0; type < DDT_TYPES; type++) {
-		for (class = 0; class < DDT_CLASSES; class++) {
-			error = ddt_object_lookup(ddt, type, class, dde);
-			if (error != ENOENT) {
-				ASSERT0(error);
-				break;
+		for (type = 0; type < DDT_TYPES; type++) {
+			for (class = 0; class < DDT_CLASSES; class++) {
+				error = ddt_object_lookup(ddt, type, class,
+				    dde);
+				if (error != ENOENT) {
+					ASSERT0(error);
+					break;
+				}
 			}
+			if (error != ENOENT)
+				break;
 		}
-		if (error != ENOENT)
-			break;
-	}
 
-	ddt_enter(ddt);
+		mutex_enter(&dds->dds_lock);
+
+		ASSERT(dde->dde_loading == B_TRUE);
+		dde->dde_loading = B_FALSE;
+	}
 
 	ASSERT(dde->dde_loaded == B_FALSE);
-	ASSERT(dde->dde_loading == B_TRUE);
 
 	dde->dde_type = type;	/* will be DDT_TYPES if no entry found */
 	dde->dde_class = class;	/* will be DDT_CLASSES if no entry found */
 	dde->dde_loaded = B_TRUE;
-	dde->dde_loading = B_FALSE;
 
 	if (error == 0)
 		ddt_stat_update(ddt, dde, -1ULL);
@@ -787,11 +1512,25 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	ddt = kmem_cache_alloc(ddt_cache, KM_SLEEP);
 	memset(ddt, 0, sizeof (ddt_t));
 
+	for (int i = 0; i < DDT_SHARDS; i++) {
+		ddt_shard_t *dds = &ddt->ddt_shard[i];
+
+		mutex_init(&dds->dds_lock, NULL, MUTEX_DEFAULT, NULL);
+		avl_create(&dds->dds_tree, ddt_entry_compare,
+		    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	}
 	mutex_init(&ddt->ddt_lock, NULL, MUTEX_DEFAULT, NULL);
-	avl_create(&ddt->ddt_tree, ddt_entry_compare,
-	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	mutex_init(&ddt->ddt_stat_lock, NULL, MUTEX_DEFAULT, NULL);
+	rw_init(&ddt->ddt_log_lock, NULL, RW_DEFAULT, NULL);
 	avl_create(&ddt->ddt_repair_tree, ddt_entry_compare,
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	for (int n = 0; n < 2; n++) {
+		avl_create(&ddt->ddt_log[n].ddl_tree, ddt_entry_compare,
+		    sizeof (ddt_log_entry_t),
+		    offsetof(ddt_log_entry_t, dle_node));
+	}
+	ddt->ddt_log_active = &ddt->ddt_log[0];
+	ddt->ddt_log_flushing = &ddt->ddt_log[1];
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
@@ -802,14 +1541,120 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 static void
 ddt_table_free(ddt_t *ddt)
 {
-	ASSERT(avl_numnodes(&ddt->ddt_tree) == 0);
+	ASSERT0(ddt_numnodes(ddt));
 	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
-	avl_destroy(&ddt->ddt_tree);
+	for (int n = 0; n < 2; n++) {
+		ddt_log_entry_t *dle;
+		void *cookie = NULL;
+
+		while ((dle = avl_destroy_nodes(&ddt->ddt_log[n].ddl_tree,
+		    &cookie)) != NULL)
+			kmem_cache_free(ddt_log_entry_cache, dle);
+		avl_destroy(&ddt->ddt_log[n].ddl_tree);
+	}
+	for (int i = 0; i < DDT_SHARDS; i++) {
+		avl_destroy(&ddt->ddt_shard[i].dds_tree);
+		mutex_destroy(&ddt->ddt_shard[i].dds_lock);
+	}
 	avl_destroy(&ddt->ddt_repair_tree);
+	rw_destroy(&ddt->ddt_log_lock);
+	mutex_destroy(&ddt->ddt_stat_lock);
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_cache_free(ddt_cache, ddt);
 }
 
+/*
+ * DDT pruning
+ *
+ * Most entries of a large DDT are unique, and an entry that has stayed
+ * unique for long is unlikely to ever gain a second reference, while it
+ * still costs memory and I/O on every lookup.  ddt_prune_unique_entries()
+ * removes the unique entries of blocks written more than a given number of
+ * days ago.  This turns those blocks into ordinary blocks: when
+ * zio_ddt_free() finds no DDT entry for a dedup block, it frees the block
+ * directly.
+ *
+ * Block pointers only record the txg of their birth, so ddt_sync() keeps a
+ * coarse txg-to-time map with one sample per hour while the pool uses
+ * dedup, to translate the age given by the user into a txg.
+ */
+
+/*
+ * Maximum number of DDT entries examined per txg while pruning.
+ */
+static uint_t zfs_dedup_prune_entries_max = 100000;
+
+#define	DDT_TXG_TIME_INTERVAL	3600	/* seconds between samples */
+
+static int
+ddt_txg_time_load(spa_t *spa)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	ddt_txg_time_t dtt;
+	dmu_buf_t *db;
+	int error;
+
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_DDT_TXG_TIME, sizeof (uint64_t), 1,
+	    &spa->spa_ddt_txg_time_object);
+	if (error != 0)
+		return (error);
+
+	error = dmu_bonus_hold(mos, spa->spa_ddt_txg_time_object, FTAG, &db);
+	if (error != 0)
+		return (error);
+	spa->spa_ddt_txg_time_count = *(uint64_t *)db->db_data;
+	dmu_buf_rele(db, FTAG);
+
+	if (spa->spa_ddt_txg_time_count == 0)
+		return (0);
+
+	error = dmu_read(mos, spa->spa_ddt_txg_time_object,
+	    (spa->spa_ddt_txg_time_count - 1) * sizeof (dtt), sizeof (dtt),
+	    &dtt, DMU_READ_PREFETCH);
+	if (error == 0)
+		spa->spa_ddt_txg_time_last = dtt.dtt_time;
+
+	return (error);
+}
+
+/*
+ * Append a sample to the txg-to-time map if the last one is more than
+ * DDT_TXG_TIME_INTERVAL old.
+ */
+static void
+ddt_txg_time_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	ddt_txg_time_t dtt;
+	dmu_buf_t *db;
+
+	dtt.dtt_txg = dmu_tx_get_txg(tx);
+	dtt.dtt_time = gethrestime_sec();
+
+	if (spa->spa_ddt_txg_time_object == 0) {
+		spa->spa_ddt_txg_time_object = dmu_object_alloc(mos,
+		    DMU_OTN_UINT64_METADATA, SPA_OLD_MAXBLOCKSIZE,
+		    DMU_OTN_UINT64_METADATA, sizeof (uint64_t), tx);
+		VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_DDT_TXG_TIME, sizeof (uint64_t), 1,
+		    &spa->spa_ddt_txg_time_object, tx));
+	} else if (dtt.dtt_time <
+	    spa->spa_ddt_txg_time_last + DDT_TXG_TIME_INTERVAL) {
+		return;
+	}
+
+	dmu_write(mos, spa->spa_ddt_txg_time_object,
+	    spa->spa_ddt_txg_time_count * sizeof (dtt), sizeof (dtt), &dtt, tx);
+	spa->spa_ddt_txg_time_count++;
+	spa->spa_ddt_txg_time_last = dtt.dtt_time;
+
+	VERIFY0(dmu_bonus_hold(mos, spa->spa_ddt_txg_time_object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	*(uint64_t *)db->db_data = spa->spa_ddt_txg_time_count;
+	dmu_buf_rele(db, FTAG);
+}
+
 void
 ddt_create(spa_t *spa)
 {
@@ -833,6 +1678,10 @@ ddt_load(spa_t *spa)
 	if (error)
 		return (error == ENOENT ? 0 : error);
 
+	error = ddt_txg_time_load(spa);
+	if (error != 0 && error != ENOENT)
+		return (error);
+
 	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
 		ddt_t *ddt = spa->spa_ddt[c];
 		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
@@ -844,6 +1693,10 @@ ddt_load(spa_t *spa)
 			}
 		}
 
+		error = ddt_log_load(ddt);
+		if (error != 0 && error != ENOENT)
+			return (error);
+
 		/*
 		 * Seed the cached histograms.
 		 */
@@ -852,6 +1705,8 @@ ddt_load(spa_t *spa)
 		spa->spa_dedup_dspace = ~0ULL;
 	}
 
+	spa->spa_dedup_dsize = ddt_get_ddt_dsize(spa);
+
 	return (0);
 }
 
@@ -864,6 +1719,10 @@ ddt_unload(spa_t *spa)
 			spa->spa_ddt[c] = NULL;
 		}
 	}
+
+	spa->spa_ddt_txg_time_object = 0;
+	spa->spa_ddt_txg_time_count = 0;
+	spa->spa_ddt_txg_time_last = 0;
 }
 
 boolean_t
@@ -871,6 +1730,8 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 {
 	ddt_t *ddt;
 	ddt_entry_t *dde;
+	enum ddt_class log_class;
+	boolean_t found;
 
 	if (!BP_GET_DEDUP(bp))
 		return (B_FALSE);
@@ -883,6 +1744,12 @@ ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 
 	ddt_key_fill(&(dde->dde_key), bp);
 
+	found = ddt_log_lookup(ddt, dde, &log_class);
+	if (found) {
+		kmem_cache_free(ddt_entry_cache, dde);
+		return (log_class <= max_class);
+	}
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class <= max_class; class++) {
 			if (ddt_object_lookup(ddt, type, class, dde) == 0) {
@@ -901,11 +1768,21 @@ ddt_repair_start(ddt_t *ddt, const blkptr_t *bp)
 {
 	ddt_key_t ddk;
 	ddt_entry_t *dde;
+	enum ddt_class log_class;
+	boolean_t found;
 
 	ddt_key_fill(&ddk, bp);
 
 	dde = ddt_alloc(&ddk);
 
+	found = ddt_log_lookup(ddt, dde, &log_class);
+	if (found) {
+		if (log_class != DDT_CLASS_UNIQUE && log_class != DDT_CLASSES)
+			return (dde);
+		memset(dde->dde_phys, 0, sizeof (dde->dde_phys));
+		return (dde);
+	}
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
 			/*
@@ -929,7 +1806,7 @@ ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde)
 {
 	avl_index_t where;
 
-	ddt_enter(ddt);
+	mutex_enter(&ddt->ddt_lock);
 
 	if (dde->dde_repair_abd != NULL && spa_writeable(ddt->ddt_spa) &&
 	    avl_find(&ddt->ddt_repair_tree, dde, &where) == NULL)
@@ -937,7 +1814,7 @@ ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde)
 	else
 		ddt_free(dde);
 
-	ddt_exit(ddt);
+	mutex_exit(&ddt->ddt_lock);
 }
 
 static void
@@ -986,22 +1863,23 @@ ddt_repair_table(ddt_t *ddt, zio_t *rio)
 	if (spa_sync_pass(spa) > 1)
 		return;
 
-	ddt_enter(ddt);
+	mutex_enter(&ddt->ddt_lock);
 	for (rdde = avl_first(t); rdde != NULL; rdde = rdde_next) {
 		rdde_next = AVL_NEXT(t, rdde);
 		avl_remove(&ddt->ddt_repair_tree, rdde);
-		ddt_exit(ddt);
+		mutex_exit(&ddt->ddt_lock);
 		ddt_bp_create(ddt->ddt_checksum, &rdde->dde_key, NULL, &blk);
 		dde = ddt_repair_start(ddt, &blk);
 		ddt_repair_entry(ddt, dde, rdde, rio);
 		ddt_repair_done(ddt, dde);
-		ddt_enter(ddt);
+		mutex_enter(&ddt->ddt_lock);
 	}
-	ddt_exit(ddt);
+	mutex_exit(&ddt->ddt_lock);
 }
 
 static void
-ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
+ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, ddt_log_update_t *dlu,
+    dmu_tx_t *tx, uint64_t txg)
 {
 	dsl_pool_t *dp = ddt->ddt_spa->spa_dsl_pool;
 	ddt_phys_t *ddp = dde->dde_phys;
@@ -1041,7 +1919,10 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	else
 		nclass = DDT_CLASS_UNIQUE;
 
-	if (otype != DDT_TYPES &&
+	if (dlu != NULL) {
+		if (otype != DDT_TYPES || total_refcnt != 0)
+			ddt_log_entry(ddt, dde, otype, oclass, dlu, tx);
+	} else if (otype != DDT_TYPES &&
 	    (otype != ntype || oclass != nclass || total_refcnt == 0)) {
 		VERIFY(ddt_object_remove(ddt, otype, oclass, dde, tx) == 0);
 		ASSERT(ddt_object_lookup(ddt, otype, oclass, dde) == ENOENT);
@@ -1053,7 +1934,10 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 		ddt_stat_update(ddt, dde, 0);
 		if (!ddt_object_exists(ddt, ntype, nclass))
 			ddt_object_create(ddt, ntype, nclass, tx);
-		VERIFY(ddt_object_update(ddt, ntype, nclass, dde, tx) == 0);
+		if (dlu == NULL) {
+			VERIFY(ddt_object_update(ddt, ntype, nclass, dde,
+			    tx) == 0);
+		}
 
 		/*
 		 * If the class changes, the order that we scan this bp
@@ -1069,28 +1953,16 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	}
 }
 
+/*
+ * Sync the statistics of the DDT objects, and destroy them once they and
+ * the logs are empty.
+ */
 static void
-ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
+ddt_sync_objects(ddt_t *ddt, dmu_tx_t *tx)
 {
 	spa_t *spa = ddt->ddt_spa;
-	ddt_entry_t *dde;
-	void *cookie = NULL;
-
-	if (avl_numnodes(&ddt->ddt_tree) == 0)
-		return;
-
-	ASSERT(spa->spa_uberblock.ub_version >= SPA_VERSION_DEDUP);
-
-	if (spa->spa_ddt_stat_object == 0) {
-		spa->spa_ddt_stat_object = zap_create_link(ddt->ddt_os,
-		    DMU_OT_DDT_STATS, DMU_POOL_DIRECTORY_OBJECT,
-		    DMU_POOL_DDT_STATS, tx);
-	}
-
-	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL) {
-		ddt_sync_entry(ddt, dde, tx, txg);
-		ddt_free(dde);
-	}
+	boolean_t log_empty = ddt_log_empty(ddt);
+	boolean_t objects = B_FALSE;
 
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		uint64_t add, count = 0;
@@ -1103,16 +1975,92 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 			}
 		}
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
-			if (count == 0 && ddt_object_exists(ddt, type, class))
+			if (!ddt_object_exists(ddt, type, class))
+				continue;
+			if (count == 0 && log_empty)
 				ddt_object_destroy(ddt, type, class, tx);
+			else
+				objects = B_TRUE;
 		}
 	}
 
+	if (!objects && log_empty && ddt->ddt_log[0].ddl_object != 0)
+		ddt_log_destroy(ddt, tx);
+
+	mutex_enter(&ddt->ddt_stat_lock);
 	memcpy(&ddt->ddt_histogram_cache, ddt->ddt_histogram,
 	    sizeof (ddt->ddt_histogram));
+	mutex_exit(&ddt->ddt_stat_lock);
 	spa->spa_dedup_dspace = ~0ULL;
 }
 
+static void
+ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
+{
+	spa_t *spa = ddt->ddt_spa;
+	ddt_entry_t *dde;
+	ddt_log_update_t dlu = { 0 };
+	size_t bufsize = DDT_LOG_BUF_RECORDS * sizeof (ddt_log_record_t);
+	uint64_t numnodes = ddt_numnodes(ddt);
+	boolean_t drain = ddt_log_draining(spa);
+	boolean_t log, dirty;
+
+	if (numnodes == 0 && ddt_log_empty(ddt))
+		return;
+
+	ASSERT(spa->spa_uberblock.ub_version >= SPA_VERSION_DEDUP);
+
+	if (spa->spa_ddt_stat_object == 0) {
+		spa->spa_ddt_stat_object = zap_create_link(ddt->ddt_os,
+		    DMU_OT_DDT_STATS, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_DDT_STATS, tx);
+	}
+
+	/*
+	 * The DDT objects change if there are entries to sync, or if log
+	 * entries are written back to them.
+	 */
+	dirty = (numnodes != 0);
+
+	/*
+	 * While draining, flush before logging this txg's changes, so that
+	 * they bypass the log as soon as it is empty.
+	 */
+	if (drain && !ddt_log_empty(ddt) && ddt_log_sync(ddt, B_TRUE, tx))
+		dirty = B_TRUE;
+
+	log = ddt_log_enabled(ddt);
+	if (!log) {
+		ASSERT(ddt_log_empty(ddt));
+	} else if (numnodes != 0) {
+		if (ddt->ddt_log[0].ddl_object == 0)
+			ddt_log_create(ddt, tx);
+		dlu.dlu_buf = vmem_alloc(bufsize, KM_SLEEP);
+	}
+
+	for (int i = 0; i < DDT_SHARDS; i++) {
+		void *cookie = NULL;
+
+		while ((dde = avl_destroy_nodes(&ddt->ddt_shard[i].dds_tree,
+		    &cookie)) != NULL) {
+			ddt_sync_entry(ddt, dde,
+			    dlu.dlu_buf != NULL ? &dlu : NULL, tx, txg);
+			ddt_free(dde);
+		}
+	}
+
+	if (dlu.dlu_buf != NULL) {
+		ddt_log_write(ddt, &dlu, tx);
+		vmem_free(dlu.dlu_buf, bufsize);
+	}
+
+	if (!drain && !ddt_log_empty(ddt) && ddt_log_sync(ddt, B_FALSE, tx))
+		dirty = B_TRUE;
+
+	if (dirty)
+		ddt_sync_objects(ddt, tx);
+}
+
 void
 ddt_sync(spa_t *spa, uint64_t txg)
 {
@@ -1147,9 +2095,29 @@ ddt_sync(spa_t *spa, uint64_t txg)
 	(void) zio_wait(rio);
 	scn->scn_zio_root = NULL;
 
+	if (spa->spa_ddt_stat_object != 0 && spa_sync_pass(spa) == 1)
+		ddt_txg_time_sync(spa, tx);
+	spa->spa_dedup_dsize = ddt_get_ddt_dsize(spa);
+
 	dmu_tx_commit(tx);
 }
 
+/*
+ * Returns B_TRUE if the logs of every DDT are empty.
+ */
+boolean_t
+ddt_log_drained(spa_t *spa)
+{
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+
+		if (ddt != NULL && !ddt_log_empty(ddt))
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
 int
 ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 {
@@ -1158,13 +2126,26 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 			do {
 				ddt_t *ddt = spa->spa_ddt[ddb->ddb_checksum];
 				int error = ENOENT;
-				if (ddt_object_exists(ddt, ddb->ddb_type,
-				    ddb->ddb_class)) {
-					error = ddt_object_walk(ddt,
-					    ddb->ddb_type, ddb->ddb_class,
-					    &ddb->ddb_cursor, dde);
+				if (ddb->ddb_type == DDT_TYPES) {
+					error = ddt_log_walk(ddt,
+					    ddb->ddb_class, &ddb->ddb_cursor,
+					    dde);
+				} else if (ddt_object_exists(ddt,
+				    ddb->ddb_type, ddb->ddb_class)) {
+					/*
+					 * Entries in the DDT log are
+					 * returned by the walk of the log.
+					 */
+					do {
+						error = ddt_object_walk(ddt,
+						    ddb->ddb_type,
+						    ddb->ddb_class,
+						    &ddb->ddb_cursor, dde);
+					} while (error == 0 &&
+					    ddt_log_contains(ddt, dde));
 				}
-				dde->dde_type = ddb->ddb_type;
+				dde->dde_type = ddb->ddb_type < DDT_TYPES ?
+				    ddb->ddb_type : DDT_TYPE_CURRENT;
 				dde->dde_class = ddb->ddb_class;
 				if (error == 0)
 					return (0);
@@ -1173,12 +2154,207 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 				ddb->ddb_cursor = 0;
 			} while (++ddb->ddb_checksum < ZIO_CHECKSUM_FUNCTIONS);
 			ddb->ddb_checksum = 0;
-		} while (++ddb->ddb_type < DDT_TYPES);
+		} while (++ddb->ddb_type <= DDT_TYPES);
 		ddb->ddb_type = 0;
 	} while (++ddb->ddb_class < DDT_CLASSES);
 
 	return (SET_ERROR(ENOENT));
 }
 
+typedef struct ddt_prune_arg {
+	uint64_t	dpa_txg;	/* prune entries born before this */
+	ddt_bookmark_t	dpa_ddb;	/* next entry to examine */
+	uint64_t	dpa_pruned;	/* entries pruned so far */
+	boolean_t	dpa_drained;	/* DDT logs drained, walk started */
+} ddt_prune_arg_t;
+
+/*
+ * Returns a txg such that every block born before it is more than the given
+ * number of days old, or 0 if the map has no such txg.  Zero days selects
+ * every block.
+ */
+static int
+ddt_prune_txg(spa_t *spa, uint64_t days, uint64_t *txgp)
+{
+	uint64_t now = gethrestime_sec();
+	uint64_t count = spa->spa_ddt_txg_time_count;
+	uint64_t lo = 0, hi = count;
+	ddt_txg_time_t dtt;
+	int error;
+
+	*txgp = 0;
+
+	if (days == 0) {
+		*txgp = UINT64_MAX;
+		return (0);
+	}
+	if (days >= now / 86400)
+		return (0);
+
+	/* Binary search for the last sample at least that old. */
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		error = dmu_read(spa->spa_meta_objset,
+		    spa->spa_ddt_txg_time_object, mid * sizeof (dtt),
+		    sizeof (dtt), &dtt, DMU_READ_PREFETCH);
+		if (error != 0)
+			return (error);
+
+		if (dtt.dtt_time <= now - days * 86400) {
+			*txgp = dtt.dtt_txg;
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Remove a unique entry from its DDT object if all of its blocks were born
+ * before txg.  Entries that are in memory are being changed this txg, and
+ * ddt_sync_entry() expects to find them where they were looked up, so
+ * they are left alone.  So are entries in the DDT log, which have changed
+ * since they were written to the DDT object, and are flushed back to it.
+ */
+static boolean_t
+ddt_prune_entry(ddt_t *ddt, enum ddt_type type, ddt_entry_t *dde,
+    uint64_t txg, dmu_tx_t *tx)
+{
+	ddt_shard_t *dds = ddt_shard(ddt, &dde->dde_key);
+	boolean_t pruned = B_FALSE;
+
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+		if (dde->dde_phys[p].ddp_phys_birth >= txg)
+			return (B_FALSE);
+	}
+
+	if (ddt_log_contains(ddt, dde))
+		return (B_FALSE);
+
+	mutex_enter(&dds->dds_lock);
+	if (avl_find(&dds->dds_tree, dde, NULL) == NULL) {
+		dde->dde_type = type;
+		dde->dde_class = DDT_CLASS_UNIQUE;
+		ddt_stat_update(ddt, dde, -1ULL);
+		VERIFY0(ddt_object_remove(ddt, type, DDT_CLASS_UNIQUE, dde,
+		    tx));
+		pruned = B_TRUE;
+	}
+	mutex_exit(&dds->dds_lock);
+
+	return (pruned);
+}
+
+/*
+ * Prune up to zfs_dedup_prune_entries_max entries, resuming from the
+ * bookmark of the previous call.  The DDT logs are drained first, over as
+ * many calls as it takes, so that the walk sees the entries logged before
+ * the prune started.
+ */
+static void
+ddt_prune_sync(void *arg, dmu_tx_t *tx)
+{
+	ddt_prune_arg_t *dpa = arg;
+	ddt_bookmark_t *ddb = &dpa->dpa_ddb;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	ddt_entry_t *dde = kmem_cache_alloc(ddt_entry_cache, KM_SLEEP);
+	uint64_t examined = 0;
+
+	if (!dpa->dpa_drained) {
+		for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+			ddt_t *ddt = spa->spa_ddt[c];
+
+			if (ddt != NULL && !ddt_log_empty(ddt) &&
+			    ddt_log_sync(ddt, B_TRUE, tx))
+				ddt_sync_objects(ddt, tx);
+		}
+		if (!ddt_log_drained(spa)) {
+			kmem_cache_free(ddt_entry_cache, dde);
+			return;
+		}
+		dpa->dpa_drained = B_TRUE;
+	}
+
+	for (; ddb->ddb_checksum < ZIO_CHECKSUM_FUNCTIONS;
+	    ddb->ddb_checksum++, ddb->ddb_type = 0) {
+		ddt_t *ddt = spa->spa_ddt[ddb->ddb_checksum];
+		boolean_t dirty = B_FALSE;
+
+		if (ddt == NULL)
+			continue;
+
+		for (; ddb->ddb_type < DDT_TYPES;
+		    ddb->ddb_type++, ddb->ddb_cursor = 0) {
+			while (examined < zfs_dedup_prune_entries_max &&
+			    ddt_object_exists(ddt, ddb->ddb_type,
+			    DDT_CLASS_UNIQUE) &&
+			    ddt_object_walk(ddt, ddb->ddb_type,
+			    DDT_CLASS_UNIQUE, &ddb->ddb_cursor, dde) == 0) {
+				examined++;
+				if (ddt_prune_entry(ddt, ddb->ddb_type, dde,
+				    dpa->dpa_txg, tx)) {
+					dpa->dpa_pruned++;
+					dirty = B_TRUE;
+				}
+			}
+			if (examined >= zfs_dedup_prune_entries_max)
+				break;
+		}
+
+		if (dirty)
+			ddt_sync_objects(ddt, tx);
+		if (examined >= zfs_dedup_prune_entries_max)
+			break;
+	}
+
+	kmem_cache_free(ddt_entry_cache, dde);
+
+	if (ddb->ddb_checksum == ZIO_CHECKSUM_FUNCTIONS) {
+		spa_history_log_internal(spa, "ddt prune", tx,
+		    "pruned=%llu", (u_longlong_t)dpa->dpa_pruned);
+	}
+}
+
+/*
+ * Remove the unique entries of blocks written more than the given number
+ * of days ago from the DDT, over as many txgs as it takes.
+ */
+int
+ddt_prune_unique_entries(spa_t *spa, uint64_t days)
+{
+	ddt_prune_arg_t dpa = { 0 };
+	int error;
+
+	if (spa->spa_ddt_stat_object == 0)
+		return (0);
+
+	error = ddt_prune_txg(spa, days, &dpa.dpa_txg);
+	if (error != 0 || dpa.dpa_txg == 0)
+		return (error);
+
+	do {
+		error = dsl_sync_task(spa_name(spa), NULL, ddt_prune_sync,
+		    &dpa, 0, ZFS_SPACE_CHECK_EXTRA_RESERVED);
+	} while (error == 0 &&
+	    dpa.dpa_ddb.ddb_checksum < ZIO_CHECKSUM_FUNCTIONS);
+
+	return (error);
+}
+
 ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, prefetch, INT, ZMOD_RW,
 	"Enable prefetching dedup-ed blks");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_flush_entries_min, UINT, ZMOD_RW,
+	"Minimum number of DDT log entries to flush per txg");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_flush_txgs, UINT, ZMOD_RW,
+	"Number of txgs over which to spread a DDT log flush");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_txg_max, UINT, ZMOD_RW,
+	"Number of txgs a DDT log accumulates before it is flushed");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, prune_entries_max, UINT, ZMOD_RW,
+	"Maximum number of DDT entries examined per txg while pruning");
@@ -2051,11 +2051,12 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 		 * algorithm (see comment in zio_nop_write) and
 		 * compression is enabled.  We don't enable nopwrite if
 		 * dedup is enabled as the two features are mutually
-		 * exclusive.
+		 * exclusive, nor for blocks that are rewritten to move them.
 		 */
 		nopwrite = (!dedup && (zio_checksum_table[checksum].ci_flags &
 		    ZCHECKSUM_FLAG_NOPWRITE) &&
-		    compress != ZIO_COMPRESS_OFF && zfs_nopwrite_enabled);
+		    compress != ZIO_COMPRESS_OFF && zfs_nopwrite_enabled &&
+		    !(wp & WP_REWRITE));
 	}
 
 	/*
@@ -71,6 +71,7 @@ static uint_t zfs_recv_queue_length = SPA_MAXBLOCKSIZE;
 static uint_t zfs_recv_queue_ff = 20;
 static uint_t zfs_recv_write_batch_size = 1024 * 1024;
 static int zfs_recv_best_effort_corrective = 0;
+static uint_t zfs_recv_writer_threads = 4;
 
 static const void *const dmu_recv_tag = "dmu_recv_tag";
 const char *const recv_clone_name = "%recv";
@@ -89,9 +90,26 @@ struct receive_record_arg {
 	int payload_size;
 	uint64_t bytes_read; /* bytes read from stream when record created */
 	boolean_t eos_marker; /* Marks the end of the stream */
+	boolean_t barrier_marker; /* Writer lanes must drain up to here */
+	struct receive_resume_pos *resume_pos; /* Set if handed to a lane */
 	bqueue_node_t node;
 };
 
+/*
+ * With more than one writer lane, records complete out of stream order. Each
+ * record handed to a lane is tracked by one of these until it completes, so
+ * that the resume state only ever covers a prefix of the stream which has
+ * been received in full. See receive_resume_pos_done().
+ */
+struct receive_resume_pos {
+	list_node_t node;
+	uint64_t object;	/* object of a write record, else 0 */
+	uint64_t offset;
+	uint64_t bytes_read;
+	uint64_t txg;		/* last txg the record's changes may be in */
+	boolean_t done;
+};
+
 struct receive_writer_arg {
 	objset_t *os;
 	boolean_t byteswap;
@@ -128,6 +146,24 @@ struct receive_writer_arg {
 	uint8_t or_mac[ZIO_DATA_MAC_LEN];
 	boolean_t or_byteorder;
 	zio_t *heal_pio;
+
+	/*
+	 * Records for independent objects may be applied by several writer
+	 * lanes. Each lane is a receive_writer_arg of its own which points
+	 * back to the parent and shares its objset and stream flags, but has
+	 * its own queue, write batch and error. See receive_writer_thread().
+	 */
+	struct receive_writer_arg *parent;
+	struct receive_writer_arg **lanes;
+	uint_t nlanes;
+	uint_t lanes_busy;	/* lanes yet to reach a marker */
+	kcondvar_t lanes_cv;	/* signalled when lanes_busy drops to 0 */
+	kmutex_t resume_lock;	/* protects resume_list and resume_* */
+	list_t resume_list;	/* records in flight on lanes, in order */
+	uint64_t resume_object;	/* resume point covered by all lanes */
+	uint64_t resume_offset;
+	uint64_t resume_bytes;
+	uint64_t resume_txg;
 };
 
 typedef struct dmu_recv_begin_arg {
@@ -1536,6 +1572,66 @@ deduce_nblkptr(dmu_object_type_t bonus_type, uint64_t bonus_size)
 	}
 }
 
+/*
+ * Called by a writer lane once all changes for a record have been assigned
+ * to a txg no later than txg. Advance the parent's resume point past every
+ * record at the head of the stream which is now complete.
+ */
+static void
+receive_resume_pos_done(struct receive_writer_arg *rwa,
+    struct receive_resume_pos *pos, uint64_t txg)
+{
+	struct receive_writer_arg *parent = rwa->parent;
+
+	if (pos == NULL)
+		return;
+
+	mutex_enter(&parent->resume_lock);
+	pos->txg = txg;
+	pos->done = B_TRUE;
+	while ((pos = list_head(&parent->resume_list)) != NULL && pos->done) {
+		list_remove(&parent->resume_list, pos);
+		if (pos->object != 0) {
+			parent->resume_object = pos->object;
+			parent->resume_offset = pos->offset;
+			parent->resume_bytes = pos->bytes_read;
+		}
+		parent->resume_txg = MAX(parent->resume_txg, pos->txg);
+		kmem_free(pos, sizeof (*pos));
+	}
+	mutex_exit(&parent->resume_lock);
+}
+
+/*
+ * Writer lanes save the parent's resume point rather than their own
+ * position, and only once every record it covers is in this txg or an
+ * earlier one. Otherwise a later save will catch up.
+ */
+static void
+save_resume_state_lanes(struct receive_writer_arg *rwa, dmu_tx_t *tx)
+{
+	struct receive_writer_arg *parent = rwa->parent;
+	dsl_dataset_t *ds = rwa->os->os_dsl_dataset;
+	int txgoff = dmu_tx_get_txg(tx) & TXG_MASK;
+
+	mutex_enter(&parent->resume_lock);
+	if (parent->resume_object != 0 &&
+	    parent->resume_txg <= dmu_tx_get_txg(tx)) {
+		ASSERT3U(parent->resume_object, >=,
+		    ds->ds_resume_object[txgoff]);
+		ASSERT(parent->resume_object != ds->ds_resume_object[txgoff] ||
+		    parent->resume_offset >= ds->ds_resume_offset[txgoff]);
+		ASSERT3U(parent->resume_bytes, >=,
+		    ds->ds_resume_bytes[txgoff]);
+		ASSERT(parent->resume_bytes != 0);
+
+		ds->ds_resume_object[txgoff] = parent->resume_object;
+		ds->ds_resume_offset[txgoff] = parent->resume_offset;
+		ds->ds_resume_bytes[txgoff] = parent->resume_bytes;
+	}
+	mutex_exit(&parent->resume_lock);
+}
+
 static void
 save_resume_state(struct receive_writer_arg *rwa,
     uint64_t object, uint64_t offset, dmu_tx_t *tx)
@@ -1545,6 +1641,11 @@ save_resume_state(struct receive_writer_arg *rwa,
 	if (!rwa->resumable)
 		return;
 
+	if (rwa->parent != NULL) {
+		save_resume_state_lanes(rwa, tx);
+		return;
+	}
+
 	/*
 	 * We use ds_resume_bytes[] != 0 to indicate that we need to
 	 * update this on disk, so it must not be 0.
@@ -2252,6 +2353,10 @@ flush_write_batch_impl(struct receive_writer_arg *rwa)
 		 * received (as opposed to the next record), so that we can
 		 * verify that we are resuming from the correct location.
 		 */
+		if (rwa->parent != NULL) {
+			receive_resume_pos_done(rwa, rrd->resume_pos,
+			    dmu_tx_get_txg(tx));
+		}
 		save_resume_state(rwa, drrw->drr_object, drrw->drr_offset, tx);
 
 		list_remove(&rwa->write_batch, rrd);
@@ -2759,6 +2864,40 @@ receive_read_prefetch(dmu_recv_cookie_t *drc, uint64_t object, uint64_t offset,
 	}
 }
 
+/*
+ * The payload of this WRITE record was compressed by the sender for transport
+ * only. Decompress it so the rest of the receive sees an ordinary
+ * uncompressed record, and the block is compressed according to the
+ * properties of the dataset being received into.
+ */
+static int
+receive_stream_decompress(dmu_recv_cookie_t *drc, struct drr_write *drrw,
+    abd_t **abdp)
+{
+	abd_t *abd = *abdp;
+
+	if (drc->drc_raw || !DRR_WRITE_COMPRESSED(drrw) ||
+	    drrw->drr_compressiontype >= ZIO_COMPRESS_FUNCTIONS ||
+	    drrw->drr_logical_size > SPA_MAXBLOCKSIZE ||
+	    drrw->drr_compressed_size > drrw->drr_logical_size)
+		return (SET_ERROR(EINVAL));
+
+	abd_t *dabd = abd_alloc_linear(drrw->drr_logical_size, B_FALSE);
+	if (zio_decompress_data(drrw->drr_compressiontype, abd,
+	    abd_to_buf(dabd), abd_get_size(abd), abd_get_size(dabd),
+	    NULL) != 0) {
+		abd_free(dabd);
+		return (SET_ERROR(EINVAL));
+	}
+	abd_free(abd);
+	*abdp = dabd;
+
+	drrw->drr_flags &= ~DRR_WRITE_STREAM_COMPRESSED;
+	drrw->drr_compressiontype = 0;
+	drrw->drr_compressed_size = 0;
+	return (0);
+}
+
 /*
  * Read records off the stream, issuing any necessary prefetches.
  */
@@ -2813,6 +2952,13 @@ receive_read_record(dmu_recv_cookie_t *drc)
 			abd_free(abd);
 			return (err);
 		}
+		if (drrw->drr_flags & DRR_WRITE_STREAM_COMPRESSED) {
+			err = receive_stream_decompress(drc, drrw, &abd);
+			if (err != 0) {
+				abd_free(abd);
+				return (err);
+			}
+		}
 		drc->drc_rrd->abd = abd;
 		receive_read_prefetch(drc, drrw->drr_object, drrw->drr_offset,
 		    drrw->drr_logical_size);
@@ -3115,9 +3261,304 @@ receive_process_record(struct receive_writer_arg *rwa,
 	return (err);
 }
 
+/*
+ * Apply one record, or just free it if this writer has already failed.
+ */
+static void
+receive_writer_process(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	/*
+	 * If there's an error, the main thread will stop putting things
+	 * on the queue, but we need to clear everything in it before we
+	 * can exit.
+	 */
+	int err = 0;
+	if (rwa->err == 0) {
+		err = receive_process_record(rwa, rrd);
+	} else if (rrd->abd != NULL) {
+		abd_free(rrd->abd);
+		rrd->abd = NULL;
+		rrd->payload = NULL;
+	} else if (rrd->payload != NULL) {
+		kmem_free(rrd->payload, rrd->payload_size);
+		rrd->payload = NULL;
+	}
+	/*
+	 * EAGAIN indicates that this record has been saved (on
+	 * raw->write_batch), and will be used again, so we don't
+	 * free it.
+	 * When healing data we always need to free the record.
+	 */
+	if (err != EAGAIN || rwa->heal) {
+		if (rwa->err == 0)
+			rwa->err = err;
+		/*
+		 * The record's transactions were all assigned to txgs no
+		 * later than the one open now.
+		 */
+		if (rwa->parent != NULL && err == 0 && rwa->err == 0) {
+			receive_resume_pos_done(rwa, rrd->resume_pos,
+			    dmu_objset_pool(rwa->os)->dp_tx.tx_open_txg);
+		}
+		kmem_free(rrd, sizeof (*rrd));
+	}
+}
+
+/*
+ * Writer lane thread; apply the records of the objects assigned to this lane
+ * in stream order. On a barrier or end of stream marker, flush the write
+ * batch and let the parent know that everything before the marker is done.
+ */
+static __attribute__((noreturn)) void
+receive_writer_lane_thread(void *arg)
+{
+	struct receive_writer_arg *rwa = arg;
+	struct receive_writer_arg *parent = rwa->parent;
+	struct receive_record_arg *rrd;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+	boolean_t eos = B_FALSE;
+
+	while (!eos) {
+		rrd = bqueue_dequeue(&rwa->q);
+		if (!rrd->eos_marker && !rrd->barrier_marker) {
+			receive_writer_process(rwa, rrd);
+			continue;
+		}
+
+		eos = rrd->eos_marker;
+		kmem_free(rrd, sizeof (*rrd));
+
+		int err = flush_write_batch(rwa);
+		if (rwa->err == 0)
+			rwa->err = err;
+
+		mutex_enter(&parent->mutex);
+		ASSERT3U(parent->lanes_busy, >, 0);
+		if (--parent->lanes_busy == 0)
+			cv_signal(&parent->lanes_cv);
+		mutex_exit(&parent->mutex);
+	}
+	spl_fstrans_unmark(cookie);
+	thread_exit();
+}
+
+/*
+ * Pick the writer lane for a record. All objects in a dnode block go to the
+ * same lane, since allocating or freeing a large dnode can affect the other
+ * objects in its block. Records which may affect objects in more than one
+ * dnode block, and records which carry state for the records after them,
+ * are applied by the parent once every lane has caught up.
+ */
+static struct receive_writer_arg *
+receive_writer_lane(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	uint64_t object, last;
+
+	switch (rrd->header.drr_type) {
+	case DRR_OBJECT:
+	{
+		struct drr_object *drro = &rrd->header.drr_u.drr_object;
+		object = drro->drr_object;
+		last = object + MAX(drro->drr_dn_slots, DNODE_MIN_SLOTS) - 1;
+		break;
+	}
+	case DRR_WRITE:
+		object = last = rrd->header.drr_u.drr_write.drr_object;
+		break;
+	case DRR_WRITE_EMBEDDED:
+		object = last = rrd->header.drr_u.drr_write_embedded.drr_object;
+		break;
+	case DRR_FREE:
+		object = last = rrd->header.drr_u.drr_free.drr_object;
+		break;
+	case DRR_SPILL:
+		object = last = rrd->header.drr_u.drr_spill.drr_object;
+		break;
+	default:
+		return (NULL);
+	}
+
+	if (object == DMU_META_DNODE_OBJECT || last < object ||
+	    (object >> DNODES_PER_BLOCK_SHIFT) !=
+	    (last >> DNODES_PER_BLOCK_SHIFT))
+		return (NULL);
+
+	return (rwa->lanes[(object >> DNODES_PER_BLOCK_SHIFT) % rwa->nlanes]);
+}
+
+/*
+ * Hand a marker to every lane and wait until all of them have reached it.
+ */
+static void
+receive_writer_lanes_wait(struct receive_writer_arg *rwa, boolean_t eos)
+{
+	mutex_enter(&rwa->mutex);
+	ASSERT0(rwa->lanes_busy);
+	rwa->lanes_busy = rwa->nlanes;
+	mutex_exit(&rwa->mutex);
+
+	for (uint_t i = 0; i < rwa->nlanes; i++) {
+		struct receive_record_arg *rrd =
+		    kmem_zalloc(sizeof (*rrd), KM_SLEEP);
+		rrd->eos_marker = eos;
+		rrd->barrier_marker = !eos;
+		bqueue_enqueue_flush(&rwa->lanes[i]->q, rrd, 1);
+	}
+
+	mutex_enter(&rwa->mutex);
+	while (rwa->lanes_busy != 0)
+		cv_wait(&rwa->lanes_cv, &rwa->mutex);
+	mutex_exit(&rwa->mutex);
+
+	for (uint_t i = 0; i < rwa->nlanes; i++) {
+		if (rwa->err == 0)
+			rwa->err = rwa->lanes[i]->err;
+	}
+}
+
+static void
+receive_writer_lanes_create(struct receive_writer_arg *rwa)
+{
+	rwa->nlanes = zfs_recv_writer_threads;
+	rwa->lanes = kmem_zalloc(rwa->nlanes * sizeof (*rwa->lanes), KM_SLEEP);
+	cv_init(&rwa->lanes_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&rwa->resume_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&rwa->resume_list, sizeof (struct receive_resume_pos),
+	    offsetof(struct receive_resume_pos, node));
+
+	for (uint_t i = 0; i < rwa->nlanes; i++) {
+		struct receive_writer_arg *lane =
+		    kmem_zalloc(sizeof (*lane), KM_SLEEP);
+
+		(void) bqueue_init(&lane->q, zfs_recv_queue_ff,
+		    MAX(zfs_recv_queue_length, 2 * zfs_max_recordsize),
+		    offsetof(struct receive_record_arg, node));
+		lane->os = rwa->os;
+		lane->byteswap = rwa->byteswap;
+		lane->tofs = rwa->tofs;
+		lane->resumable = rwa->resumable;
+		lane->spill = rwa->spill;
+		lane->full = rwa->full;
+		lane->parent = rwa;
+		list_create(&lane->write_batch,
+		    sizeof (struct receive_record_arg),
+		    offsetof(struct receive_record_arg, node.bqn_node));
+		rwa->lanes[i] = lane;
+
+		(void) thread_create(NULL, 0, receive_writer_lane_thread,
+		    lane, 0, curproc, TS_RUN, minclsyspri);
+	}
+}
+
+/*
+ * Stop the lanes once they have applied everything queued to them, and
+ * fold their state back into the parent.
+ */
+static void
+receive_writer_lanes_destroy(struct receive_writer_arg *rwa)
+{
+	struct receive_resume_pos *pos;
+
+	receive_writer_lanes_wait(rwa, B_TRUE);
+
+	for (uint_t i = 0; i < rwa->nlanes; i++) {
+		struct receive_writer_arg *lane = rwa->lanes[i];
+
+		rwa->max_object = MAX(rwa->max_object, lane->max_object);
+		ASSERT(list_is_empty(&lane->write_batch));
+		list_destroy(&lane->write_batch);
+		bqueue_destroy(&lane->q);
+		kmem_free(lane, sizeof (*lane));
+	}
+	kmem_free(rwa->lanes, rwa->nlanes * sizeof (*rwa->lanes));
+	rwa->lanes = NULL;
+	rwa->nlanes = 0;
+
+	/* Records which failed are never completed. */
+	while ((pos = list_remove_head(&rwa->resume_list)) != NULL)
+		kmem_free(pos, sizeof (*pos));
+	list_destroy(&rwa->resume_list);
+	mutex_destroy(&rwa->resume_lock);
+	cv_destroy(&rwa->lanes_cv);
+}
+
+/*
+ * Hand a record to its writer lane. Returns B_FALSE if the record must be
+ * applied by the parent instead.
+ */
+static boolean_t
+receive_writer_dispatch(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	struct receive_writer_arg *lane;
+
+	/*
+	 * Once a lane has failed, stop handing out records; the parent
+	 * frees everything else that is still queued to it.
+	 */
+	for (uint_t i = 0; i < rwa->nlanes && rwa->err == 0; i++)
+		rwa->err = rwa->lanes[i]->err;
+	if (rwa->err != 0)
+		return (B_FALSE);
+
+	/*
+	 * For resuming to work, write records must be in increasing order
+	 * by (object, offset). The lanes only see their own records, so
+	 * check the order across all of them here.
+	 */
+	if (rrd->header.drr_type == DRR_WRITE) {
+		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+
+		if (drrw->drr_object < rwa->last_object ||
+		    (drrw->drr_object == rwa->last_object &&
+		    drrw->drr_offset < rwa->last_offset)) {
+			rwa->err = SET_ERROR(EINVAL);
+			return (B_FALSE);
+		}
+		rwa->last_object = drrw->drr_object;
+		rwa->last_offset = drrw->drr_offset;
+	}
+
+	lane = receive_writer_lane(rwa, rrd);
+	if (lane == NULL) {
+		receive_writer_lanes_wait(rwa, B_FALSE);
+		return (B_FALSE);
+	}
+
+	if (rwa->resumable) {
+		struct receive_resume_pos *pos =
+		    kmem_zalloc(sizeof (*pos), KM_SLEEP);
+		if (rrd->header.drr_type == DRR_WRITE) {
+			pos->object = rrd->header.drr_u.drr_write.drr_object;
+			pos->offset = rrd->header.drr_u.drr_write.drr_offset;
+		} else if (rrd->header.drr_type == DRR_WRITE_EMBEDDED) {
+			pos->object =
+			    rrd->header.drr_u.drr_write_embedded.drr_object;
+			pos->offset =
+			    rrd->header.drr_u.drr_write_embedded.drr_offset;
+		}
+		pos->bytes_read = rrd->bytes_read;
+		mutex_enter(&rwa->resume_lock);
+		list_insert_tail(&rwa->resume_list, pos);
+		mutex_exit(&rwa->resume_lock);
+		rrd->resume_pos = pos;
+	}
+
+	bqueue_enqueue(&lane->q, rrd,
+	    sizeof (struct receive_record_arg) + rrd->payload_size);
+	return (B_TRUE);
+}
+
 /*
  * dmu_recv_stream's worker thread; pull records off the queue, and then call
  * receive_process_record  When we're done, signal the main thread and exit.
+ *
+ * When receiving a plain (not raw or healing) stream, records for objects in
+ * different dnode blocks are handed to zfs_recv_writer_threads writer lanes
+ * instead, which apply them concurrently. Each lane sees the records for its
+ * objects in stream order, so per-object ordering is unchanged.
  */
 static __attribute__((noreturn)) void
 receive_writer_thread(void *arg)
@@ -3126,38 +3567,20 @@ receive_writer_thread(void *arg)
 	struct receive_record_arg *rrd;
 	fstrans_cookie_t cookie = spl_fstrans_mark();
 
+	if (zfs_recv_writer_threads > 1 && !rwa->raw && !rwa->heal)
+		receive_writer_lanes_create(rwa);
+
 	for (rrd = bqueue_dequeue(&rwa->q); !rrd->eos_marker;
 	    rrd = bqueue_dequeue(&rwa->q)) {
-		/*
-		 * If there's an error, the main thread will stop putting things
-		 * on the queue, but we need to clear everything in it before we
-		 * can exit.
-		 */
-		int err = 0;
-		if (rwa->err == 0) {
-			err = receive_process_record(rwa, rrd);
-		} else if (rrd->abd != NULL) {
-			abd_free(rrd->abd);
-			rrd->abd = NULL;
-			rrd->payload = NULL;
-		} else if (rrd->payload != NULL) {
-			kmem_free(rrd->payload, rrd->payload_size);
-			rrd->payload = NULL;
-		}
-		/*
-		 * EAGAIN indicates that this record has been saved (on
-		 * raw->write_batch), and will be used again, so we don't
-		 * free it.
-		 * When healing data we always need to free the record.
-		 */
-		if (err != EAGAIN || rwa->heal) {
-			if (rwa->err == 0)
-				rwa->err = err;
-			kmem_free(rrd, sizeof (*rrd));
-		}
+		if (rwa->nlanes != 0 && receive_writer_dispatch(rwa, rrd))
+			continue;
+		receive_writer_process(rwa, rrd);
 	}
 	kmem_free(rrd, sizeof (*rrd));
 
+	if (rwa->nlanes != 0)
+		receive_writer_lanes_destroy(rwa);
+
 	if (rwa->heal) {
 		zio_wait(rwa->heal_pio);
 	} else {
@@ -3740,4 +4163,7 @@ ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, write_batch_size, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, best_effort_corrective, INT, ZMOD_RW,
 	"Ignore errors during corrective receive");
+
+ZFS_MODULE_PARAM(zfs_recv, zfs_recv_, writer_threads, UINT, ZMOD_RW,
+	"Number of threads applying the records of a receive");
 /* END CSTYLED */
@@ -94,6 +94,15 @@ static uint_t zfs_send_no_prefetch_queue_length = 1024 * 1024;
 static uint_t zfs_send_queue_ff = 20;
 static uint_t zfs_send_no_prefetch_queue_ff = 20;
 
+/*
+ * Number of threads issuing the data reads of a single send.  The reads are
+ * issued in stream order and are asynchronous either way, and the amount of
+ * data in flight is bounded by zfs_send_queue_length, which is what limits
+ * the number of reads outstanding.  More threads only help if looking the
+ * blocks up in the ARC and issuing the zios is itself the bottleneck.
+ */
+static uint_t zfs_send_reader_threads = 1;
+
 /*
  * Use this to override the recordsize calculation for fast zfs send estimates.
  */
@@ -167,6 +176,10 @@ struct send_range {
 			boolean_t		io_outstanding;
 			boolean_t		io_compressed;
 			int			io_err;
+			/* for reads handed to the reader threads */
+			taskq_ent_t		io_tqent;
+			objset_t		*io_os;
+			zio_flag_t		io_flags;
 		} data;
 		struct srh {
 			uint32_t		datablksz;
@@ -218,6 +231,7 @@ typedef struct dmu_send_cookie {
 	uint64_t dsc_last_data_offset;
 	uint64_t dsc_resume_object;
 	uint64_t dsc_resume_offset;
+	enum zio_compress dsc_stream_compress;
 	boolean_t dsc_sent_begin;
 	boolean_t dsc_sent_end;
 } dmu_send_cookie_t;
@@ -530,6 +544,42 @@ dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
 		payload_size = drrw->drr_logical_size;
 	}
 
+	/*
+	 * Compress the payload of blocks that would otherwise be sent as
+	 * they are in memory, if the stream was asked to be compressed.
+	 * Metadata is left alone so that receivers which do not know about
+	 * stream compression can still byteswap it.  When doing a dry run
+	 * there is no data to compress.
+	 */
+	void *cbuf = NULL;
+	if (dscp->dsc_stream_compress != ZIO_COMPRESS_OFF &&
+	    !DRR_WRITE_COMPRESSED(drrw) && !raw &&
+	    data != NULL && !DMU_OT_IS_METADATA(type)) {
+		enum zio_compress c = dscp->dsc_stream_compress;
+		zio_compress_info_t *ci = &zio_compress_table[c];
+		size_t d_len = lsize - (lsize >> 3);
+		size_t c_len;
+
+		cbuf = zio_data_buf_alloc(lsize);
+		c_len = ci->ci_compress(data, cbuf, lsize, d_len,
+		    c == ZIO_COMPRESS_ZSTD ? ZIO_ZSTD_LEVEL_DEFAULT :
+		    ci->ci_level);
+		/*
+		 * Pad the payload as a compressed block would be padded, so
+		 * receivers which store it as is get a valid physical size.
+		 */
+		if (c_len <= d_len &&
+		    P2ROUNDUP(c_len, SPA_MINBLOCKSIZE) < lsize) {
+			size_t p_len = P2ROUNDUP(c_len, SPA_MINBLOCKSIZE);
+			memset((char *)cbuf + c_len, 0, p_len - c_len);
+			drrw->drr_flags |= DRR_WRITE_STREAM_COMPRESSED;
+			drrw->drr_compressiontype = c;
+			drrw->drr_compressed_size = p_len;
+			payload_size = p_len;
+			data = cbuf;
+		}
+	}
+
 	if (bp == NULL || BP_IS_EMBEDDED(bp) || (BP_IS_PROTECTED(bp) && !raw)) {
 		/*
 		 * There's no pre-computed checksum for partial-block writes,
@@ -550,7 +600,10 @@ dmu_dump_write(dmu_send_cookie_t *dscp, dmu_object_type_t type, uint64_t object,
 		drrw->drr_key.ddk_cksum = bp->blk_cksum;
 	}
 
-	if (dump_record(dscp, data, payload_size) != 0)
+	int err = dump_record(dscp, data, payload_size);
+	if (cbuf != NULL)
+		zio_data_buf_free(cbuf, lsize);
+	if (err != 0)
 		return (SET_ERROR(EINTR));
 	return (0);
 }
@@ -1091,6 +1144,7 @@ range_alloc(enum type type, uint64_t object, uint64_t start_blkid,
 		range->sru.data.io_outstanding = 0;
 		range->sru.data.io_err = 0;
 		range->sru.data.io_compressed = B_FALSE;
+		taskq_init_ent(&range->sru.data.io_tqent);
 	}
 	return (range);
 }
@@ -1601,6 +1655,7 @@ struct send_reader_thread_arg {
 	boolean_t issue_reads;
 	uint64_t featureflags;
 	int error;
+	taskq_t *taskq;		/* Issues data reads, if not NULL */
 };
 
 static void
@@ -1621,6 +1676,58 @@ dmu_send_read_done(zio_t *zio)
 	mutex_exit(&range->sru.data.lock);
 }
 
+/*
+ * Read the data of a range, from the ARC if it is cached there and directly
+ * from disk otherwise.  If the caller has already marked the range as having
+ * an outstanding read, the mark is cleared once the data is available.
+ */
+static void
+send_issue_read(objset_t *os, struct send_range *range, zio_flag_t zioflags)
+{
+	struct srd *srdp = &range->sru.data;
+	blkptr_t *bp = &srdp->bp;
+
+	zbookmark_phys_t zb = {
+	    .zb_objset = dmu_objset_id(os),
+	    .zb_object = range->object,
+	    .zb_level = 0,
+	    .zb_blkid = range->start_blkid,
+	};
+
+	arc_flags_t aflags = ARC_FLAG_CACHED_ONLY;
+
+	int arc_err = arc_read(NULL, os->os_spa, bp,
+	    arc_getbuf_func, &srdp->abuf, ZIO_PRIORITY_ASYNC_READ,
+	    zioflags, &aflags, &zb);
+	/*
+	 * If the data is not already cached in the ARC, we read directly
+	 * from zio.  This avoids the performance overhead of adding a new
+	 * entry to the ARC, and we also avoid polluting the ARC cache with
+	 * data that is not likely to be used in the future.
+	 */
+	if (arc_err != 0) {
+		srdp->abd = abd_alloc_linear(srdp->datasz, B_FALSE);
+		srdp->io_outstanding = B_TRUE;
+		zio_nowait(zio_read(NULL, os->os_spa, bp, srdp->abd,
+		    srdp->datasz, dmu_send_read_done, range,
+		    ZIO_PRIORITY_ASYNC_READ, zioflags, &zb));
+	} else if (srdp->io_outstanding) {
+		mutex_enter(&srdp->lock);
+		srdp->io_outstanding = B_FALSE;
+		cv_broadcast(&srdp->cv);
+		mutex_exit(&srdp->lock);
+	}
+}
+
+static void
+send_read_task(void *arg)
+{
+	struct send_range *range = arg;
+
+	send_issue_read(range->sru.data.io_os, range,
+	    range->sru.data.io_flags);
+}
+
 static void
 issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 {
@@ -1674,31 +1781,21 @@ issue_data_read(struct send_reader_thread_arg *srta, struct send_range *range)
 	if (send_do_embed(bp, srta->featureflags))
 		return;
 
-	zbookmark_phys_t zb = {
-	    .zb_objset = dmu_objset_id(os),
-	    .zb_object = range->object,
-	    .zb_level = 0,
-	    .zb_blkid = range->start_blkid,
-	};
-
-	arc_flags_t aflags = ARC_FLAG_CACHED_ONLY;
+	if (srta->taskq == NULL) {
+		send_issue_read(os, range, zioflags);
+		return;
+	}
 
-	int arc_err = arc_read(NULL, os->os_spa, bp,
-	    arc_getbuf_func, &srdp->abuf, ZIO_PRIORITY_ASYNC_READ,
-	    zioflags, &aflags, &zb);
 	/*
-	 * If the data is not already cached in the ARC, we read directly
-	 * from zio.  This avoids the performance overhead of adding a new
-	 * entry to the ARC, and we also avoid polluting the ARC cache with
-	 * data that is not likely to be used in the future.
+	 * Hand the read to one of the reader threads.  The range is marked
+	 * outstanding until the read completes, so do_dump() and range_free()
+	 * wait for it just as for a read issued here.
 	 */
-	if (arc_err != 0) {
-		srdp->abd = abd_alloc_linear(srdp->datasz, B_FALSE);
-		srdp->io_outstanding = B_TRUE;
-		zio_nowait(zio_read(NULL, os->os_spa, bp, srdp->abd,
-		    srdp->datasz, dmu_send_read_done, range,
-		    ZIO_PRIORITY_ASYNC_READ, zioflags, &zb));
-	}
+	srdp->io_os = os;
+	srdp->io_flags = zioflags;
+	srdp->io_outstanding = B_TRUE;
+	taskq_dispatch_ent(srta->taskq, send_read_task, range, 0,
+	    &srdp->io_tqent);
 }
 
 /*
@@ -1930,6 +2027,7 @@ struct dmu_send_params {
 	boolean_t compressok;
 	boolean_t rawok;
 	boolean_t savedok;
+	enum zio_compress stream_compress;
 	uint64_t resumeobj;
 	uint64_t resumeoff;
 	uint64_t saved_guid;
@@ -1986,6 +2084,19 @@ setup_featureflags(struct dmu_send_params *dspp, objset_t *os,
 		*featureflags |= DMU_BACKUP_FEATURE_LZ4;
 	}
 
+	/*
+	 * Blocks compressed by the stream are stored with that compression by
+	 * receivers that do not understand DRR_WRITE_STREAM_COMPRESSED, so
+	 * the stream requires the matching compression feature.  Raw streams
+	 * carry ciphertext, which is not worth compressing.
+	 */
+	if (!(*featureflags & DMU_BACKUP_FEATURE_RAW)) {
+		if (dspp->stream_compress == ZIO_COMPRESS_LZ4)
+			*featureflags |= DMU_BACKUP_FEATURE_LZ4;
+		else if (dspp->stream_compress == ZIO_COMPRESS_ZSTD)
+			*featureflags |= DMU_BACKUP_FEATURE_ZSTD;
+	}
+
 	/*
 	 * We specifically do not include DMU_BACKUP_FEATURE_EMBED_DATA here to
 	 * allow sending ZSTD compressed datasets to a receiver that does not
@@ -2146,6 +2257,14 @@ setup_reader_thread(struct send_reader_thread_arg *srt_arg,
 	srt_arg->smta = smt_arg;
 	srt_arg->issue_reads = !dspp->dso->dso_dryrun;
 	srt_arg->featureflags = featureflags;
+	if (srt_arg->issue_reads && zfs_send_reader_threads > 1) {
+		/*
+		 * All entries are queued via taskq_dispatch_ent(), so
+		 * min/maxalloc configuration is not required.
+		 */
+		srt_arg->taskq = taskq_create("send_reader",
+		    zfs_send_reader_threads, minclsyspri, 0, 0, 0);
+	}
 	(void) thread_create(NULL, 0, send_reader_thread, srt_arg, 0,
 	    curproc, TS_RUN, minclsyspri);
 }
@@ -2450,6 +2569,8 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	dsc.dsc_featureflags = featureflags;
 	dsc.dsc_resume_object = dspp->resumeobj;
 	dsc.dsc_resume_offset = dspp->resumeoff;
+	dsc.dsc_stream_compress = (featureflags & DMU_BACKUP_FEATURE_RAW) ?
+	    ZIO_COMPRESS_OFF : dspp->stream_compress;
 
 	dsl_pool_rele(dp, tag);
 
@@ -2567,6 +2688,8 @@ dmu_send_impl(struct dmu_send_params *dspp)
 	}
 	range_free(range);
 
+	if (srt_arg->taskq != NULL)
+		taskq_destroy(srt_arg->taskq);
 	bqueue_destroy(&srt_arg->q);
 	bqueue_destroy(&smt_arg->q);
 	if (dspp->redactbook != NULL)
@@ -2636,8 +2759,8 @@ out:
 int
 dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
     boolean_t embedok, boolean_t large_block_ok, boolean_t compressok,
-    boolean_t rawok, boolean_t savedok, int outfd, offset_t *off,
-    dmu_send_outparams_t *dsop)
+    boolean_t rawok, boolean_t savedok, enum zio_compress stream_compress,
+    int outfd, offset_t *off, dmu_send_outparams_t *dsop)
 {
 	int err;
 	dsl_dataset_t *fromds;
@@ -2652,6 +2775,7 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 	dspp.tag = FTAG;
 	dspp.rawok = rawok;
 	dspp.savedok = savedok;
+	dspp.stream_compress = stream_compress;
 
 	dsflags = (rawok) ? DS_HOLD_FLAG_NONE : DS_HOLD_FLAG_DECRYPT;
 	err = dsl_pool_hold(pool, FTAG, &dspp.dp);
@@ -2726,8 +2850,8 @@ dmu_send_obj(const char *pool, uint64_t tosnap, uint64_t fromsnap,
 int
 dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
     boolean_t large_block_ok, boolean_t compressok, boolean_t rawok,
-    boolean_t savedok, uint64_t resumeobj, uint64_t resumeoff,
-    const char *redactbook, int outfd, offset_t *off,
+    boolean_t savedok, enum zio_compress stream_compress, uint64_t resumeobj,
+    uint64_t resumeoff, const char *redactbook, int outfd, offset_t *off,
     dmu_send_outparams_t *dsop)
 {
 	int err = 0;
@@ -2750,6 +2874,7 @@ dmu_send(const char *tosnap, const char *fromsnap, boolean_t embedok,
 	dspp.resumeoff = resumeoff;
 	dspp.rawok = rawok;
 	dspp.savedok = savedok;
+	dspp.stream_compress = stream_compress;
 
 	if (fromsnap != NULL && strpbrk(fromsnap, "@#") == NULL)
 		return (SET_ERROR(EINVAL));
@@ -3109,6 +3234,9 @@ ZFS_MODULE_PARAM(zfs_send, zfs_send_, no_prefetch_queue_length, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_send, zfs_send_, queue_ff, UINT, ZMOD_RW,
 	"Send queue fill fraction");
 
+ZFS_MODULE_PARAM(zfs_send, zfs_send_, reader_threads, UINT, ZMOD_RW,
+	"Number of threads issuing the data reads of a send");
+
 ZFS_MODULE_PARAM(zfs_send, zfs_send_, no_prefetch_queue_ff, UINT, ZMOD_RW,
 	"Send queue fill fraction for non-prefetch queues");
 
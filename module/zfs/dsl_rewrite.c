@@ -0,0 +1,534 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or https://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/dbuf.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_tx.h>
+#include <sys/dnode.h>
+#include <sys/dsl_dataset.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_rewrite.h>
+#include <sys/dsl_synctask.h>
+#include <sys/spa_impl.h>
+#include <sys/zap.h>
+#include <sys/zthr.h>
+
+/*
+ * Block rewrite.
+ *
+ * A rewrite walks the data blocks of a filesystem or volume and dirties
+ * them again, so that the normal write pipeline allocates them afresh from
+ * the pool's current free space. On a fragmented pool this turns scattered
+ * blocks back into large contiguous runs (one transaction group's worth of
+ * rewritten blocks of an object is allocated together), and it is also a
+ * way to apply changed properties such as compression or checksum to
+ * existing data.
+ *
+ * Only blocks that belong to the dataset alone are rewritten: those born
+ * after its most recent snapshot (or its origin, for a clone). Rewriting
+ * a block that a snapshot still references would only add a second copy.
+ * The most recent snapshot is looked up again for every batch, so
+ * snapshots taken while the rewrite runs are respected too. Blocks born
+ * after the rewrite started have already been written afresh and are
+ * skipped as well, which also guarantees that the walk terminates.
+ *
+ * Candidate blocks are found with dmu_object_next() and
+ * dnode_next_offset(), both of which prune whole subtrees by birth txg
+ * the same way dmu_traverse does, but which are safe to use on a live
+ * dataset that is being modified under us.
+ *
+ * The walk is done by a per-pool zthr. Its position (object and offset)
+ * is synced to DMU_POOL_REWRITE in the MOS along with each txg of
+ * rewritten blocks, so it resumes where it left off after an export or a
+ * reboot. Like a scrub, it is throttled so as not to monopolize the pool:
+ * at most zfs_rewrite_txg_bytes are dirtied per txg.
+ */
+
+/*
+ * Maximum number of bytes rewritten per txg.
+ */
+static uint64_t zfs_rewrite_txg_bytes = 64 << 20;
+
+/*
+ * Maximum number of blocks dirtied in a single transaction.
+ */
+static uint_t zfs_rewrite_batch_blocks = 32;
+
+int
+dsl_rewrite_init(spa_t *spa)
+{
+	int error;
+
+	error = zap_lookup(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_REWRITE, sizeof (uint64_t),
+	    sizeof (spa->spa_rewrite_phys) / sizeof (uint64_t),
+	    &spa->spa_rewrite_phys);
+	if (error == ENOENT) {
+		memset(&spa->spa_rewrite_phys, 0,
+		    sizeof (spa->spa_rewrite_phys));
+		spa->spa_rewrite_phys.drp_state = DSS_NONE;
+		return (0);
+	}
+	return (error);
+}
+
+static void
+dsl_rewrite_phys_sync(spa_t *spa, dmu_tx_t *tx)
+{
+	ASSERT(MUTEX_HELD(&spa->spa_rewrite_lock));
+
+	VERIFY0(zap_update(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_REWRITE, sizeof (uint64_t),
+	    sizeof (spa->spa_rewrite_phys) / sizeof (uint64_t),
+	    &spa->spa_rewrite_phys, tx));
+}
+
+/*
+ * Record the progress made in this txg. The rewritten blocks and the
+ * position that follows them are synced together.
+ */
+static void
+dsl_rewrite_progress_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = arg;
+	dsl_rewrite_phys_t *drp =
+	    &spa->spa_rewrite_progress[dmu_tx_get_txg(tx) & TXG_MASK];
+
+	mutex_enter(&spa->spa_rewrite_lock);
+	if (spa->spa_rewrite_phys.drp_state == DSS_SCANNING &&
+	    drp->drp_max_txg == spa->spa_rewrite_phys.drp_max_txg) {
+		spa->spa_rewrite_phys.drp_object = drp->drp_object;
+		spa->spa_rewrite_phys.drp_offset = drp->drp_offset;
+		spa->spa_rewrite_phys.drp_blocks = drp->drp_blocks;
+		spa->spa_rewrite_phys.drp_bytes = drp->drp_bytes;
+		dsl_rewrite_phys_sync(spa, tx);
+	}
+	memset(drp, 0, sizeof (*drp));
+	mutex_exit(&spa->spa_rewrite_lock);
+}
+
+static void
+dsl_rewrite_done_sync(void *arg, dmu_tx_t *tx)
+{
+	dsl_rewrite_phys_t *drw = arg;
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+
+	mutex_enter(&spa->spa_rewrite_lock);
+	if (spa->spa_rewrite_phys.drp_state == DSS_SCANNING &&
+	    drw->drp_max_txg == spa->spa_rewrite_phys.drp_max_txg) {
+		spa->spa_rewrite_phys = *drw;
+		spa->spa_rewrite_phys.drp_end_time = gethrestime_sec();
+		dsl_rewrite_phys_sync(spa, tx);
+		spa_history_log_internal(spa, "rewrite done", tx,
+		    "dsobj=%llu state=%llu blocks=%llu bytes=%llu",
+		    (u_longlong_t)drw->drp_dsobj,
+		    (u_longlong_t)drw->drp_state,
+		    (u_longlong_t)drw->drp_blocks,
+		    (u_longlong_t)drw->drp_bytes);
+	}
+	mutex_exit(&spa->spa_rewrite_lock);
+}
+
+/*
+ * Rewrite up to zfs_rewrite_batch_blocks data blocks of one object in a
+ * single transaction, starting the search at drw->drp_offset. Advances
+ * drw past the blocks that were looked at, and returns the txg they were
+ * dirtied in through txgp. Returns ESRCH when the end of the object is
+ * reached.
+ */
+static int
+dsl_rewrite_batch(spa_t *spa, dnode_t *dn, uint64_t min_txg,
+    dsl_rewrite_phys_t *drw, uint64_t *txgp)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	uint64_t blksz = dn->dn_datablksz;
+	uint_t nblocks = MIN(zfs_rewrite_batch_blocks, 1024);
+	uint64_t *offsets = kmem_alloc(nblocks * sizeof (uint64_t), KM_SLEEP);
+	dmu_buf_t **dbs = kmem_alloc(nblocks * sizeof (dmu_buf_t *), KM_SLEEP);
+	uint64_t offset = drw->drp_offset;
+	uint_t n = 0;
+	int error = 0, search = 0;
+
+	/*
+	 * Find the next blocks that are not shared with a snapshot, and
+	 * start reading them in.
+	 */
+	while (n < nblocks) {
+		search = dnode_next_offset(dn, 0, &offset, 1, 1, min_txg);
+		if (search != 0)
+			break;
+		offset = P2ALIGN(offset, blksz);
+		dmu_prefetch(dn->dn_objset, dn->dn_object, 0, offset, blksz,
+		    ZIO_PRIORITY_ASYNC_READ);
+		offsets[n++] = offset;
+		offset += blksz;
+	}
+	if (n == 0) {
+		kmem_free(dbs, nblocks * sizeof (dmu_buf_t *));
+		kmem_free(offsets, nblocks * sizeof (uint64_t));
+		return (search);
+	}
+
+	/*
+	 * Wait for the reads before assigning the transaction, so that no
+	 * disk read is done while holding an assigned tx, which would stall
+	 * the quiesce of the txg for every writer to the pool. A read error
+	 * only skips that block.
+	 */
+	for (uint_t i = 0; i < n; i++) {
+		if (dmu_buf_hold_by_dnode(dn, offsets[i], FTAG, &dbs[i],
+		    DMU_READ_NO_PREFETCH) != 0)
+			dbs[i] = NULL;
+	}
+
+	dmu_tx_t *tx = dmu_tx_create(dn->dn_objset);
+	for (uint_t i = 0; i < n; i++)
+		dmu_tx_hold_write_by_dnode(tx, dn, offsets[i], blksz);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error != 0) {
+		dmu_tx_abort(tx);
+		for (uint_t i = 0; i < n; i++) {
+			if (dbs[i] != NULL)
+				dmu_buf_rele(dbs[i], FTAG);
+		}
+		kmem_free(dbs, nblocks * sizeof (dmu_buf_t *));
+		kmem_free(offsets, nblocks * sizeof (uint64_t));
+		return (error);
+	}
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	for (uint_t i = 0; i < n; i++) {
+		uint64_t blkid = dbuf_whichblock(dn, 0, offsets[i]);
+		blkptr_t bp;
+
+		if (dbs[i] == NULL)
+			continue;
+
+		/*
+		 * Re-check the block under the dnode's locks, it may have
+		 * been rewritten or freed since it was found.
+		 */
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
+		error = dbuf_dnode_findbp(dn, 0, blkid, &bp, NULL, NULL);
+		rw_exit(&dn->dn_struct_rwlock);
+		if (error == 0 &&
+		    !BP_IS_HOLE(&bp) && !BP_IS_EMBEDDED(&bp) &&
+		    !BP_GET_DEDUP(&bp) &&
+		    bp.blk_birth > min_txg &&
+		    bp.blk_birth <= drw->drp_max_txg) {
+			dmu_buf_will_rewrite(dbs[i], tx);
+			drw->drp_blocks++;
+			drw->drp_bytes += blksz;
+		}
+		dmu_buf_rele(dbs[i], FTAG);
+	}
+
+	drw->drp_offset = (search == ESRCH) ? UINT64_MAX : offset;
+
+	/*
+	 * Register the progress of this txg once, and keep it up to date
+	 * for every batch that lands in it.
+	 */
+	mutex_enter(&spa->spa_rewrite_lock);
+	dsl_rewrite_phys_t *drp = &spa->spa_rewrite_progress[txg & TXG_MASK];
+	boolean_t first = (drp->drp_max_txg == 0);
+	*drp = *drw;
+	mutex_exit(&spa->spa_rewrite_lock);
+	if (first)
+		dsl_sync_task_nowait(dp, dsl_rewrite_progress_sync, spa, tx);
+
+	dmu_tx_commit(tx);
+	kmem_free(dbs, nblocks * sizeof (dmu_buf_t *));
+	kmem_free(offsets, nblocks * sizeof (uint64_t));
+
+	*txgp = txg;
+	return (search == ESRCH ? ESRCH : 0);
+}
+
+/*
+ * Hold the dataset being rewritten for one batch of work. The dataset is
+ * long-held so that it stays around without holding the pool config lock,
+ * which can't be held across dmu_tx_assign().
+ */
+static int
+dsl_rewrite_hold(spa_t *spa, uint64_t dsobj, dsl_dataset_t **dsp,
+    objset_t **osp, uint64_t *min_txg)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dsl_dataset_t *ds;
+	int error;
+
+	dsl_pool_config_enter(dp, FTAG);
+	error = dsl_dataset_hold_obj_flags(dp, dsobj, DS_HOLD_FLAG_DECRYPT,
+	    FTAG, &ds);
+	if (error == 0) {
+		error = dmu_objset_from_ds(ds, osp);
+		if (error != 0) {
+			dsl_dataset_rele_flags(ds, DS_HOLD_FLAG_DECRYPT, FTAG);
+		} else {
+			*min_txg = dsl_dataset_phys(ds)->ds_prev_snap_txg;
+			dsl_dataset_long_hold(ds, FTAG);
+			*dsp = ds;
+		}
+	}
+	dsl_pool_config_exit(dp, FTAG);
+
+	return (error);
+}
+
+static void
+dsl_rewrite_rele(dsl_dataset_t *ds)
+{
+	dsl_dataset_long_rele(ds, FTAG);
+	dsl_dataset_rele_flags(ds, DS_HOLD_FLAG_DECRYPT, FTAG);
+}
+
+static boolean_t
+dsl_rewrite_thread_check(void *arg, zthr_t *zthr)
+{
+	(void) zthr;
+	spa_t *spa = arg;
+
+	return (spa->spa_rewrite_phys.drp_state == DSS_SCANNING);
+}
+
+static void
+dsl_rewrite_thread(void *arg, zthr_t *zthr)
+{
+	spa_t *spa = arg;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dsl_rewrite_phys_t drw;
+	uint64_t txg_bytes = 0;
+	uint64_t cur_txg = 0;
+	int error = 0;
+
+	mutex_enter(&spa->spa_rewrite_lock);
+	drw = spa->spa_rewrite_phys;
+	mutex_exit(&spa->spa_rewrite_lock);
+
+	zfs_dbgmsg("rewrite of dsobj %llu resuming at object %llu "
+	    "offset %llu", (u_longlong_t)drw.drp_dsobj,
+	    (u_longlong_t)drw.drp_object, (u_longlong_t)drw.drp_offset);
+
+	while (!zthr_iscancelled(zthr)) {
+		dsl_dataset_t *ds;
+		objset_t *os;
+		uint64_t min_txg;
+		dnode_t *dn;
+
+		/* Stop if the rewrite was cancelled or restarted. */
+		mutex_enter(&spa->spa_rewrite_lock);
+		boolean_t active =
+		    (spa->spa_rewrite_phys.drp_state == DSS_SCANNING &&
+		    spa->spa_rewrite_phys.drp_max_txg == drw.drp_max_txg);
+		mutex_exit(&spa->spa_rewrite_lock);
+		if (!active)
+			return;
+
+		/* Throttle to zfs_rewrite_txg_bytes per txg. */
+		if (txg_bytes >= zfs_rewrite_txg_bytes) {
+			txg_wait_open(dp, cur_txg + 1, B_FALSE);
+			txg_bytes = 0;
+		}
+
+		error = dsl_rewrite_hold(spa, drw.drp_dsobj, &ds, &os,
+		    &min_txg);
+		if (error != 0)
+			break;
+
+		if (drw.drp_object == 0 || drw.drp_offset == UINT64_MAX) {
+			/* Move on to the next object changed since min_txg. */
+			error = dmu_object_next(os, &drw.drp_object, B_FALSE,
+			    min_txg);
+			drw.drp_offset = 0;
+			dsl_rewrite_rele(ds);
+			if (error != 0)
+				break;
+			continue;
+		}
+
+		error = dnode_hold(os, drw.drp_object, FTAG, &dn);
+		if (error == 0) {
+			if (DMU_OT_IS_FILE(dn->dn_type) ||
+			    dn->dn_type == DMU_OT_ZVOL) {
+				uint64_t txg = cur_txg;
+				uint64_t bytes = drw.drp_bytes;
+				error = dsl_rewrite_batch(spa, dn, min_txg,
+				    &drw, &txg);
+				if (txg != cur_txg) {
+					/* The batch landed in a new txg. */
+					cur_txg = txg;
+					txg_bytes = 0;
+				}
+				txg_bytes += drw.drp_bytes - bytes;
+			} else {
+				error = ESRCH;
+			}
+			dnode_rele(dn, FTAG);
+		}
+		dsl_rewrite_rele(ds);
+
+		if (error == ESRCH || error == ENOENT) {
+			/* Done with this object (or it was freed). */
+			drw.drp_offset = UINT64_MAX;
+			error = 0;
+		} else if (error != 0) {
+			break;
+		}
+	}
+
+	if (zthr_iscancelled(zthr))
+		return;
+
+	/*
+	 * ESRCH from dmu_object_next() means that every object was looked
+	 * at. Anything else (e.g. the dataset was destroyed, its key was
+	 * unloaded or the pool is out of space) ends the rewrite early.
+	 */
+	drw.drp_state = (error == ESRCH) ? DSS_FINISHED : DSS_CANCELED;
+	zfs_dbgmsg("rewrite of dsobj %llu ended with error %d after %llu "
+	    "blocks", (u_longlong_t)drw.drp_dsobj, error,
+	    (u_longlong_t)drw.drp_blocks);
+	(void) dsl_sync_task(spa_name(spa), NULL, dsl_rewrite_done_sync,
+	    &drw, 0, ZFS_SPACE_CHECK_EXTRA_RESERVED);
+}
+
+void
+dsl_rewrite_start_thread(spa_t *spa)
+{
+	ASSERT3P(spa->spa_rewrite_zthr, ==, NULL);
+	spa->spa_rewrite_zthr = zthr_create("z_rewrite",
+	    dsl_rewrite_thread_check, dsl_rewrite_thread, spa, minclsyspri);
+}
+
+typedef struct dsl_rewrite_arg {
+	const char	*dra_dsname;
+	boolean_t	dra_stop;
+} dsl_rewrite_arg_t;
+
+static int
+dsl_rewrite_check(void *arg, dmu_tx_t *tx)
+{
+	dsl_rewrite_arg_t *dra = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	spa_t *spa = dp->dp_spa;
+	dsl_dataset_t *ds;
+	int error;
+
+	error = dsl_dataset_hold_flags(dp, dra->dra_dsname,
+	    DS_HOLD_FLAG_DECRYPT, FTAG, &ds);
+	if (error != 0)
+		return (error);
+
+	if (ds->ds_is_snapshot) {
+		error = SET_ERROR(EINVAL);
+	} else if (dra->dra_stop) {
+		if (spa->spa_rewrite_phys.drp_state != DSS_SCANNING ||
+		    spa->spa_rewrite_phys.drp_dsobj != ds->ds_object)
+			error = SET_ERROR(ENOENT);
+	} else if (spa->spa_rewrite_phys.drp_state == DSS_SCANNING) {
+		error = SET_ERROR(EBUSY);
+	}
+
+	dsl_dataset_rele_flags(ds, DS_HOLD_FLAG_DECRYPT, FTAG);
+	return (error);
+}
+
+static void
+dsl_rewrite_sync(void *arg, dmu_tx_t *tx)
+{
+	dsl_rewrite_arg_t *dra = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	spa_t *spa = dp->dp_spa;
+	dsl_rewrite_phys_t *drp = &spa->spa_rewrite_phys;
+	dsl_dataset_t *ds;
+
+	VERIFY0(dsl_dataset_hold(dp, dra->dra_dsname, FTAG, &ds));
+
+	mutex_enter(&spa->spa_rewrite_lock);
+	if (dra->dra_stop) {
+		drp->drp_state = DSS_CANCELED;
+		drp->drp_end_time = gethrestime_sec();
+	} else {
+		memset(drp, 0, sizeof (*drp));
+		drp->drp_state = DSS_SCANNING;
+		drp->drp_dsobj = ds->ds_object;
+		drp->drp_max_txg = dmu_tx_get_txg(tx);
+		drp->drp_start_time = gethrestime_sec();
+	}
+	dsl_rewrite_phys_sync(spa, tx);
+	mutex_exit(&spa->spa_rewrite_lock);
+
+	spa_history_log_internal_ds(ds, dra->dra_stop ? "rewrite cancel" :
+	    "rewrite", tx, "");
+	dsl_dataset_rele(ds, FTAG);
+}
+
+static int
+dsl_rewrite_command(const char *dsname, boolean_t stop)
+{
+	dsl_rewrite_arg_t dra = {
+		.dra_dsname = dsname,
+		.dra_stop = stop,
+	};
+	spa_t *spa;
+	int error;
+
+	error = dsl_sync_task(dsname, dsl_rewrite_check, dsl_rewrite_sync,
+	    &dra, 0, ZFS_SPACE_CHECK_RESERVED);
+	if (error != 0)
+		return (error);
+
+	if (!stop && spa_open(dsname, &spa, FTAG) == 0) {
+		if (spa->spa_rewrite_zthr != NULL)
+			zthr_wakeup(spa->spa_rewrite_zthr);
+		spa_close(spa, FTAG);
+	}
+
+	return (0);
+}
+
+/*
+ * Start rewriting the blocks of the given filesystem or volume. Only one
+ * rewrite can run in a pool at a time.
+ */
+int
+dsl_rewrite_start(const char *dsname)
+{
+	return (dsl_rewrite_command(dsname, B_FALSE));
+}
+
+/*
+ * Cancel the rewrite of the given dataset.
+ */
+int
+dsl_rewrite_stop(const char *dsname)
+{
+	return (dsl_rewrite_command(dsname, B_TRUE));
+}
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, rewrite_txg_bytes, U64, ZMOD_RW,
+	"Max bytes rewritten per txg by zfs rewrite");
+
+ZFS_MODULE_PARAM(zfs, zfs_, rewrite_batch_blocks, UINT, ZMOD_RW,
+	"Max blocks rewritten per transaction by zfs rewrite");
+/* END CSTYLED */
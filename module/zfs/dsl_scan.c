@@ -149,6 +149,22 @@ static int zfs_scan_strict_mem_lim = B_FALSE;
  */
 static uint64_t zfs_scan_vdev_limit = 4 << 20;
 
+/*
+ * Latency feedback for sorted scan I/O.  When zfs_scan_qos_target_us is
+ * set, every zfs_scan_qos_interval_ms each top-level vdev's issuing thread
+ * looks at the latency of the synchronous (foreground) I/Os its leaves
+ * completed in the meantime.  If their 99th percentile is above the target,
+ * the in-flight limit derived from zfs_scan_vdev_limit is halved, down to
+ * zfs_scan_qos_min_pct percent of it; otherwise it grows back by
+ * zfs_scan_qos_step_pct percent per interval.  The resulting limit is
+ * reported by 'zpool status'.
+ */
+static uint_t zfs_scan_qos_target_us = 0;
+static uint_t zfs_scan_qos_interval_ms = 500;
+static uint_t zfs_scan_qos_min_pct = 5;
+static uint_t zfs_scan_qos_step_pct = 10;
+#define	SCAN_QOS_PERCENTILE	99
+
 static uint_t zfs_scan_issue_strategy = 0;
 
 /* don't queue & sort zios, go direct */
@@ -186,10 +202,15 @@ static uint_t zfs_free_min_time_ms = 1000;
 /* minimum milliseconds to resilver per txg */
 static uint_t zfs_resilver_min_time_ms = 3000;
 
+/* issue resilver I/O for metadata as soon as it is found */
+static int zfs_resilver_metadata_first = B_FALSE;
+
 static uint_t zfs_scan_checkpoint_intval = 7200; /* in seconds */
 int zfs_scan_suspend_progress = 0; /* set to prevent scans from progressing */
 static int zfs_no_scrub_io = B_FALSE; /* set to disable scrub i/o */
 static int zfs_no_scrub_prefetch = B_FALSE; /* set to disable scrub prefetch */
+/* max number of queued datasets to prefetch ahead of the traversal */
+static uint_t zfs_scan_prefetch_datasets = 0;
 static const enum ddt_class zfs_scrub_ddt_class_max = DDT_CLASS_DUPLICATE;
 /* max number of blocks to free in a single TXG */
 static uint64_t zfs_async_block_max_blocks = UINT64_MAX;
@@ -231,6 +252,7 @@ static scan_cb_t *scan_funcs[POOL_SCAN_FUNCS] = {
 typedef struct {
 	uint64_t	sds_dsobj;
 	uint64_t	sds_txg;
+	boolean_t	sds_prefetched;	/* root blocks prefetched ahead */
 	avl_node_t	sds_node;
 } scan_ds_t;
 
@@ -309,6 +331,8 @@ struct dsl_scan_io_queue {
 	uint64_t	q_maxinflight_bytes;
 	uint64_t	q_inflight_bytes;
 	kcondvar_t	q_zio_cv; /* used under vd->vdev_scan_io_queue_lock */
+	uint64_t	q_qos_pct; /* % of in-flight limit left by QoS */
+	hrtime_t	q_qos_last; /* time of last QoS update */
 
 	/* per txg statistics */
 	uint64_t	q_total_seg_size_this_txg;
@@ -322,6 +346,8 @@ typedef struct scan_prefetch_ctx {
 	zfs_refcount_t spc_refcnt;	/* refcount for memory management */
 	dsl_scan_t *spc_scn;		/* dsl_scan_t for the pool */
 	boolean_t spc_root;		/* is this prefetch for an objset? */
+	boolean_t spc_ahead;		/* ahead of the traversal's objset? */
+	uint64_t spc_min_txg;		/* min txg of the objset */
 	uint8_t spc_indblkshift;	/* dn_indblkshift of current dnode */
 	uint16_t spc_datablkszsec;	/* dn_idatablkszsec of current dnode */
 } scan_prefetch_ctx_t;
@@ -478,6 +504,12 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 	    sizeof (scan_prefetch_issue_ctx_t),
 	    offsetof(scan_prefetch_issue_ctx_t, spic_avl_node));
 
+	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LAST_SCRUBBED_TXG, sizeof (uint64_t), 1,
+	    &scn->scn_last_scrubbed_txg);
+	if (err != 0 && err != ENOENT)
+		return (err);
+
 	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
 	    "scrub_func", sizeof (uint64_t), 1, &f);
 	if (err == 0) {
@@ -737,19 +769,20 @@ dsl_scan_setup_check(void *arg, dmu_tx_t *tx)
 	return (0);
 }
 
-void
-dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
+static void
+dsl_scan_setup_impl(pool_scan_func_t func, boolean_t from_last_txg,
+    dmu_tx_t *tx)
 {
 	dsl_scan_t *scn = dmu_tx_pool(tx)->dp_scan;
-	pool_scan_func_t *funcp = arg;
 	dmu_object_type_t ot = 0;
 	dsl_pool_t *dp = scn->scn_dp;
 	spa_t *spa = dp->dp_spa;
 
 	ASSERT(!dsl_scan_is_running(scn));
-	ASSERT(*funcp > POOL_SCAN_NONE && *funcp < POOL_SCAN_FUNCS);
+	ASSERT(func > POOL_SCAN_NONE && func < POOL_SCAN_FUNCS);
+	ASSERT(!from_last_txg || func == POOL_SCAN_SCRUB);
 	memset(&scn->scn_phys, 0, sizeof (scn->scn_phys));
-	scn->scn_phys.scn_func = *funcp;
+	scn->scn_phys.scn_func = func;
 	scn->scn_phys.scn_state = DSS_SCANNING;
 	scn->scn_phys.scn_min_txg = 0;
 	scn->scn_phys.scn_max_txg = tx->tx_txg;
@@ -779,6 +812,17 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 			    ESC_ZFS_RESILVER_START);
 			nvlist_free(aux);
 		} else {
+			/*
+			 * Everything born up to the max txg of the last
+			 * completed scrub has already been verified, so
+			 * only visit blocks born after it.
+			 */
+			if (from_last_txg) {
+				scn->scn_phys.scn_min_txg =
+				    scn->scn_last_scrubbed_txg;
+				scn->scn_phys.scn_flags |=
+				    DSF_SCRUB_FROM_LAST_TXG;
+			}
 			spa_event_notify(spa, NULL, NULL, ESC_ZFS_SCRUB_START);
 		}
 
@@ -836,16 +880,33 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 
 	spa_history_log_internal(spa, "scan setup", tx,
 	    "func=%u mintxg=%llu maxtxg=%llu",
-	    *funcp, (u_longlong_t)scn->scn_phys.scn_min_txg,
+	    func, (u_longlong_t)scn->scn_phys.scn_min_txg,
 	    (u_longlong_t)scn->scn_phys.scn_max_txg);
 }
 
+void
+dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
+{
+	pool_scan_func_t *funcp = arg;
+
+	dsl_scan_setup_impl(*funcp, B_FALSE, tx);
+}
+
+static void
+dsl_scan_setup_from_last_txg_sync(void *arg, dmu_tx_t *tx)
+{
+	pool_scan_func_t *funcp = arg;
+
+	dsl_scan_setup_impl(*funcp, B_TRUE, tx);
+}
+
 /*
  * Called by the ZFS_IOC_POOL_SCAN ioctl to start a scrub or resilver.
- * Can also be called to resume a paused scrub.
+ * Can also be called to resume a paused scrub. If from_last_txg is set,
+ * a new scrub only visits blocks born after the last completed scrub.
  */
 int
-dsl_scan(dsl_pool_t *dp, pool_scan_func_t func)
+dsl_scan(dsl_pool_t *dp, pool_scan_func_t func, boolean_t from_last_txg)
 {
 	spa_t *spa = dp->dp_spa;
 	dsl_scan_t *scn = dp->dp_scan;
@@ -880,7 +941,9 @@ dsl_scan(dsl_pool_t *dp, pool_scan_func_t func)
 		return (SET_ERROR(err));
 	}
 
+	ASSERT(!from_last_txg || func == POOL_SCAN_SCRUB);
 	return (dsl_sync_task(spa_name(spa), dsl_scan_setup_check,
+	    from_last_txg ? dsl_scan_setup_from_last_txg_sync :
 	    dsl_scan_setup_sync, &func, 0, ZFS_SPACE_CHECK_EXTRA_RESERVED));
 }
 
@@ -953,8 +1016,30 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		    "errors=%llu", (u_longlong_t)spa_get_errlog_size(spa));
 
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
+		boolean_t from_last_txg =
+		    !!(scn->scn_phys.scn_flags & DSF_SCRUB_FROM_LAST_TXG);
+
 		spa->spa_scrub_active = B_FALSE;
 
+		/*
+		 * A completed scrub of all blocks born after the last
+		 * completed one moves the bound for the next such scrub
+		 * up to the txg before its own max txg. Blocks born in
+		 * scn_max_txg itself may have been written after the scan
+		 * was set up in that txg and not been visited. A healing
+		 * scrub only visited the blocks in the DTLs, so it does
+		 * not count.
+		 */
+		if (complete && scn->scn_phys.scn_func == POOL_SCAN_SCRUB &&
+		    (scn->scn_phys.scn_min_txg == 0 || from_last_txg)) {
+			scn->scn_last_scrubbed_txg =
+			    scn->scn_phys.scn_max_txg - 1;
+			VERIFY0(zap_update(dp->dp_meta_objset,
+			    DMU_POOL_DIRECTORY_OBJECT,
+			    DMU_POOL_LAST_SCRUBBED_TXG, sizeof (uint64_t), 1,
+			    &scn->scn_last_scrubbed_txg, tx));
+		}
+
 		/*
 		 * If the scrub/resilver completed, update all DTLs to
 		 * reflect this.  Whether it succeeded or not, vacate
@@ -963,9 +1048,10 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		 * As the scrub does not currently support traversing
 		 * data that have been freed but are part of a checkpoint,
 		 * we don't mark the scrub as done in the DTLs as faults
-		 * may still exist in those vdevs.
+		 * may still exist in those vdevs. Neither does a scrub
+		 * from the last scrubbed txg, which skipped older blocks.
 		 */
-		if (complete &&
+		if (complete && !from_last_txg &&
 		    !spa_feature_is_active(spa, SPA_FEATURE_POOL_CHECKPOINT)) {
 			vdev_dtl_reassess(spa->spa_root_vdev, tx->tx_txg,
 			    scn->scn_phys.scn_max_txg, B_TRUE, B_FALSE);
@@ -981,6 +1067,10 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 				spa_event_notify(spa, NULL, NULL,
 				    ESC_ZFS_SCRUB_FINISH);
 			}
+		} else if (complete && from_last_txg) {
+			vdev_dtl_reassess(spa->spa_root_vdev, tx->tx_txg,
+			    0, B_TRUE, B_FALSE);
+			spa_event_notify(spa, NULL, NULL, ESC_ZFS_SCRUB_FINISH);
 		} else {
 			vdev_dtl_reassess(spa->spa_root_vdev, tx->tx_txg,
 			    0, B_TRUE, B_FALSE);
@@ -1507,6 +1597,10 @@ dsl_scan_zil(dsl_pool_t *dp, zil_header_t *zh)
 /*
  * We compare scan_prefetch_issue_ctx_t's based on their bookmarks. The idea
  * here is to sort the AVL tree by the order each block will be needed.
+ * Prefetches for datasets queued ahead of the traversal always sort after
+ * those of the objset being traversed, since zbookmark_compare() ignores
+ * the objset. Blocks of different queued objsets at the same position are
+ * ordered by objset rather than being dropped as duplicates.
  */
 static int
 scan_prefetch_queue_compare(const void *a, const void *b)
@@ -1514,10 +1608,20 @@ scan_prefetch_queue_compare(const void *a, const void *b)
 	const scan_prefetch_issue_ctx_t *spic_a = a, *spic_b = b;
 	const scan_prefetch_ctx_t *spc_a = spic_a->spic_spc;
 	const scan_prefetch_ctx_t *spc_b = spic_b->spic_spc;
+	int cmp;
 
-	return (zbookmark_compare(spc_a->spc_datablkszsec,
+	cmp = TREE_CMP(spc_a->spc_ahead, spc_b->spc_ahead);
+	if (cmp != 0)
+		return (cmp);
+
+	cmp = zbookmark_compare(spc_a->spc_datablkszsec,
 	    spc_a->spc_indblkshift, spc_b->spc_datablkszsec,
-	    spc_b->spc_indblkshift, &spic_a->spic_zb, &spic_b->spic_zb));
+	    spc_b->spc_indblkshift, &spic_a->spic_zb, &spic_b->spic_zb);
+	if (cmp != 0)
+		return (cmp);
+
+	return (TREE_CMP(spic_a->spic_zb.zb_objset,
+	    spic_b->spic_zb.zb_objset));
 }
 
 static void
@@ -1538,6 +1642,8 @@ scan_prefetch_ctx_create(dsl_scan_t *scn, dnode_phys_t *dnp, const void *tag)
 	zfs_refcount_create(&spc->spc_refcnt);
 	zfs_refcount_add(&spc->spc_refcnt, tag);
 	spc->spc_scn = scn;
+	spc->spc_ahead = B_FALSE;
+	spc->spc_min_txg = scn->scn_phys.scn_cur_min_txg;
 	if (dnp != NULL) {
 		spc->spc_datablkszsec = dnp->dn_datablkszsec;
 		spc->spc_indblkshift = dnp->dn_indblkshift;
@@ -1581,6 +1687,12 @@ dsl_scan_check_prefetch_resume(scan_prefetch_ctx_t *spc,
 	dnode_phys_t tmp_dnp;
 	dnode_phys_t *dnp = (spc->spc_root) ? NULL : &tmp_dnp;
 
+	/*
+	 * Objsets queued ahead of the traversal have not been visited yet,
+	 * so nothing in them can be behind the resume point.
+	 */
+	if (spc->spc_ahead)
+		return (B_FALSE);
 	if (zb->zb_objset != last_zb->zb_objset)
 		return (B_TRUE);
 	if ((int64_t)zb->zb_object < 0)
@@ -1606,7 +1718,7 @@ dsl_scan_prefetch(scan_prefetch_ctx_t *spc, blkptr_t *bp, zbookmark_phys_t *zb)
 	if (zfs_no_scrub_prefetch || BP_IS_REDACTED(bp))
 		return;
 
-	if (BP_IS_HOLE(bp) || bp->blk_birth <= scn->scn_phys.scn_cur_min_txg ||
+	if (BP_IS_HOLE(bp) || bp->blk_birth <= spc->spc_min_txg ||
 	    (BP_GET_LEVEL(bp) == 0 && BP_GET_TYPE(bp) != DMU_OT_DNODE &&
 	    BP_GET_TYPE(bp) != DMU_OT_OBJSET))
 		return;
@@ -1640,7 +1752,7 @@ dsl_scan_prefetch(scan_prefetch_ctx_t *spc, blkptr_t *bp, zbookmark_phys_t *zb)
 }
 
 static void
-dsl_scan_prefetch_dnode(dsl_scan_t *scn, dnode_phys_t *dnp,
+dsl_scan_prefetch_dnode(scan_prefetch_ctx_t *pspc, dnode_phys_t *dnp,
     uint64_t objset, uint64_t object)
 {
 	int i;
@@ -1652,7 +1764,9 @@ dsl_scan_prefetch_dnode(dsl_scan_t *scn, dnode_phys_t *dnp,
 
 	SET_BOOKMARK(&zb, objset, object, 0, 0);
 
-	spc = scan_prefetch_ctx_create(scn, dnp, FTAG);
+	spc = scan_prefetch_ctx_create(pspc->spc_scn, dnp, FTAG);
+	spc->spc_ahead = pspc->spc_ahead;
+	spc->spc_min_txg = pspc->spc_min_txg;
 
 	for (i = 0; i < dnp->dn_nblkptr; i++) {
 		zb.zb_level = BP_GET_LEVEL(&dnp->dn_blkptr[i]);
@@ -1708,20 +1822,20 @@ dsl_scan_prefetch_cb(zio_t *zio, const zbookmark_phys_t *zb, const blkptr_t *bp,
 		for (i = 0, cdnp = buf->b_data; i < epb;
 		    i += cdnp->dn_extra_slots + 1,
 		    cdnp += cdnp->dn_extra_slots + 1) {
-			dsl_scan_prefetch_dnode(scn, cdnp,
+			dsl_scan_prefetch_dnode(spc, cdnp,
 			    zb->zb_objset, zb->zb_blkid * epb + i);
 		}
 	} else if (BP_GET_TYPE(bp) == DMU_OT_OBJSET) {
 		objset_phys_t *osp = buf->b_data;
 
-		dsl_scan_prefetch_dnode(scn, &osp->os_meta_dnode,
+		dsl_scan_prefetch_dnode(spc, &osp->os_meta_dnode,
 		    zb->zb_objset, DMU_META_DNODE_OBJECT);
 
 		if (OBJSET_BUF_HAS_USERUSED(buf)) {
-			dsl_scan_prefetch_dnode(scn,
+			dsl_scan_prefetch_dnode(spc,
 			    &osp->os_groupused_dnode, zb->zb_objset,
 			    DMU_GROUPUSED_OBJECT);
-			dsl_scan_prefetch_dnode(scn,
+			dsl_scan_prefetch_dnode(spc,
 			    &osp->os_userused_dnode, zb->zb_objset,
 			    DMU_USERUSED_OBJECT);
 		}
@@ -2671,6 +2785,10 @@ dsl_scan_ddt_entry(dsl_scan_t *scn, enum zio_checksum checksum,
  * reference class transitions to a higher level (i.e DDT_CLASS_UNIQUE to
  * DDT_CLASS_DUPLICATE); if it transitions from refcnt == 1 to refcnt > 1
  * while a scrub is in progress, it scrubs the block right then.
+ *
+ * The DDT log is drained into the DDT objects over several txgs before they
+ * are walked, and is not used until the walk is done (see ddt_log_enabled()),
+ * so that ddt_sync_entry() sees every transition as it happens.
  */
 static void
 dsl_scan_ddt(dsl_scan_t *scn, dmu_tx_t *tx)
@@ -2680,6 +2798,13 @@ dsl_scan_ddt(dsl_scan_t *scn, dmu_tx_t *tx)
 	int error;
 	uint64_t n = 0;
 
+	if (!ddt_log_drained(scn->scn_dp->dp_spa)) {
+		zfs_dbgmsg("waiting for the ddt log to drain on %s",
+		    scn->scn_dp->dp_spa->spa_name);
+		scn->scn_suspending = B_TRUE;
+		return;
+	}
+
 	while ((error = ddt_walk(scn->scn_dp->dp_spa, ddb, &dde)) == 0) {
 		ddt_t *ddt;
 
@@ -2693,7 +2818,7 @@ dsl_scan_ddt(dsl_scan_t *scn, dmu_tx_t *tx)
 
 		/* There should be no pending changes to the dedup table */
 		ddt = scn->scn_dp->dp_spa->spa_ddt[ddb->ddb_checksum];
-		ASSERT(avl_first(&ddt->ddt_tree) == NULL);
+		ASSERT0(ddt_numnodes(ddt));
 
 		dsl_scan_ddt_entry(scn, ddb->ddb_checksum, &dde, tx);
 		n++;
@@ -2720,6 +2845,59 @@ dsl_scan_ds_maxtxg(dsl_dataset_t *ds)
 	return (smt);
 }
 
+static uint64_t
+dsl_scan_ds_mintxg(dsl_scan_t *scn, dsl_dataset_t *ds, uint64_t txg)
+{
+	if (txg != 0)
+		return (MAX(scn->scn_phys.scn_min_txg, txg));
+	return (MAX(scn->scn_phys.scn_min_txg,
+	    dsl_dataset_phys(ds)->ds_prev_snap_txg));
+}
+
+/*
+ * The traversal visits one dataset at a time so that a single bookmark
+ * describes where to resume after suspending. To keep the disks busy on
+ * pools with many small datasets, queue prefetches for the root blocks of
+ * the next few datasets waiting in the scan queue. Their metadata is then
+ * read in parallel with the traversal of the current dataset, behind it
+ * in the prefetch priority order.
+ */
+static void
+dsl_scan_prefetch_queued_datasets(dsl_scan_t *scn)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	scan_ds_t *sds;
+	uint_t n;
+
+	if (zfs_no_scrub_prefetch)
+		return;
+
+	for (sds = avl_first(&scn->scn_queue), n = 0;
+	    sds != NULL && n < zfs_scan_prefetch_datasets;
+	    sds = AVL_NEXT(&scn->scn_queue, sds), n++) {
+		dsl_dataset_t *ds;
+		scan_prefetch_ctx_t *spc;
+		zbookmark_phys_t zb;
+
+		if (sds->sds_prefetched)
+			continue;
+		sds->sds_prefetched = B_TRUE;
+
+		if (dsl_dataset_hold_obj(dp, sds->sds_dsobj, FTAG, &ds) != 0)
+			continue;
+
+		SET_BOOKMARK(&zb, ds->ds_object, ZB_ROOT_OBJECT,
+		    ZB_ROOT_LEVEL, ZB_ROOT_BLKID);
+		spc = scan_prefetch_ctx_create(scn, NULL, FTAG);
+		spc->spc_ahead = B_TRUE;
+		spc->spc_min_txg = dsl_scan_ds_mintxg(scn, ds, sds->sds_txg);
+		dsl_scan_prefetch(spc, &dsl_dataset_phys(ds)->ds_bp, &zb);
+		scan_prefetch_ctx_rele(spc, FTAG);
+
+		dsl_dataset_rele(ds, FTAG);
+	}
+}
+
 static void
 dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 {
@@ -2763,6 +2941,7 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 		 * be -1, so we will skip this and find a new objset
 		 * below.
 		 */
+		dsl_scan_prefetch_queued_datasets(scn);
 		dsl_scan_visitds(scn, dsobj, tx);
 		if (scn->scn_suspending)
 			return;
@@ -2789,17 +2968,12 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 
 		/* set up min / max txg */
 		VERIFY3U(0, ==, dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds));
-		if (txg != 0) {
-			scn->scn_phys.scn_cur_min_txg =
-			    MAX(scn->scn_phys.scn_min_txg, txg);
-		} else {
-			scn->scn_phys.scn_cur_min_txg =
-			    MAX(scn->scn_phys.scn_min_txg,
-			    dsl_dataset_phys(ds)->ds_prev_snap_txg);
-		}
+		scn->scn_phys.scn_cur_min_txg =
+		    dsl_scan_ds_mintxg(scn, ds, txg);
 		scn->scn_phys.scn_cur_max_txg = dsl_scan_ds_maxtxg(ds);
 		dsl_dataset_rele(ds, FTAG);
 
+		dsl_scan_prefetch_queued_datasets(scn);
 		dsl_scan_visitds(scn, dsobj, tx);
 		if (scn->scn_suspending)
 			return;
@@ -2866,6 +3040,103 @@ scan_io_queue_check_suspend(dsl_scan_t *scn)
 	    spa_shutting_down(scn->scn_dp->dp_spa));
 }
 
+/*
+ * Maximum number of in-flight scan bytes for this queue's vdev, scaled
+ * by the current QoS throttle.
+ */
+static uint64_t
+scan_io_queue_max_inflight(dsl_scan_io_queue_t *queue)
+{
+	uint64_t limit = zfs_scan_vdev_limit *
+	    (vdev_get_ndisks(queue->q_vd) - vdev_get_nparity(queue->q_vd));
+
+	return (MAX(1, limit * queue->q_qos_pct / 100));
+}
+
+/*
+ * Return the latency at the given percentile of a latency histogram, or
+ * zero if it is empty.  The latency is interpolated linearly within the
+ * power-of-two bucket the percentile falls into.
+ */
+static uint64_t
+scan_lat_histo_percentile(const uint64_t *histo, uint_t pct)
+{
+	uint64_t count = 0, cum = 0;
+
+	for (int i = 0; i < VDEV_L_HISTO_BUCKETS; i++)
+		count += histo[i];
+	if (count == 0)
+		return (0);
+
+	uint64_t target = howmany(count * pct, 100);
+	for (int i = 0; i < VDEV_L_HISTO_BUCKETS; i++) {
+		if (histo[i] != 0 && cum + histo[i] >= target) {
+			uint64_t lo = 1ULL << i;
+			return (lo + lo * (target - cum) / histo[i]);
+		}
+		cum += histo[i];
+	}
+	return (1ULL << (VDEV_L_HISTO_BUCKETS - 1));
+}
+
+/*
+ * Adjust the in-flight limit of the queue to the latency of foreground
+ * I/O, see zfs_scan_qos_target_us.
+ */
+static void
+scan_io_queue_qos_update(dsl_scan_io_queue_t *queue)
+{
+	kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+	uint64_t pct = queue->q_qos_pct;
+	hrtime_t now = gethrtime();
+
+	if (zfs_scan_qos_target_us == 0) {
+		pct = 100;
+	} else if (now - queue->q_qos_last >=
+	    MSEC2NSEC(zfs_scan_qos_interval_ms)) {
+		uint64_t histo[VDEV_L_HISTO_BUCKETS] = { 0 };
+
+		vdev_queue_sync_lat_collect(queue->q_vd, histo);
+		uint64_t lat = scan_lat_histo_percentile(histo,
+		    SCAN_QOS_PERCENTILE);
+		if (lat > (uint64_t)USEC2NSEC(zfs_scan_qos_target_us))
+			pct = MAX(pct / 2, MAX(zfs_scan_qos_min_pct, 1));
+		else
+			pct = MIN(pct + zfs_scan_qos_step_pct, 100);
+		queue->q_qos_last = now;
+	}
+
+	if (pct == queue->q_qos_pct)
+		return;
+
+	mutex_enter(q_lock);
+	queue->q_qos_pct = pct;
+	queue->q_maxinflight_bytes = scan_io_queue_max_inflight(queue);
+	cv_broadcast(&queue->q_zio_cv);
+	mutex_exit(q_lock);
+}
+
+/*
+ * Return the lowest in-flight limit, in percent, that the QoS throttle
+ * currently leaves to the scan I/O queues of the pool.
+ */
+uint64_t
+dsl_scan_qos_pct(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t pct = 100;
+
+	for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *vd = rvd->vdev_child[c];
+
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		if (vd->vdev_scan_io_queue != NULL)
+			pct = MIN(pct, vd->vdev_scan_io_queue->q_qos_pct);
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+	return (pct);
+}
+
 /*
  * Given a list of scan_io_t's in io_list, this issues the I/Os out to
  * disk. This consumes the io_list and frees the scan_io_t's. This is
@@ -2889,6 +3160,7 @@ scan_io_queue_issue(dsl_scan_io_queue_t *queue, list_t *io_list)
 			break;
 		}
 
+		scan_io_queue_qos_update(queue);
 		sio2bp(sio, &bp);
 		scan_exec_io(scn->scn_dp, &bp, sio->sio_flags,
 		    &sio->sio_zb, queue);
@@ -3065,8 +3337,7 @@ scan_io_queues_run_one(void *arg)
 	queue->q_zio = zio;
 
 	/* Calculate maximum in-flight bytes for this vdev. */
-	queue->q_maxinflight_bytes = MAX(1, zfs_scan_vdev_limit *
-	    (vdev_get_ndisks(queue->q_vd) - vdev_get_nparity(queue->q_vd)));
+	queue->q_maxinflight_bytes = scan_io_queue_max_inflight(queue);
 
 	/* reset per-queue scan statistics for this txg */
 	queue->q_total_seg_size_this_txg = 0;
@@ -3935,6 +4206,27 @@ scan_io_queue_insert(dsl_scan_io_queue_t *queue, const blkptr_t *bp, int dva_i,
 	scan_io_queue_insert_impl(queue, sio);
 }
 
+/*
+ * A damaged indirect block or metadata object can leave a whole dataset
+ * unreadable, while a damaged data block only affects one record. Sorted
+ * resilvers accumulate blocks in the per-vdev queues and issue them in
+ * offset order, so metadata is repaired no sooner than the user data
+ * around it. When resilvering, issue the I/O for metadata as soon as the
+ * traversal finds it instead. This is best-effort: once the queues reach
+ * the memory limit, scn_clearing issues queued level-0 data while the
+ * traversal is still running, and metadata found after that is repaired
+ * after the data. It shortens the window in which losing another disk
+ * loses whole datasets, at the cost of some random I/O for what is usually
+ * a small fraction of the pool's blocks.
+ */
+static boolean_t
+dsl_scan_resilver_metadata_first(dsl_scan_t *scn, const blkptr_t *bp)
+{
+	return (zfs_resilver_metadata_first &&
+	    scn->scn_phys.scn_func == POOL_SCAN_RESILVER &&
+	    (BP_GET_LEVEL(bp) > 0 || DMU_OT_IS_METADATA(BP_GET_TYPE(bp))));
+}
+
 /*
  * Given a set of I/O parameters as discovered by the metadata traversal
  * process, attempts to place the I/O into the sorted queues (if allowed),
@@ -3950,9 +4242,11 @@ dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
 
 	/*
 	 * Gang blocks are hard to issue sequentially, so we just issue them
-	 * here immediately instead of queuing them.
+	 * here immediately instead of queuing them. The same goes for metadata
+	 * when resilvering (see dsl_scan_resilver_metadata_first()).
 	 */
-	if (!dp->dp_scan->scn_is_sorted || BP_IS_GANG(bp)) {
+	if (!dp->dp_scan->scn_is_sorted || BP_IS_GANG(bp) ||
+	    dsl_scan_resilver_metadata_first(dp->dp_scan, bp)) {
 		scan_exec_io(dp, bp, zio_flags, zb, NULL);
 		return;
 	}
@@ -4156,13 +4450,17 @@ ext_size_compare(const void *x, const void *y)
 	return (TREE_CMP(*a, *b));
 }
 
+ZFS_BTREE_FIND_IN_BUF_FUNC(ext_size_find_in_buf, uint64_t,
+    ext_size_compare)
+
 static void
 ext_size_create(range_tree_t *rt, void *arg)
 {
 	(void) rt;
 	zfs_btree_t *size_tree = arg;
 
-	zfs_btree_create(size_tree, ext_size_compare, sizeof (uint64_t));
+	zfs_btree_create(size_tree, ext_size_compare, ext_size_find_in_buf,
+	    sizeof (uint64_t));
 }
 
 static void
@@ -4245,6 +4543,7 @@ scan_io_queue_create(vdev_t *vd)
 	q->q_vd = vd;
 	q->q_sio_memused = 0;
 	q->q_last_ext_addr = -1;
+	q->q_qos_pct = 100;
 	cv_init(&q->q_zio_cv, NULL, CV_DEFAULT, NULL);
 	q->q_exts_by_addr = range_tree_create_gap(&ext_size_ops, RANGE_SEG_GAP,
 	    &q->q_exts_by_size, 0, vd->vdev_ashift, zfs_scan_max_ext_gap);
@@ -4450,6 +4749,18 @@ dsl_scan_assess_vdev(dsl_pool_t *dp, vdev_t *vd)
 ZFS_MODULE_PARAM(zfs, zfs_, scan_vdev_limit, U64, ZMOD_RW,
 	"Max bytes in flight per leaf vdev for scrubs and resilvers");
 
+ZFS_MODULE_PARAM(zfs, zfs_, scan_qos_target_us, UINT, ZMOD_RW,
+	"Target 99th percentile latency of sync I/O while scanning (0=off)");
+
+ZFS_MODULE_PARAM(zfs, zfs_, scan_qos_interval_ms, UINT, ZMOD_RW,
+	"Interval at which scan I/O is adjusted to sync I/O latency");
+
+ZFS_MODULE_PARAM(zfs, zfs_, scan_qos_min_pct, UINT, ZMOD_RW,
+	"Lowest percentage of zfs_scan_vdev_limit scan I/O is throttled to");
+
+ZFS_MODULE_PARAM(zfs, zfs_, scan_qos_step_pct, UINT, ZMOD_RW,
+	"Percentage by which throttled scan I/O grows back per interval");
+
 ZFS_MODULE_PARAM(zfs, zfs_, scrub_min_time_ms, UINT, ZMOD_RW,
 	"Min millisecs to scrub per txg");
 
@@ -4462,6 +4773,9 @@ ZFS_MODULE_PARAM(zfs, zfs_, free_min_time_ms, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, resilver_min_time_ms, UINT, ZMOD_RW,
 	"Min millisecs to resilver per txg");
 
+ZFS_MODULE_PARAM(zfs, zfs_, resilver_metadata_first, INT, ZMOD_RW,
+	"Resilver metadata as soon as it is found");
+
 ZFS_MODULE_PARAM(zfs, zfs_, scan_suspend_progress, INT, ZMOD_RW,
 	"Set to prevent scans from progressing");
 
@@ -4471,6 +4785,9 @@ ZFS_MODULE_PARAM(zfs, zfs_, no_scrub_io, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, no_scrub_prefetch, INT, ZMOD_RW,
 	"Set to disable scrub prefetching");
 
+ZFS_MODULE_PARAM(zfs, zfs_, scan_prefetch_datasets, UINT, ZMOD_RW,
+	"Max number of queued datasets to prefetch ahead of the scan");
+
 ZFS_MODULE_PARAM(zfs, zfs_, async_block_max_blocks, U64, ZMOD_RW,
 	"Max number of blocks freed in one txg");
 
@@ -202,6 +202,20 @@ static const uint32_t metaslab_min_search_count = 100;
  */
 static int metaslab_df_use_largest_segment = B_FALSE;
 
+/*
+ * On RAIDZ every block carries its own parity and skip sectors, so a txg
+ * full of small blocks turns into many small writes on each child.  When
+ * those blocks are allocated back to back, each child sees a contiguous
+ * run of sectors which the vdev queue aggregates into a few large writes.
+ * Allocations up to this size on RAIDZ top-level vdevs therefore share one
+ * cursor, instead of the per-alignment cursors, so that small blocks of
+ * different sizes from the same txg are packed together.  This changes
+ * where small blocks land on every RAIDZ pool, and its effect on IOPS and
+ * fragmentation has not been measured yet, so it is off (zero) by default;
+ * 32K is a reasonable value to try.
+ */
+static uint_t metaslab_df_raidz_pack_max = 0;
+
 /*
  * Percentage of all cpus that can be used by the metaslab taskq.
  */
@@ -243,6 +257,21 @@ static int metaslab_lba_weighting_enabled = B_TRUE;
  */
 static int metaslab_bias_enabled = B_TRUE;
 
+/*
+ * Maximum percentage by which a metaslab group's share of each pass of the
+ * rotor is increased or decreased based on how its write latency compares
+ * to the rest of its class.  This keeps a slow or failing vdev from setting
+ * the txg sync time when vdevs of differing speed are mixed.  Set to 0 to
+ * disable latency based biasing.
+ */
+static uint_t metaslab_latency_bias_pct = 50;
+
+/*
+ * Weight of each new sample in the write latency moving averages, as a
+ * power of two (each sample contributes 1/8th).
+ */
+static const int metaslab_latency_ewma_shift = 3;
+
 /*
  * Enable/disable remapping of indirect DVAs to their concrete vdevs.
  */
@@ -278,7 +307,9 @@ static const uint64_t metaslab_trace_max_entries = 5000;
 
 /*
  * Maximum number of metaslabs per group that can be disabled
- * simultaneously.
+ * simultaneously.  A sequential rebuild with several workers may disable
+ * one more metaslab for each worker past the first; see
+ * metaslab_group_disabled_max().
  */
 static const int max_disabled_ms = 3;
 
@@ -1368,6 +1399,12 @@ metaslab_rangesize64_compare(const void *x1, const void *x2)
 
 	return (TREE_CMP(r1->rs_start, r2->rs_start));
 }
+ZFS_BTREE_FIND_IN_BUF_FUNC(metaslab_rt_find_rangesize32_in_buf,
+    range_seg32_t, metaslab_rangesize32_compare)
+
+ZFS_BTREE_FIND_IN_BUF_FUNC(metaslab_rt_find_rangesize64_in_buf,
+    range_seg64_t, metaslab_rangesize64_compare)
+
 typedef struct metaslab_rt_arg {
 	zfs_btree_t *mra_bt;
 	uint32_t mra_floor_shift;
@@ -1415,19 +1452,22 @@ metaslab_rt_create(range_tree_t *rt, void *arg)
 
 	size_t size;
 	int (*compare) (const void *, const void *);
+	bt_find_in_buf_f bt_find;
 	switch (rt->rt_type) {
 	case RANGE_SEG32:
 		size = sizeof (range_seg32_t);
 		compare = metaslab_rangesize32_compare;
+		bt_find = metaslab_rt_find_rangesize32_in_buf;
 		break;
 	case RANGE_SEG64:
 		size = sizeof (range_seg64_t);
 		compare = metaslab_rangesize64_compare;
+		bt_find = metaslab_rt_find_rangesize64_in_buf;
 		break;
 	default:
 		panic("Invalid range seg type %d", rt->rt_type);
 	}
-	zfs_btree_create(size_tree, compare, size);
+	zfs_btree_create(size_tree, compare, bt_find, size);
 	mrap->mra_floor_shift = metaslab_by_size_min_shift;
 }
 
@@ -1677,6 +1717,15 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
+	/*
+	 * Pack small RAIDZ allocations together, see
+	 * metaslab_df_raidz_pack_max.  ms_lbas[0] is otherwise unused since
+	 * allocation sizes are always a multiple of the sector size.
+	 */
+	if (size <= metaslab_df_raidz_pack_max &&
+	    msp->ms_group->mg_vd->vdev_ops == &vdev_raidz_ops)
+		cursor = &msp->ms_lbas[0];
+
 	/*
 	 * If we're running low on space, find a segment based on size,
 	 * rather than iterating based on offset.
@@ -2676,6 +2725,19 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object,
 
 		ASSERT(ms->ms_sm != NULL);
 		ms->ms_allocated_space = space_map_allocated(ms->ms_sm);
+
+		/*
+		 * Seed the cached maximum free segment size from the space
+		 * map's summary so that allocations can skip metaslabs that
+		 * are too fragmented for them without loading them first.
+		 * The summary is treated like the size remembered when a
+		 * metaslab is unloaded [see metaslab_should_allocate()].
+		 */
+		uint64_t max_free[SPACE_MAP_SUMMARY_SIZE];
+		if (space_map_summary_get(ms->ms_sm, max_free)) {
+			ms->ms_max_size = max_free[0];
+			ms->ms_unload_time = gethrtime();
+		}
 	}
 
 	uint64_t shift, start;
@@ -3489,7 +3551,7 @@ metaslab_preload(void *arg)
 	spl_fstrans_unmark(cookie);
 }
 
-static void
+void
 metaslab_group_preload(metaslab_group_t *mg)
 {
 	spa_t *spa = mg->mg_vd->vdev_spa;
@@ -3819,6 +3881,39 @@ metaslab_flush_update(metaslab_t *msp, dmu_tx_t *tx)
 	metaslab_unflushed_bump(msp, tx, B_FALSE);
 }
 
+/*
+ * Update the summary of the largest free segments kept in the metaslab's
+ * space map. It is only recomputed while the metaslab is loaded; otherwise
+ * the metaslab can only have seen frees since it was last recorded, so the
+ * recorded sizes are still lower bounds and a summary that was valid
+ * before the histogram changed is revalidated as is.
+ */
+static void
+metaslab_sync_summary(metaslab_t *msp, boolean_t valid, dmu_tx_t *tx)
+{
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (!msp->ms_loaded) {
+		if (valid)
+			space_map_summary_set(msp->ms_sm, NULL, tx);
+		return;
+	}
+
+	zfs_btree_t *t = &msp->ms_allocatable_by_size;
+	if (zfs_btree_numnodes(t) == 0)
+		metaslab_size_tree_full_load(msp->ms_allocatable);
+
+	uint64_t max_free[SPACE_MAP_SUMMARY_SIZE] = {0};
+	zfs_btree_index_t where;
+	range_seg_t *rs = zfs_btree_last(t, &where);
+	for (int i = 0; i < SPACE_MAP_SUMMARY_SIZE && rs != NULL; i++) {
+		max_free[i] = rs_get_end(rs, msp->ms_allocatable) -
+		    rs_get_start(rs, msp->ms_allocatable);
+		rs = zfs_btree_prev(t, &where, &where);
+	}
+	space_map_summary_set(msp->ms_sm, max_free, tx);
+}
+
 boolean_t
 metaslab_flush(metaslab_t *msp, dmu_tx_t *tx)
 {
@@ -3884,6 +3979,7 @@ metaslab_flush(metaslab_t *msp, dmu_tx_t *tx)
 			    msp->ms_defer[t], tx);
 		}
 		metaslab_aux_histograms_update(msp);
+		metaslab_sync_summary(msp, B_FALSE, tx);
 
 		metaslab_group_histogram_add(mg, msp);
 		metaslab_group_histogram_verify(mg);
@@ -3905,6 +4001,12 @@ metaslab_flush(metaslab_t *msp, dmu_tx_t *tx)
 	msp->ms_flushing = B_TRUE;
 	uint64_t sm_len_before = space_map_length(msp->ms_sm);
 
+	/*
+	 * Flushing only moves changes from the log into the space map,
+	 * so a valid summary stays valid; see metaslab_sync_summary().
+	 */
+	boolean_t summary_valid = space_map_summary_get(msp->ms_sm, NULL);
+
 	mutex_exit(&msp->ms_lock);
 	space_map_write(msp->ms_sm, msp->ms_unflushed_allocs, SM_ALLOC,
 	    SM_NO_VDEVID, tx);
@@ -3932,6 +4034,8 @@ metaslab_flush(metaslab_t *msp, dmu_tx_t *tx)
 	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
 	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
 
+	metaslab_sync_summary(msp, summary_valid, tx);
+
 	metaslab_verify_space(msp, dmu_tx_get_txg(tx));
 	metaslab_verify_weight_and_frag(msp);
 
@@ -4057,6 +4161,12 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	mutex_enter(&msp->ms_sync_lock);
 	mutex_enter(&msp->ms_lock);
 
+	/*
+	 * Check the summary before the histogram changes below; see
+	 * metaslab_sync_summary().
+	 */
+	boolean_t summary_valid = space_map_summary_get(msp->ms_sm, NULL);
+
 	/*
 	 * Note: metaslab_condense() clears the space map's histogram.
 	 * Therefore we must verify and remove this histogram before
@@ -4181,6 +4291,7 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	 */
 	space_map_histogram_add(msp->ms_sm, msp->ms_freeing, tx);
 	metaslab_aux_histograms_update(msp);
+	metaslab_sync_summary(msp, summary_valid, tx);
 
 	metaslab_group_histogram_add(mg, msp);
 	metaslab_group_histogram_verify(mg);
@@ -4576,6 +4687,64 @@ metaslab_group_alloc_verify(spa_t *spa, const blkptr_t *bp, const void *tag,
 #endif
 }
 
+static void
+metaslab_latency_ewma(uint64_t *avg, uint64_t sample)
+{
+	uint64_t old, new;
+
+	do {
+		old = *avg;
+		if (old == 0) {
+			new = sample;
+		} else {
+			new = old - (old >> metaslab_latency_ewma_shift) +
+			    (sample >> metaslab_latency_ewma_shift);
+		}
+	} while (atomic_cas_64(avg, old, new) != old);
+}
+
+/*
+ * Fold the latency of a completed allocating write into the moving
+ * averages of the metaslab group it was written to and of its class.
+ */
+void
+metaslab_group_latency_update(metaslab_group_t *mg, hrtime_t delta)
+{
+	if (mg == NULL || delta <= 0)
+		return;
+
+	metaslab_latency_ewma(&mg->mg_write_latency, delta);
+	metaslab_latency_ewma(&mg->mg_class->mc_write_latency, delta);
+}
+
+/*
+ * Returns the part of a metaslab group's allocation bias which is derived
+ * from its write latency.  A group completing writes faster than the class
+ * average is given up to metaslab_latency_bias_pct percent more of the
+ * aliquot, a slower one that much less.  The free space bias still applies
+ * on top of this, and a group which already has less free space than the
+ * class average (free_ratio below 100) is never biased up for being fast,
+ * so latency alone can't fill one vdev ahead of the others.
+ */
+static int64_t
+metaslab_group_latency_bias(metaslab_group_t *mg, int64_t free_ratio)
+{
+	uint64_t mg_latency = mg->mg_write_latency;
+	uint64_t mc_latency = mg->mg_class->mc_write_latency;
+	int64_t pct = MIN(metaslab_latency_bias_pct, 100);
+	int64_t ratio;
+
+	if (pct == 0 || mg_latency == 0 || mc_latency == 0)
+		return (0);
+
+	ratio = (int64_t)((mc_latency * 100) / mg_latency);
+	ratio = MIN(MAX(ratio, 100 - pct), 100 + pct);
+	if (ratio > 100 && free_ratio < 100)
+		ratio = 100;
+
+	return (((ratio - 100) * (int64_t)mg->mg_aliquot) / 100);
+}
+
 static uint64_t
 metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 {
@@ -5268,8 +5437,13 @@ top:
 				    (mc_free + 1);
 				mg->mg_bias = ((ratio - 100) *
 				    (int64_t)mg->mg_aliquot) / 100;
+
+				mg->mg_latency_bias =
+				    metaslab_group_latency_bias(mg, ratio);
+				mg->mg_bias += mg->mg_latency_bias;
 			} else if (!metaslab_bias_enabled) {
 				mg->mg_bias = 0;
+				mg->mg_latency_bias = 0;
 			}
 
 			if ((flags & METASLAB_FASTWRITE) ||
@@ -6067,17 +6241,30 @@ metaslab_group_disable_wait(metaslab_group_t *mg)
 	}
 }
 
+/*
+ * Each worker of a sequential rebuild disables the metaslab it scans, so
+ * the group of a vdev being rebuilt by several workers is allowed that
+ * many more disabled metaslabs.  The workers are counted from before
+ * they start until after they have all finished.
+ */
+static int
+metaslab_group_disabled_max(metaslab_group_t *mg)
+{
+	int nworkers = mg->mg_vd->vdev_rebuild_config.vr_nworkers;
+
+	return (max_disabled_ms + MAX(nworkers - 1, 0));
+}
+
 static void
 metaslab_group_disabled_increment(metaslab_group_t *mg)
 {
 	ASSERT(MUTEX_HELD(&mg->mg_ms_disabled_lock));
 	ASSERT(mg->mg_disabled_updating);
 
-	while (mg->mg_ms_disabled >= max_disabled_ms) {
+	while (mg->mg_ms_disabled >= metaslab_group_disabled_max(mg)) {
 		cv_wait(&mg->mg_ms_disabled_cv, &mg->mg_ms_disabled_lock);
 	}
 	mg->mg_ms_disabled++;
-	ASSERT3U(mg->mg_ms_disabled, <=, max_disabled_ms);
 }
 
 /*
@@ -6243,6 +6430,9 @@ ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, lba_weighting_enabled, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, bias_enabled, INT, ZMOD_RW,
 	"Enable metaslab group biasing");
 
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, latency_bias_pct, UINT, ZMOD_RW,
+	"Max percent metaslab group bias based on write latency");
+
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, segment_weight_enabled, INT,
 	ZMOD_RW, "Enable segment-based metaslab selection");
 
@@ -6258,6 +6448,9 @@ ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, df_max_search, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, df_use_largest_segment, INT, ZMOD_RW,
 	"When looking in size tree, use largest segment instead of exact fit");
 
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, df_raidz_pack_max, UINT, ZMOD_RW,
+	"Max RAIDZ allocation size packed with other small allocations");
+
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, max_size_cache_sec, U64,
 	ZMOD_RW, "How long to trust the cached max chunk size of a metaslab");
 
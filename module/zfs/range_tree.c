@@ -213,7 +213,13 @@ range_tree_create_gap(const range_tree_ops_t *ops, range_seg_type_t type,
 	default:
 		panic("Invalid range seg type %d", type);
 	}
-	zfs_btree_create(&rt->rt_root, compare, size);
+	/*
+	 * Range trees use the generic node search. A specialized search
+	 * generated with ZFS_BTREE_FIND_IN_BUF_FUNC() was measurably slower
+	 * in metaslab_df_alloc(), whose lookups follow the allocation cursor
+	 * and so predict well; see btree_test -b.
+	 */
+	zfs_btree_create(&rt->rt_root, compare, NULL, size);
 
 	rt->rt_ops = ops;
 	rt->rt_gap = gap;
@@ -341,6 +341,8 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_DEDUPRATIO, NULL,
 		    ddt_get_pool_dedup_ratio(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_DEDUP_TABLE_SIZE, NULL,
+		    ddt_get_ddt_dsize(spa), src);
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_HEALTH, NULL,
 		    rvd->vdev_state, src);
@@ -1598,6 +1600,10 @@ spa_destroy_aux_threads(spa_t *spa)
 		zthr_destroy(spa->spa_livelist_condense_zthr);
 		spa->spa_livelist_condense_zthr = NULL;
 	}
+	if (spa->spa_rewrite_zthr != NULL) {
+		zthr_destroy(spa->spa_rewrite_zthr);
+		spa->spa_rewrite_zthr = NULL;
+	}
 }
 
 /*
@@ -2900,6 +2906,8 @@ spa_spawn_aux_threads(spa_t *spa)
 	    zthr_create("z_checkpoint_discard",
 	    spa_checkpoint_discard_thread_check,
 	    spa_checkpoint_discard_thread, spa, minclsyspri);
+
+	dsl_rewrite_start_thread(spa);
 }
 
 /*
@@ -4190,6 +4198,13 @@ spa_ld_get_props(spa_t *spa)
 	if (error != 0 && error != ENOENT)
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
 
+	/*
+	 * Load the state of the block rewrite, if any.
+	 */
+	error = dsl_rewrite_init(spa);
+	if (error != 0)
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
+
 	/*
 	 * Load the history object.  If we have an older pool, this
 	 * will not be present.
@@ -4255,6 +4270,8 @@ spa_ld_get_props(spa_t *spa)
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
 		spa_prop_find(spa, ZPOOL_PROP_MULTIHOST, &spa->spa_multihost);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOTRIM, &spa->spa_autotrim);
+		spa_prop_find(spa, ZPOOL_PROP_DEDUP_TABLE_QUOTA,
+		    &spa->spa_dedup_table_quota);
 		spa->spa_autoreplace = (autoreplace != 0);
 	}
 
@@ -4387,6 +4404,28 @@ spa_ld_load_vdev_metadata(spa_t *spa)
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, error));
 	}
 
+	/*
+	 * Now that the metaslab weights reflect the unflushed changes, start
+	 * loading the best metaslabs of every group in the background so
+	 * that they load in parallel with the rest of the import instead of
+	 * one at a time on the first allocations.
+	 */
+	if (spa_writeable(spa)) {
+		spa_config_enter(spa, SCL_ALLOC, FTAG, RW_READER);
+		for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+			vdev_t *tvd = rvd->vdev_child[c];
+			metaslab_group_t *mgs[] = {
+			    tvd->vdev_mg, tvd->vdev_log_mg };
+
+			for (int i = 0; i < ARRAY_SIZE(mgs); i++) {
+				if (mgs[i] != NULL &&
+				    mgs[i]->mg_activation_count > 0)
+					metaslab_group_preload(mgs[i]);
+			}
+		}
+		spa_config_exit(spa, SCL_ALLOC, FTAG);
+	}
+
 	/*
 	 * Propagate the leaf DTLs we just loaded all the way up the vdev tree.
 	 */
@@ -6035,6 +6074,8 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
 	spa->spa_multihost = zpool_prop_default_numeric(ZPOOL_PROP_MULTIHOST);
 	spa->spa_autotrim = zpool_prop_default_numeric(ZPOOL_PROP_AUTOTRIM);
+	spa->spa_dedup_table_quota =
+	    zpool_prop_default_numeric(ZPOOL_PROP_DEDUP_TABLE_QUOTA);
 
 	if (props != NULL) {
 		spa_configfile_set(spa, props, B_FALSE);
@@ -8098,7 +8139,19 @@ spa_scan(spa_t *spa, pool_scan_func_t func)
 		return (0);
 	}
 
-	return (dsl_scan(spa->spa_dsl_pool, func));
+	return (dsl_scan(spa->spa_dsl_pool, func, B_FALSE));
+}
+
+/*
+ * Start a scrub of the blocks born after the last completed scrub, or
+ * resume a paused scrub.
+ */
+int
+spa_scan_from_last_txg(spa_t *spa)
+{
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == 0);
+
+	return (dsl_scan(spa->spa_dsl_pool, POOL_SCAN_SCRUB, B_TRUE));
 }
 
 /*
@@ -8339,6 +8392,10 @@ spa_async_suspend(spa_t *spa)
 	zthr_t *ll_condense_thread = spa->spa_livelist_condense_zthr;
 	if (ll_condense_thread != NULL)
 		zthr_cancel(ll_condense_thread);
+
+	zthr_t *rewrite_thread = spa->spa_rewrite_zthr;
+	if (rewrite_thread != NULL)
+		zthr_cancel(rewrite_thread);
 }
 
 void
@@ -8365,6 +8422,10 @@ spa_async_resume(spa_t *spa)
 	zthr_t *ll_condense_thread = spa->spa_livelist_condense_zthr;
 	if (ll_condense_thread != NULL)
 		zthr_resume(ll_condense_thread);
+
+	zthr_t *rewrite_thread = spa->spa_rewrite_zthr;
+	if (rewrite_thread != NULL)
+		zthr_resume(rewrite_thread);
 }
 
 static boolean_t
@@ -8892,6 +8953,9 @@ spa_sync_props(void *arg, dmu_tx_t *tx)
 				case ZPOOL_PROP_MULTIHOST:
 					spa->spa_multihost = intval;
 					break;
+				case ZPOOL_PROP_DEDUP_TABLE_QUOTA:
+					spa->spa_dedup_table_quota = intval;
+					break;
 				default:
 					break;
 				}
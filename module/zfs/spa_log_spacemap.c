@@ -303,6 +303,22 @@ static uint64_t zfs_max_log_walking = 5;
  */
 int zfs_keep_log_spacemaps_at_export = 0;
 
+/*
+ * Number of threads used to replay the log space maps into the unflushed
+ * range trees of the metaslabs during import. The log space maps are still
+ * read and decoded in TXG order by a single thread, but the entries are
+ * applied to the metaslabs in parallel, with each metaslab always handled
+ * by the same thread so that its entries are applied in order. Setting this
+ * to 1 replays the log serially.
+ */
+static uint_t zfs_log_sm_replay_threads = 8;
+
+/*
+ * Number of log space map entries buffered per replay thread before they
+ * are handed off to be applied.
+ */
+#define	SPA_LD_LOG_SM_BATCH_LEN	(1ULL << 14)
+
 static uint64_t
 spa_estimate_incoming_log_blocks(spa_t *spa)
 {
@@ -1067,11 +1083,84 @@ spa_ld_log_sm_metadata(spa_t *spa)
 	return (0);
 }
 
+typedef struct spa_ld_log_sm_entry {
+	metaslab_t *slle_ms;
+	uint64_t slle_start;
+	uint64_t slle_end;
+	maptype_t slle_type;
+} spa_ld_log_sm_entry_t;
+
+typedef struct spa_ld_log_sm_batch {
+	spa_ld_log_sm_entry_t *sllb_entries;
+	uint64_t sllb_count;
+} spa_ld_log_sm_batch_t;
+
 typedef struct spa_ld_log_sm_arg {
 	spa_t *slls_spa;
 	uint64_t slls_txg;
+	taskq_t *slls_tq;
+	spa_ld_log_sm_batch_t *slls_batches;
+	uint_t slls_nbatches;
 } spa_ld_log_sm_arg_t;
 
+/*
+ * Apply a batch of log space map entries to the unflushed trees of their
+ * metaslabs. All the entries of a given metaslab end up in the same batch,
+ * in the order that they were read from the log.
+ */
+static void
+spa_ld_log_sm_apply(void *arg)
+{
+	spa_ld_log_sm_batch_t *sllb = arg;
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+
+	for (uint64_t i = 0; i < sllb->sllb_count; i++) {
+		spa_ld_log_sm_entry_t *slle = &sllb->sllb_entries[i];
+		metaslab_t *ms = slle->slle_ms;
+
+		switch (slle->slle_type) {
+		case SM_ALLOC:
+			range_tree_remove_xor_add_segment(slle->slle_start,
+			    slle->slle_end, ms->ms_unflushed_frees,
+			    ms->ms_unflushed_allocs);
+			break;
+		case SM_FREE:
+			range_tree_remove_xor_add_segment(slle->slle_start,
+			    slle->slle_end, ms->ms_unflushed_allocs,
+			    ms->ms_unflushed_frees);
+			break;
+		default:
+			panic("invalid maptype_t");
+			break;
+		}
+	}
+	sllb->sllb_count = 0;
+
+	spl_fstrans_unmark(cookie);
+}
+
+/*
+ * Apply all the buffered log space map entries and wait for them to be
+ * processed.
+ */
+static void
+spa_ld_log_sm_flush(spa_ld_log_sm_arg_t *slls)
+{
+	if (slls->slls_tq == NULL) {
+		spa_ld_log_sm_apply(&slls->slls_batches[0]);
+		return;
+	}
+
+	for (uint_t b = 0; b < slls->slls_nbatches; b++) {
+		spa_ld_log_sm_batch_t *sllb = &slls->slls_batches[b];
+		if (sllb->sllb_count == 0)
+			continue;
+		VERIFY3U(taskq_dispatch(slls->slls_tq, spa_ld_log_sm_apply,
+		    sllb, TQ_SLEEP), !=, TASKQID_INVALID);
+	}
+	taskq_wait(slls->slls_tq);
+}
+
 static int
 spa_ld_log_sm_cb(space_map_entry_t *sme, void *arg)
 {
@@ -1105,19 +1194,21 @@ spa_ld_log_sm_cb(space_map_entry_t *sme, void *arg)
 	if (slls->slls_txg < metaslab_unflushed_txg(ms))
 		return (0);
 
-	switch (sme->sme_type) {
-	case SM_ALLOC:
-		range_tree_remove_xor_add_segment(offset, offset + size,
-		    ms->ms_unflushed_frees, ms->ms_unflushed_allocs);
-		break;
-	case SM_FREE:
-		range_tree_remove_xor_add_segment(offset, offset + size,
-		    ms->ms_unflushed_allocs, ms->ms_unflushed_frees);
-		break;
-	default:
-		panic("invalid maptype_t");
-		break;
-	}
+	/*
+	 * Queue the entry for the thread that owns this metaslab. The
+	 * range tree updates are where the time goes on large logs, so
+	 * they are done in parallel across metaslabs.
+	 */
+	spa_ld_log_sm_batch_t *sllb = &slls->slls_batches[
+	    (ms->ms_id + vdev_id) % slls->slls_nbatches];
+	spa_ld_log_sm_entry_t *slle = &sllb->sllb_entries[sllb->sllb_count++];
+	slle->slle_ms = ms;
+	slle->slle_start = offset;
+	slle->slle_end = offset + size;
+	slle->slle_type = sme->sme_type;
+	if (sllb->sllb_count == SPA_LD_LOG_SM_BATCH_LEN)
+		spa_ld_log_sm_flush(slls);
+
 	if (!metaslab_unflushed_dirty(ms)) {
 		metaslab_set_unflushed_dirty(ms, B_TRUE);
 		spa_log_summary_dirty_flushed_metaslab(spa,
@@ -1144,6 +1235,25 @@ spa_ld_log_sm_data(spa_t *spa)
 
 	hrtime_t read_logs_starttime = gethrtime();
 
+	uint_t nthreads = MAX(MIN(zfs_log_sm_replay_threads,
+	    max_ncpus), 1);
+	spa_ld_log_sm_arg_t slls = {
+		.slls_spa = spa,
+		.slls_tq = NULL,
+		.slls_nbatches = nthreads,
+	};
+	slls.slls_batches = kmem_zalloc(nthreads *
+	    sizeof (spa_ld_log_sm_batch_t), KM_SLEEP);
+	for (uint_t b = 0; b < nthreads; b++) {
+		slls.slls_batches[b].sllb_entries = vmem_alloc(
+		    SPA_LD_LOG_SM_BATCH_LEN * sizeof (spa_ld_log_sm_entry_t),
+		    KM_SLEEP);
+	}
+	if (nthreads > 1) {
+		slls.slls_tq = taskq_create("z_log_sm_replay", nthreads,
+		    minclsyspri, nthreads, INT_MAX, TASKQ_PREPOPULATE);
+	}
+
 	/* Prefetch log spacemaps dnodes. */
 	for (sls = avl_first(&spa->spa_sm_logs_by_txg); sls;
 	    sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
@@ -1185,12 +1295,9 @@ spa_ld_log_sm_data(spa_t *spa)
 		summary_add_data(spa, sls->sls_txg,
 		    sls->sls_mscount, 0, sls->sls_nblocks);
 
-		struct spa_ld_log_sm_arg vla = {
-			.slls_spa = spa,
-			.slls_txg = sls->sls_txg
-		};
+		slls.slls_txg = sls->sls_txg;
 		error = space_map_iterate(sls->sls_sm,
-		    space_map_length(sls->sls_sm), spa_ld_log_sm_cb, &vla);
+		    space_map_length(sls->sls_sm), spa_ld_log_sm_cb, &slls);
 		if (error != 0) {
 			spa_load_failed(spa, "spa_ld_log_sm_data(): failed "
 			    "at space_map_iterate(obj=%llu) [error %d]",
@@ -1208,15 +1315,32 @@ spa_ld_log_sm_data(spa_t *spa)
 		spa_log_sm_set_blocklimit(spa);
 	}
 
+	spa_ld_log_sm_flush(&slls);
+
 	hrtime_t read_logs_endtime = gethrtime();
 	spa_load_note(spa,
 	    "read %llu log space maps (%llu total blocks - blksz = %llu bytes) "
-	    "in %lld ms", (u_longlong_t)avl_numnodes(&spa->spa_sm_logs_by_txg),
+	    "in %lld ms (%u threads)",
+	    (u_longlong_t)avl_numnodes(&spa->spa_sm_logs_by_txg),
 	    (u_longlong_t)spa_log_sm_nblocks(spa),
 	    (u_longlong_t)zfs_log_sm_blksz,
-	    (longlong_t)((read_logs_endtime - read_logs_starttime) / 1000000));
+	    (longlong_t)((read_logs_endtime - read_logs_starttime) / 1000000),
+	    nthreads);
 
 out:
+	/*
+	 * Any entries still buffered at this point belong to a failed
+	 * import and are dropped; the trees are torn down in spa_unload().
+	 */
+	if (slls.slls_tq != NULL)
+		taskq_destroy(slls.slls_tq);
+	for (uint_t b = 0; b < nthreads; b++) {
+		vmem_free(slls.slls_batches[b].sllb_entries,
+		    SPA_LD_LOG_SM_BATCH_LEN * sizeof (spa_ld_log_sm_entry_t));
+	}
+	kmem_free(slls.slls_batches, nthreads *
+	    sizeof (spa_ld_log_sm_batch_t));
+
 	if (error != 0) {
 		for (spa_log_sm_t *sls = avl_first(&spa->spa_sm_logs_by_txg);
 		    sls; sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
@@ -1392,6 +1516,9 @@ ZFS_MODULE_PARAM(zfs, zfs_, max_log_walking, U64, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, keep_log_spacemaps_at_export, INT, ZMOD_RW,
 	"Prevent the log spacemaps from being flushed and destroyed "
 	"during pool export/destroy");
+
+ZFS_MODULE_PARAM(zfs, zfs_, log_sm_replay_threads, UINT, ZMOD_RW,
+	"Number of threads used to replay the spacemap log at import");
 /* END CSTYLED */
 
 ZFS_MODULE_PARAM(zfs, zfs_, max_logsm_summary_length, U64, ZMOD_RW,
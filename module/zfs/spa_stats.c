@@ -22,6 +22,7 @@
 #include <sys/zfs_context.h>
 #include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
+#include <sys/metaslab_impl.h>
 #include <sys/spa.h>
 #include <zfs_comutil.h>
 
@@ -876,6 +877,373 @@ spa_guid_destroy(spa_t *spa)
 	mutex_destroy(&shk->lock);
 }
 
+/*
+ * Append one line per child of every mirror-like vdev below vd, showing
+ * the share of reads directed to it and its read latency average.
+ */
+static int
+spa_mirror_stats_vdev(vdev_t *vd, char *buf, size_t size, size_t *off)
+{
+	int error;
+
+	if (vd->vdev_ops == &vdev_mirror_ops ||
+	    vd->vdev_ops == &vdev_replacing_ops ||
+	    vd->vdev_ops == &vdev_spare_ops) {
+		uint64_t total = 0;
+		char pname[32];
+
+		(void) snprintf(pname, sizeof (pname), "%s-%llu",
+		    vd->vdev_ops->vdev_op_type, (u_longlong_t)vd->vdev_id);
+		for (int c = 0; c < vd->vdev_children; c++)
+			total += vd->vdev_child[c]->vdev_mirror_reads;
+
+		for (int c = 0; c < vd->vdev_children; c++) {
+			vdev_t *cvd = vd->vdev_child[c];
+			uint64_t reads = cvd->vdev_mirror_reads;
+			char cname[32];
+
+			if (cvd->vdev_path == NULL) {
+				(void) snprintf(cname, sizeof (cname),
+				    "%s-%llu", cvd->vdev_ops->vdev_op_type,
+				    (u_longlong_t)cvd->vdev_id);
+			}
+
+			*off += snprintf(buf + *off, size - *off,
+			    "%-20s %-32s %12llu %5llu %12llu\n", pname,
+			    cvd->vdev_path ? cvd->vdev_path : cname,
+			    (u_longlong_t)reads,
+			    (u_longlong_t)(total ? reads * 100 / total : 0),
+			    (u_longlong_t)NSEC2USEC(
+			    cvd->vdev_mirror_lat_ewma));
+			if (*off >= size)
+				return (SET_ERROR(ENOMEM));
+		}
+	}
+
+	for (int c = 0; c < vd->vdev_children; c++) {
+		error = spa_mirror_stats_vdev(vd->vdev_child[c], buf, size,
+		    off);
+		if (error != 0)
+			return (error);
+	}
+
+	return (0);
+}
+
+static int
+spa_mirror_stats_data(char *buf, size_t size, void *data)
+{
+	spa_t *spa = (spa_t *)data;
+	size_t off;
+	int error = 0;
+
+	off = snprintf(buf, size, "%-20s %-32s %12s %5s %12s\n",
+	    "vdev", "child", "reads", "share", "lat_us");
+	if (off >= size)
+		return (SET_ERROR(ENOMEM));
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if (spa->spa_root_vdev != NULL)
+		error = spa_mirror_stats_vdev(spa->spa_root_vdev, buf, size,
+		    &off);
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	return (error);
+}
+
+/*
+ * Return the distribution of normal reads across the children of each
+ * mirror vdev in /proc/spl/kstat/zfs/<pool>/vdev_mirror.  The share
+ * column is each child's percentage of the reads sent to its parent
+ * since the pool was imported.
+ */
+static void
+spa_mirror_stats_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.mirror;
+	char *name;
+	kstat_t *ksp;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	name = kmem_asprintf("zfs/%s", spa_name(spa));
+	ksp = kstat_create(name, 0, "vdev_mirror", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_flags |= KSTAT_FLAG_NO_HEADERS;
+		kstat_set_raw_ops(ksp, NULL, spa_mirror_stats_data,
+		    spa_state_addr);
+		kstat_install(ksp);
+	}
+
+	kmem_strfree(name);
+}
+
+static void
+spa_mirror_stats_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.mirror;
+	kstat_t *ksp = shk->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	mutex_destroy(&shk->lock);
+}
+
+/*
+ * Append one line per leaf vdev below vd with the number of i/os in each
+ * deadline-scheduled class that completed after their deadline.
+ */
+static int
+spa_queue_stats_vdev(vdev_t *vd, char *buf, size_t size, size_t *off)
+{
+	int error;
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		uint64_t *missed = vd->vdev_queue.vq_deadline_missed;
+		char name[32];
+
+		if (vd->vdev_path == NULL) {
+			(void) snprintf(name, sizeof (name), "%s-%llu",
+			    vd->vdev_ops->vdev_op_type,
+			    (u_longlong_t)vd->vdev_id);
+		}
+
+		*off += snprintf(buf + *off, size - *off,
+		    "%-32s %16llu %16llu\n",
+		    vd->vdev_path ? vd->vdev_path : name,
+		    (u_longlong_t)missed[ZIO_PRIORITY_SYNC_READ],
+		    (u_longlong_t)missed[ZIO_PRIORITY_SYNC_WRITE]);
+		if (*off >= size)
+			return (SET_ERROR(ENOMEM));
+	}
+
+	for (int c = 0; c < vd->vdev_children; c++) {
+		error = spa_queue_stats_vdev(vd->vdev_child[c], buf, size, off);
+		if (error != 0)
+			return (error);
+	}
+
+	return (0);
+}
+
+static int
+spa_queue_stats_data(char *buf, size_t size, void *data)
+{
+	spa_t *spa = (spa_t *)data;
+	size_t off;
+	int error = 0;
+
+	off = snprintf(buf, size, "%-32s %16s %16s\n",
+	    "vdev", "sync_r_missed", "sync_w_missed");
+	if (off >= size)
+		return (SET_ERROR(ENOMEM));
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if (spa->spa_root_vdev != NULL)
+		error = spa_queue_stats_vdev(spa->spa_root_vdev, buf, size,
+		    &off);
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	return (error);
+}
+
+/*
+ * Return the per-leaf count of sync i/os which missed their
+ * zfs_vdev_sync_{read,write}_deadline_ms latency target in
+ * /proc/spl/kstat/zfs/<pool>/vdev_queue.
+ */
+static void
+spa_queue_stats_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.queue;
+	char *name;
+	kstat_t *ksp;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	name = kmem_asprintf("zfs/%s", spa_name(spa));
+	ksp = kstat_create(name, 0, "vdev_queue", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_flags |= KSTAT_FLAG_NO_HEADERS;
+		kstat_set_raw_ops(ksp, NULL, spa_queue_stats_data,
+		    spa_state_addr);
+		kstat_install(ksp);
+	}
+
+	kmem_strfree(name);
+}
+
+static void
+spa_queue_stats_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.queue;
+	kstat_t *ksp = shk->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	mutex_destroy(&shk->lock);
+}
+
+static int
+spa_latency_stats_data(char *buf, size_t size, void *data)
+{
+	spa_t *spa = (spa_t *)data;
+	vdev_t *rvd;
+	size_t off;
+
+	off = snprintf(buf, size, "%-8s %16s %16s %16s %16s\n", "vdev",
+	    "write_lat_us", "class_lat_us", "bias", "latency_bias");
+	if (off >= size)
+		return (SET_ERROR(ENOMEM));
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	rvd = spa->spa_root_vdev;
+	for (uint64_t c = 0; rvd != NULL && c < rvd->vdev_children; c++) {
+		metaslab_group_t *mg = rvd->vdev_child[c]->vdev_mg;
+
+		if (mg == NULL)
+			continue;
+
+		off += snprintf(buf + off, size - off,
+		    "%-8llu %16llu %16llu %16lld %16lld\n", (u_longlong_t)c,
+		    (u_longlong_t)NSEC2USEC(mg->mg_write_latency),
+		    (u_longlong_t)NSEC2USEC(mg->mg_class->mc_write_latency),
+		    (longlong_t)mg->mg_bias, (longlong_t)mg->mg_latency_bias);
+		if (off >= size) {
+			spa_config_exit(spa, SCL_VDEV, FTAG);
+			return (SET_ERROR(ENOMEM));
+		}
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	return (0);
+}
+
+/*
+ * Return the allocating write latency and resulting allocation bias of
+ * each top-level vdev in /proc/spl/kstat/zfs/<pool>/metaslab_latency.
+ */
+static void
+spa_latency_stats_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.latency;
+	char *name;
+	kstat_t *ksp;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	name = kmem_asprintf("zfs/%s", spa_name(spa));
+	ksp = kstat_create(name, 0, "metaslab_latency", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_flags |= KSTAT_FLAG_NO_HEADERS;
+		kstat_set_raw_ops(ksp, NULL, spa_latency_stats_data,
+		    spa_state_addr);
+		kstat_install(ksp);
+	}
+
+	kmem_strfree(name);
+}
+
+static void
+spa_latency_stats_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.latency;
+	kstat_t *ksp = shk->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	mutex_destroy(&shk->lock);
+}
+
+static int
+spa_rewrite_stats_data(char *buf, size_t size, void *data)
+{
+	spa_t *spa = (spa_t *)data;
+	dsl_rewrite_phys_t drp;
+	size_t off;
+
+	mutex_enter(&spa->spa_rewrite_lock);
+	drp = spa->spa_rewrite_phys;
+	mutex_exit(&spa->spa_rewrite_lock);
+
+	off = snprintf(buf, size, "%-8s %-12s %-12s %-20s %-12s %-16s "
+	    "%-12s %-12s\n", "state", "dsobj", "object", "offset", "blocks",
+	    "bytes", "start", "end");
+	if (off >= size)
+		return (SET_ERROR(ENOMEM));
+
+	off += snprintf(buf + off, size - off, "%-8llu %-12llu %-12llu "
+	    "%-20llu %-12llu %-16llu %-12llu %-12llu\n",
+	    (u_longlong_t)drp.drp_state, (u_longlong_t)drp.drp_dsobj,
+	    (u_longlong_t)drp.drp_object, (u_longlong_t)drp.drp_offset,
+	    (u_longlong_t)drp.drp_blocks, (u_longlong_t)drp.drp_bytes,
+	    (u_longlong_t)drp.drp_start_time, (u_longlong_t)drp.drp_end_time);
+	if (off >= size)
+		return (SET_ERROR(ENOMEM));
+
+	return (0);
+}
+
+/*
+ * Return the state and progress of the pool's block rewrite, as last
+ * synced to disk, in /proc/spl/kstat/zfs/<pool>/rewrite.
+ */
+static void
+spa_rewrite_stats_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.rewrite;
+	char *name;
+	kstat_t *ksp;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	name = kmem_asprintf("zfs/%s", spa_name(spa));
+	ksp = kstat_create(name, 0, "rewrite", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_flags |= KSTAT_FLAG_NO_HEADERS;
+		kstat_set_raw_ops(ksp, NULL, spa_rewrite_stats_data,
+		    spa_state_addr);
+		kstat_install(ksp);
+	}
+
+	kmem_strfree(name);
+}
+
+static void
+spa_rewrite_stats_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.rewrite;
+	kstat_t *ksp = shk->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	mutex_destroy(&shk->lock);
+}
+
 static const spa_iostats_t spa_iostats_template = {
 	{ "trim_extents_written",		KSTAT_DATA_UINT64 },
 	{ "trim_bytes_written",			KSTAT_DATA_UINT64 },
@@ -998,11 +1366,19 @@ spa_stats_init(spa_t *spa)
 	spa_state_init(spa);
 	spa_guid_init(spa);
 	spa_iostats_init(spa);
+	spa_mirror_stats_init(spa);
+	spa_queue_stats_init(spa);
+	spa_latency_stats_init(spa);
+	spa_rewrite_stats_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_rewrite_stats_destroy(spa);
+	spa_latency_stats_destroy(spa);
+	spa_queue_stats_destroy(spa);
+	spa_mirror_stats_destroy(spa);
 	spa_iostats_destroy(spa);
 	spa_health_destroy(spa);
 	spa_tx_assign_destroy(spa);
@@ -523,6 +523,76 @@ space_map_histogram_add(space_map_t *sm, range_tree_t *rt, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * Checksum the parts of the space map that any writer updates, so that
+ * appending to the map without touching the summary invalidates it even
+ * if the histogram happens to come out the same.
+ */
+static uint64_t
+space_map_histogram_checksum(space_map_t *sm)
+{
+	/* 64-bit FNV-1a over the length, allocated space and buckets */
+	uint64_t cksum = 0xcbf29ce484222325ULL;
+	cksum ^= sm->sm_phys->smp_length;
+	cksum *= 0x100000001b3ULL;
+	cksum ^= (uint64_t)sm->sm_phys->smp_alloc;
+	cksum *= 0x100000001b3ULL;
+	for (int i = 0; i < SPACE_MAP_HISTOGRAM_SIZE; i++) {
+		cksum ^= sm->sm_phys->smp_histogram[i];
+		cksum *= 0x100000001b3ULL;
+	}
+
+	/* zero is what older versions left in this field */
+	return (cksum == 0 ? 1 : cksum);
+}
+
+/*
+ * Return B_TRUE and copy out the largest free region sizes if the space
+ * map has a summary that is consistent with its current histogram.
+ * max_free may be NULL to just check the summary's validity.
+ */
+boolean_t
+space_map_summary_get(space_map_t *sm, uint64_t *max_free)
+{
+	if (sm->sm_dbuf->db_size != sizeof (space_map_phys_t))
+		return (B_FALSE);
+
+	if (sm->sm_phys->smp_summary_check !=
+	    space_map_histogram_checksum(sm))
+		return (B_FALSE);
+
+	if (max_free != NULL) {
+		memcpy(max_free, sm->sm_phys->smp_max_free,
+		    sizeof (sm->sm_phys->smp_max_free));
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Record the summary of the space map's largest free regions. If
+ * max_free is NULL the recorded sizes are kept, and the summary is only
+ * revalidated against the current histogram; the caller must know that
+ * the recorded sizes are still lower bounds.
+ */
+void
+space_map_summary_set(space_map_t *sm, const uint64_t *max_free,
+    dmu_tx_t *tx)
+{
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	if (sm->sm_dbuf->db_size != sizeof (space_map_phys_t))
+		return;
+
+	dmu_buf_will_dirty(sm->sm_dbuf, tx);
+
+	if (max_free != NULL) {
+		memcpy(sm->sm_phys->smp_max_free, max_free,
+		    sizeof (sm->sm_phys->smp_max_free));
+		sm->sm_phys->smp_summary_txg = dmu_tx_get_txg(tx);
+	}
+	sm->sm_phys->smp_summary_check = space_map_histogram_checksum(sm);
+}
+
 static void
 space_map_write_intro_debug(space_map_t *sm, maptype_t maptype, dmu_tx_t *tx)
 {
@@ -904,6 +974,8 @@ space_map_truncate(space_map_t *sm, int blocksize, dmu_tx_t *tx)
 	dmu_buf_will_dirty(sm->sm_dbuf, tx);
 	sm->sm_phys->smp_length = 0;
 	sm->sm_phys->smp_alloc = 0;
+	if (sm->sm_dbuf->db_size == sizeof (space_map_phys_t))
+		sm->sm_phys->smp_summary_check = 0;
 }
 
 uint64_t
@@ -1416,7 +1416,7 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	uint64_t oldc = vd->vdev_ms_count;
 	uint64_t newc = vd->vdev_asize >> vd->vdev_ms_shift;
 	metaslab_t **mspp;
-	int error;
+	int error = 0;
 	boolean_t expanding = (oldc != 0);
 
 	ASSERT(txg == 0 || spa_config_held(spa, SCL_ALLOC, RW_WRITER));
@@ -1441,33 +1441,54 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	vd->vdev_ms = mspp;
 	vd->vdev_ms_count = newc;
 
-	for (uint64_t m = oldc; m < newc; m++) {
-		uint64_t object = 0;
+	/*
+	 * vdev_ms_array may be 0 if we are creating the "fake"
+	 * metaslabs for an indirect vdev for zdb's leak detection.
+	 * See zdb_leak_init().
+	 */
+	uint64_t *objects = NULL;
+	if (txg == 0 && vd->vdev_ms_array != 0) {
+		objects = vmem_zalloc((newc - oldc) * sizeof (uint64_t),
+		    KM_SLEEP);
+		error = dmu_read(spa->spa_meta_objset, vd->vdev_ms_array,
+		    oldc * sizeof (uint64_t), (newc - oldc) * sizeof (uint64_t),
+		    objects, DMU_READ_PREFETCH);
+		if (error != 0) {
+			vdev_dbgmsg(vd, "unable to read the metaslab "
+			    "array [error=%d]", error);
+			vmem_free(objects, (newc - oldc) * sizeof (uint64_t));
+			return (error);
+		}
+
 		/*
-		 * vdev_ms_array may be 0 if we are creating the "fake"
-		 * metaslabs for an indirect vdev for zdb's leak detection.
-		 * See zdb_leak_init().
+		 * Opening each space map reads its dnode. On vdevs with
+		 * many metaslabs these reads dominate import time if they
+		 * are issued one at a time, so prefetch all of them first.
 		 */
-		if (txg == 0 && vd->vdev_ms_array != 0) {
-			error = dmu_read(spa->spa_meta_objset,
-			    vd->vdev_ms_array,
-			    m * sizeof (uint64_t), sizeof (uint64_t), &object,
-			    DMU_READ_PREFETCH);
-			if (error != 0) {
-				vdev_dbgmsg(vd, "unable to read the metaslab "
-				    "array [error=%d]", error);
-				return (error);
+		for (uint64_t m = oldc; m < newc; m++) {
+			if (objects[m - oldc] != 0) {
+				dmu_prefetch(spa->spa_meta_objset,
+				    objects[m - oldc], 0, 0, 0,
+				    ZIO_PRIORITY_SYNC_READ);
 			}
 		}
+	}
+
+	for (uint64_t m = oldc; m < newc; m++) {
+		uint64_t object = (objects != NULL) ? objects[m - oldc] : 0;
 
 		error = metaslab_init(vd->vdev_mg, m, object, txg,
 		    &(vd->vdev_ms[m]));
 		if (error != 0) {
 			vdev_dbgmsg(vd, "metaslab_init failed [error=%d]",
 			    error);
-			return (error);
+			break;
 		}
 	}
+	if (objects != NULL)
+		vmem_free(objects, (newc - oldc) * sizeof (uint64_t));
+	if (error != 0)
+		return (error);
 
 	/*
 	 * Find the emptiest metaslab on the vdev and mark it for use for
@@ -53,6 +53,9 @@ typedef struct mirror_stats {
 
 	kstat_named_t vdev_mirror_stat_preferred_found;
 	kstat_named_t vdev_mirror_stat_preferred_not_found;
+
+	kstat_named_t vdev_mirror_stat_latency_adjusted;
+	kstat_named_t vdev_mirror_stat_latency_stale;
 } mirror_stats_t;
 
 static mirror_stats_t mirror_stats = {
@@ -70,7 +73,10 @@ static mirror_stats_t mirror_stats = {
 	{ "preferred_found",			KSTAT_DATA_UINT64 },
 	/* Preferred child vdev not found or equal load  */
 	{ "preferred_not_found",		KSTAT_DATA_UINT64 },
-
+	/* Child load was scaled by its relative read latency */
+	{ "latency_adjusted",			KSTAT_DATA_UINT64 },
+	/* A child had no recent latency sample, so latency was ignored */
+	{ "latency_stale",			KSTAT_DATA_UINT64 },
 };
 
 #define	MIRROR_STAT(stat)		(mirror_stats.stat.value.ui64)
@@ -144,6 +150,25 @@ static int zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
 static int zfs_vdev_mirror_non_rotating_inc = 0;
 static int zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
+/*
+ * Latency aware load calculation configuration.
+ *
+ * Each child tracks an exponentially weighted moving average of its read
+ * latency.  When enabled, a child's load (the number of I/Os it must get
+ * through before servicing a new one) is scaled by how much slower it is
+ * than the fastest readable child, which approximates the time until the
+ * new read completes.  Children of similar speed keep their unscaled load
+ * so they continue to share reads evenly.  Samples older than
+ * zfs_vdev_mirror_latency_stale_ms are ignored, and while any child has
+ * no recent sample reads are balanced by load alone.  This lets a child
+ * that was avoided be read from again and recover once it is fast again.
+ */
+static int zfs_vdev_mirror_latency_aware = 1;
+static uint_t zfs_vdev_mirror_latency_stale_ms = 1000;
+
+/* Weight of a new sample is 1 / (1 << VDEV_MIRROR_LAT_EWMA_SHIFT) */
+#define	VDEV_MIRROR_LAT_EWMA_SHIFT	3
+
 static inline size_t
 vdev_mirror_map_size(int children)
 {
@@ -437,6 +462,51 @@ vdev_mirror_close(vdev_t *vd)
 		vdev_close(vd->vdev_child[c]);
 }
 
+/*
+ * Fold a completed read's device latency into the child's moving average.
+ * Only leaf vdevs record a device access time (io_delay), reads that were
+ * satisfied by an aggregated I/O or failed are not sampled.
+ */
+static void
+vdev_mirror_lat_update(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	uint64_t ewma, delay;
+
+	if (zio->io_type != ZIO_TYPE_READ || zio->io_error != 0 ||
+	    zio->io_delay <= 0 || vd == NULL)
+		return;
+
+	delay = zio->io_delay;
+	ewma = vd->vdev_mirror_lat_ewma;
+	if (ewma == 0 || gethrtime() - vd->vdev_mirror_lat_ts >
+	    MSEC2NSEC(zfs_vdev_mirror_latency_stale_ms)) {
+		ewma = delay;
+	} else if (delay > ewma) {
+		ewma += (delay - ewma) >> VDEV_MIRROR_LAT_EWMA_SHIFT;
+	} else {
+		ewma -= (ewma - delay) >> VDEV_MIRROR_LAT_EWMA_SHIFT;
+	}
+	vd->vdev_mirror_lat_ewma = ewma;
+	vd->vdev_mirror_lat_ts = gethrtime();
+}
+
+/*
+ * Return the child's read latency average, or 0 when there is no recent
+ * sample to go by.
+ */
+static uint64_t
+vdev_mirror_lat(vdev_t *vd, hrtime_t now)
+{
+	uint64_t ewma = vd->vdev_mirror_lat_ewma;
+
+	if (ewma == 0 || now - vd->vdev_mirror_lat_ts >
+	    MSEC2NSEC(zfs_vdev_mirror_latency_stale_ms))
+		return (0);
+
+	return (ewma);
+}
+
 static void
 vdev_mirror_child_done(zio_t *zio)
 {
@@ -445,6 +515,8 @@ vdev_mirror_child_done(zio_t *zio)
 	mc->mc_error = zio->io_error;
 	mc->mc_tried = 1;
 	mc->mc_skipped = 0;
+
+	vdev_mirror_lat_update(zio);
 }
 
 /*
@@ -529,10 +601,37 @@ vdev_mirror_child_select(zio_t *zio)
 {
 	mirror_map_t *mm = zio->io_vsd;
 	uint64_t txg = zio->io_txg;
+	uint64_t lat, min_lat = UINT64_MAX;
+	hrtime_t now = gethrtime();
 	int c, lowest_load;
 
 	ASSERT(zio->io_bp == NULL || BP_PHYSICAL_BIRTH(zio->io_bp) == txg);
 
+	/*
+	 * Find the fastest child with a recent latency sample.  If any
+	 * child lacks one, latencies are ignored for this read: the children
+	 * then share reads by load alone, which is how the stale child gets
+	 * read from and sampled again.
+	 */
+	if (zfs_vdev_mirror_latency_aware && !mm->mm_root) {
+		for (c = 0; c < mm->mm_children; c++) {
+			mirror_child_t *mc = &mm->mm_child[c];
+
+			if (mc->mc_tried || mc->mc_skipped ||
+			    mc->mc_vd == NULL ||
+			    !mc->mc_vd->vdev_ops->vdev_op_leaf)
+				continue;
+
+			lat = vdev_mirror_lat(mc->mc_vd, now);
+			if (lat == 0) {
+				MIRROR_BUMP(vdev_mirror_stat_latency_stale);
+				min_lat = UINT64_MAX;
+				break;
+			}
+			min_lat = MIN(min_lat, lat);
+		}
+	}
+
 	lowest_load = INT_MAX;
 	mm->mm_preferred_cnt = 0;
 	for (c = 0; c < mm->mm_children; c++) {
@@ -564,6 +663,22 @@ vdev_mirror_child_select(zio_t *zio)
 		}
 
 		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset);
+
+		/*
+		 * Scale the load by the child's latency relative to the
+		 * fastest child, rounding down so that children of similar
+		 * speed keep the same load.
+		 */
+		if (min_lat != UINT64_MAX && mc->mc_load < INT_MAX &&
+		    (lat = vdev_mirror_lat(mc->mc_vd, now)) > min_lat) {
+			uint64_t load = ((uint64_t)mc->mc_load + 1) * lat /
+			    min_lat - 1;
+			if (load > mc->mc_load) {
+				MIRROR_BUMP(vdev_mirror_stat_latency_adjusted);
+				mc->mc_load = MIN(load, INT_MAX - 1);
+			}
+		}
+
 		if (mc->mc_load > lowest_load)
 			continue;
 
@@ -657,6 +772,10 @@ vdev_mirror_io_start(zio_t *zio)
 		 */
 		c = vdev_mirror_child_select(zio);
 		children = (c >= 0);
+		if (c >= 0) {
+			mc = &mm->mm_child[c];
+			atomic_inc_64(&mc->mc_vd->vdev_mirror_reads);
+		}
 	} else {
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
 
@@ -1038,3 +1157,9 @@ ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, non_rotating_inc, INT,
 
 ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, non_rotating_seek_inc, INT,
 	ZMOD_RW, "Non-rotating media load increment for seeking I/Os");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, latency_aware, INT,
+	ZMOD_RW, "Scale child load by relative read latency");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, latency_stale_ms, UINT,
+	ZMOD_RW, "Age in ms after which a child's read latency is re-sampled");
@@ -192,6 +192,18 @@ static uint_t zfs_vdev_nia_delay = 5;
  */
 static uint_t zfs_vdev_nia_credit = 5;
 
+/*
+ * Latency targets for the FIFO-ordered synchronous classes.  When the oldest
+ * queued I/O of such a class has waited longer than its deadline, that class
+ * is issued first, ahead of the min_active round-robin, and while it is at
+ * its max_active limit the other classes are held to their min_active so the
+ * device queue drains towards the overdue I/Os.  I/Os which complete more
+ * than the deadline after being queued are counted per vdev in the
+ * vdev_queue kstat.  A deadline of zero disables it for that class.
+ */
+static uint_t zfs_vdev_sync_read_deadline_ms = 100;
+static uint_t zfs_vdev_sync_write_deadline_ms = 100;
+
 /*
  * To reduce IOPs, we aggregate small adjacent I/Os into one large I/O.
  * For read I/Os, we also aggregate across small adjacency gaps; for writes
@@ -235,6 +247,16 @@ uint_t zfs_vdev_def_queue_depth = 32;
  */
 static uint_t zfs_vdev_aggregate_trim = 0;
 
+/*
+ * Issue I/O to non-rotating leaf vdevs directly when nothing is queued and
+ * the scheduler would issue it immediately anyway.  Only the minimal
+ * active accounting is done, skipping the queued trees and the aggregation
+ * search; with an empty queue there is nothing to aggregate with.  Once
+ * the device falls behind and I/Os start queueing, the normal scheduler
+ * takes over until the queue drains again.
+ */
+static uint_t zfs_vdev_queue_bypass = 1;
+
 static int
 vdev_queue_offset_compare(const void *x1, const void *x2)
 {
@@ -313,6 +335,47 @@ vdev_queue_class_min_active(vdev_queue_t *vq, zio_priority_t p)
 	}
 }
 
+static uint_t
+vdev_queue_class_deadline_ms(zio_priority_t p)
+{
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+		return (zfs_vdev_sync_read_deadline_ms);
+	case ZIO_PRIORITY_SYNC_WRITE:
+		return (zfs_vdev_sync_write_deadline_ms);
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Return the first class whose oldest queued i/o has been waiting longer
+ * than the class deadline.  Only FIFO classes have deadlines, so the oldest
+ * i/o is always the first one in the class tree.
+ */
+static zio_priority_t
+vdev_queue_class_overdue(vdev_queue_t *vq)
+{
+	hrtime_t now = 0;
+	zio_priority_t p;
+
+	for (p = ZIO_PRIORITY_SYNC_READ; p <= ZIO_PRIORITY_SYNC_WRITE; p++) {
+		uint_t deadline_ms = vdev_queue_class_deadline_ms(p);
+		zio_t *zio;
+
+		if (deadline_ms == 0 ||
+		    (zio = avl_first(vdev_queue_class_tree(vq, p))) == NULL)
+			continue;
+
+		if (now == 0)
+			now = gethrtime();
+		if (now - zio->io_timestamp >= MSEC2NSEC(deadline_ms))
+			return (p);
+	}
+
+	return (ZIO_PRIORITY_NUM_QUEUEABLE);
+}
+
 static uint_t
 vdev_queue_max_async_writes(spa_t *spa)
 {
@@ -416,10 +479,26 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 {
 	spa_t *spa = vq->vq_vdev->vdev_spa;
 	zio_priority_t p, n;
+	boolean_t overdue = B_FALSE;
 
 	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
 		return (ZIO_PRIORITY_NUM_QUEUEABLE);
 
+	/*
+	 * A queue whose oldest i/o has missed its deadline goes first.  If
+	 * it is already at its maximum, keep the other queues at their
+	 * minimum until it catches up.
+	 */
+	p = vdev_queue_class_overdue(vq);
+	if (p != ZIO_PRIORITY_NUM_QUEUEABLE) {
+		if (vq->vq_class[p].vqc_active <
+		    vdev_queue_class_max_active(spa, vq, p)) {
+			vq->vq_last_prio = p;
+			return (p);
+		}
+		overdue = B_TRUE;
+	}
+
 	/*
 	 * Find a queue that has not reached its minimum # outstanding i/os.
 	 * Do round-robin to reduce starvation due to zfs_vdev_max_active
@@ -435,6 +514,9 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 		}
 	}
 
+	if (overdue)
+		return (ZIO_PRIORITY_NUM_QUEUEABLE);
+
 	/*
 	 * If we haven't found a queue, look for one that hasn't reached its
 	 * maximum # outstanding i/os.
@@ -867,6 +949,36 @@ again:
 	return (zio);
 }
 
+/*
+ * Return true if the zio can skip the queue and be issued right away, see
+ * zfs_vdev_queue_bypass.  This must give the same answer as queueing the
+ * zio and calling vdev_queue_io_to_issue() when no other I/O is queued.
+ */
+static boolean_t
+vdev_queue_can_bypass(vdev_queue_t *vq, zio_t *zio)
+{
+	vdev_t *vd = vq->vq_vdev;
+	zio_priority_t p = zio->io_priority;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (!zfs_vdev_queue_bypass || !vd->vdev_nonrot ||
+	    (zio->io_flags & ZIO_FLAG_NODATA))
+		return (B_FALSE);
+
+	if (avl_numnodes(vdev_queue_type_tree(vq, ZIO_TYPE_READ)) != 0 ||
+	    avl_numnodes(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE)) != 0 ||
+	    avl_numnodes(vdev_queue_type_tree(vq, ZIO_TYPE_TRIM)) != 0)
+		return (B_FALSE);
+
+	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
+		return (B_FALSE);
+
+	return (vq->vq_class[p].vqc_active < vdev_queue_class_min_active(vq,
+	    p) || vq->vq_class[p].vqc_active <
+	    vdev_queue_class_max_active(vd->vdev_spa, vq, p));
+}
+
 zio_t *
 vdev_queue_io(zio_t *zio)
 {
@@ -911,6 +1023,13 @@ vdev_queue_io(zio_t *zio)
 	zio->io_timestamp = gethrtime();
 
 	mutex_enter(&vq->vq_lock);
+	if (vdev_queue_can_bypass(vq, zio)) {
+		vq->vq_last_prio = zio->io_priority;
+		vdev_queue_pending_add(vq, zio);
+		vq->vq_last_offset = zio->io_offset + zio->io_size;
+		mutex_exit(&vq->vq_lock);
+		return (zio);
+	}
 	vdev_queue_io_add(vq, zio);
 	nio = vdev_queue_io_to_issue(vq);
 	mutex_exit(&vq->vq_lock);
@@ -945,6 +1064,13 @@ vdev_queue_io_done(zio_t *zio)
 	mutex_enter(&vq->vq_lock);
 	vdev_queue_pending_remove(vq, zio);
 
+	uint_t deadline_ms = vdev_queue_class_deadline_ms(zio->io_priority);
+	if (deadline_ms != 0 && zio->io_delta > MSEC2NSEC(deadline_ms))
+		vq->vq_deadline_missed[zio->io_priority]++;
+	if (zio->io_priority == ZIO_PRIORITY_SYNC_READ ||
+	    zio->io_priority == ZIO_PRIORITY_SYNC_WRITE)
+		vq->vq_sync_lat_histo[L_HISTO(zio->io_delta)]++;
+
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
@@ -1033,6 +1159,30 @@ vdev_queue_last_offset(vdev_t *vd)
 	return (vd->vdev_queue.vq_last_offset);
 }
 
+/*
+ * Add the latencies of the synchronous I/Os completed by the leaves of vd
+ * since the last call into histo, and reset them.  This is how the scan
+ * watches foreground latency to throttle its own I/O, see
+ * scan_io_queue_qos_update().
+ */
+void
+vdev_queue_sync_lat_collect(vdev_t *vd, uint64_t *histo)
+{
+	for (uint64_t c = 0; c < vd->vdev_children; c++)
+		vdev_queue_sync_lat_collect(vd->vdev_child[c], histo);
+
+	if (!vd->vdev_ops->vdev_op_leaf)
+		return;
+
+	vdev_queue_t *vq = &vd->vdev_queue;
+	mutex_enter(&vq->vq_lock);
+	for (int i = 0; i < VDEV_L_HISTO_BUCKETS; i++) {
+		histo[i] += vq->vq_sync_lat_histo[i];
+		vq->vq_sync_lat_histo[i] = 0;
+	}
+	mutex_exit(&vq->vq_lock);
+}
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregation_limit, UINT, ZMOD_RW,
 	"Max vdev I/O aggregation size");
 
@@ -1042,6 +1192,9 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregation_limit_non_rotating, UINT,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregate_trim, UINT, ZMOD_RW,
 	"Allow TRIM I/O to be aggregated");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, queue_bypass, UINT, ZMOD_RW,
+	"Issue I/O to idle non-rotating vdevs without queueing");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, read_gap_limit, UINT, ZMOD_RW,
 	"Aggregate read I/O over gap");
 
@@ -1099,6 +1252,12 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_write_max_active, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_write_min_active, UINT, ZMOD_RW,
 	"Min active sync write I/Os per vdev");
 
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_read_deadline_ms, UINT, ZMOD_RW,
+	"Latency target for sync read I/Os in milliseconds");
+
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, sync_write_deadline_ms, UINT, ZMOD_RW,
+	"Latency target for sync write I/Os in milliseconds");
+
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, trim_max_active, UINT, ZMOD_RW,
 	"Max active trim/discard I/Os per vdev");
 
@@ -124,6 +124,18 @@ static uint64_t zfs_rebuild_max_segment = 1024 * 1024;
  */
 static uint64_t zfs_rebuild_vdev_limit = 32 << 20;
 
+/*
+ * Maximum number of workers used to rebuild a dRAID top-level vdev.  Each
+ * worker scans a different metaslab, which keeps the rebuild issue rate
+ * from being capped by a single thread on wide dRAID configurations.  One
+ * worker is started per redundancy group's worth of children, up to this
+ * limit.  All workers share the zfs_rebuild_vdev_limit in flight limit.
+ * Mirrors are always rebuilt by a single worker to keep their I/O
+ * sequential.  Values above REBUILD_MAX_WORKERS are treated as that many.
+ */
+#define	REBUILD_MAX_WORKERS	64
+static uint_t zfs_rebuild_max_workers = 8;
+
 /*
  * Automatically start a pool scrub when the last active sequential resilver
  * completes in order to verify the checksums of all blocks which have been
@@ -484,19 +496,28 @@ vdev_rebuild_cb(zio_t *zio)
 	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
 	vdev_t *vd = vr->vr_top_vdev;
 
-	mutex_enter(&vr->vr_io_lock);
 	if (zio->io_error == ENXIO && !vdev_writeable(vd)) {
 		/*
 		 * The I/O failed because the top-level vdev was unavailable.
 		 * Attempt to roll back to the last completed offset, in order
 		 * resume from the correct location if the pool is resumed.
 		 * (This works because spa_sync waits on spa_txg_zio before
-		 * it runs sync tasks.)
+		 * it runs sync tasks.)  With several workers a later txg may
+		 * already record an offset past this I/O, so clamp every
+		 * pending txg from this one on.
 		 */
-		uint64_t *off = &vr->vr_scan_offset[zio->io_txg & TXG_MASK];
-		*off = MIN(*off, zio->io_offset);
-	} else if (zio->io_error) {
-		vrp->vrp_errors++;
+		mutex_enter(&vd->vdev_rebuild_lock);
+		for (uint64_t txg = zio->io_txg; txg <= vr->vr_scan_txg &&
+		    txg < zio->io_txg + TXG_SIZE; txg++) {
+			uint64_t *off = &vr->vr_scan_offset[txg & TXG_MASK];
+			*off = MIN(*off, zio->io_offset);
+		}
+		mutex_exit(&vd->vdev_rebuild_lock);
+		mutex_enter(&vr->vr_io_lock);
+	} else {
+		mutex_enter(&vr->vr_io_lock);
+		if (zio->io_error)
+			vrp->vrp_errors++;
 	}
 
 	abd_free(zio->io_abd);
@@ -543,15 +564,41 @@ vdev_rebuild_blkptr_init(blkptr_t *bp, vdev_t *vd, uint64_t start,
 	BP_SET_BYTEORDER(bp, ZFS_HOST_BYTEORDER);
 }
 
+/*
+ * Returns the offset below which all rebuild I/O has been issued.  Since
+ * metaslabs are handed out to the workers in order this is the lowest
+ * offset any active worker has yet to issue, or the start of the next
+ * metaslab to be scanned when no worker is behind it.
+ */
+static uint64_t
+vdev_rebuild_issued_offset(vdev_rebuild_t *vr)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	uint64_t offset = vr->vr_next_ms << vd->vdev_ms_shift;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_rebuild_lock));
+
+	for (int i = 0; i < vr->vr_nworkers; i++) {
+		vdev_rebuild_worker_t *vrw = &vr->vr_workers[i];
+
+		if (vrw->vrw_active)
+			offset = MIN(offset, vrw->vrw_offset);
+	}
+
+	return (offset);
+}
+
 /*
  * Issues a rebuild I/O and takes care of rate limiting the number of queued
  * rebuild I/Os.  The provided start and size must be properly aligned for the
- * top-level vdev type being rebuilt.
+ * top-level vdev type being rebuilt.  The in flight limit is shared by all
+ * of the workers rebuilding the top-level vdev.
  */
 static int
-vdev_rebuild_range(vdev_rebuild_t *vr, uint64_t start, uint64_t size)
+vdev_rebuild_range(vdev_rebuild_worker_t *vrw, uint64_t start, uint64_t size)
 {
-	uint64_t ms_id __maybe_unused = vr->vr_scan_msp->ms_id;
+	vdev_rebuild_t *vr = vrw->vrw_rebuild;
+	uint64_t ms_id __maybe_unused = vrw->vrw_scan_msp->ms_id;
 	vdev_t *vd = vr->vr_top_vdev;
 	spa_t *spa = vd->vdev_spa;
 	blkptr_t blk;
@@ -559,8 +606,10 @@ vdev_rebuild_range(vdev_rebuild_t *vr, uint64_t start, uint64_t size)
 	ASSERT3U(ms_id, ==, start >> vd->vdev_ms_shift);
 	ASSERT3U(ms_id, ==, (start + size - 1) >> vd->vdev_ms_shift);
 
+	mutex_enter(&vd->vdev_rebuild_lock);
 	vr->vr_pass_bytes_scanned += size;
 	vr->vr_rebuild_phys.vrp_bytes_scanned += size;
+	mutex_exit(&vd->vdev_rebuild_lock);
 
 	/*
 	 * Rebuild the data in this range by constructing a special block
@@ -590,9 +639,15 @@ vdev_rebuild_range(vdev_rebuild_t *vr, uint64_t start, uint64_t size)
 	spa_config_enter(spa, SCL_STATE_ALL, vd, RW_READER);
 	mutex_enter(&vd->vdev_rebuild_lock);
 
-	/* This is the first I/O for this txg. */
-	if (vr->vr_scan_offset[txg & TXG_MASK] == 0) {
-		vr->vr_scan_offset[txg & TXG_MASK] = start;
+	/*
+	 * This is the first I/O for this txg.  The issued offset can't be
+	 * used to tell, as it is legitimately 0 until the worker for the
+	 * first metaslab issues anything.
+	 */
+	if (txg > vr->vr_scan_txg) {
+		vr->vr_scan_txg = txg;
+		vr->vr_scan_offset[txg & TXG_MASK] =
+		    vdev_rebuild_issued_offset(vr);
 		dsl_sync_task_nowait(spa_get_dsl(spa),
 		    vdev_rebuild_update_sync,
 		    (void *)(uintptr_t)vd->vdev_id, tx);
@@ -608,36 +663,48 @@ vdev_rebuild_range(vdev_rebuild_t *vr, uint64_t start, uint64_t size)
 		dmu_tx_commit(tx);
 		return (SET_ERROR(EINTR));
 	}
-	mutex_exit(&vd->vdev_rebuild_lock);
-	dmu_tx_commit(tx);
 
-	vr->vr_scan_offset[txg & TXG_MASK] = start + size;
+	/*
+	 * Only record progress in the newest txg any worker has issued I/O
+	 * to.  Another worker may already have issued I/O below this
+	 * worker's offset in a later txg, which must not be considered
+	 * rebuilt when this older txg syncs.  The I/O is issued before the
+	 * tx is committed so the txg cannot sync before it has been added
+	 * to spa_txg_zio.
+	 */
+	vrw->vrw_offset = start + size;
+	if (txg == vr->vr_scan_txg) {
+		vr->vr_scan_offset[txg & TXG_MASK] =
+		    vdev_rebuild_issued_offset(vr);
+	}
 	vr->vr_pass_bytes_issued += size;
 	vr->vr_rebuild_phys.vrp_bytes_issued += size;
+	mutex_exit(&vd->vdev_rebuild_lock);
 
 	zio_nowait(zio_read(spa->spa_txg_zio[txg & TXG_MASK], spa, &blk,
 	    abd_alloc(psize, B_FALSE), psize, vdev_rebuild_cb, vr,
 	    ZIO_PRIORITY_REBUILD, ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL |
 	    ZIO_FLAG_RESILVER, NULL));
+	dmu_tx_commit(tx);
 
 	return (0);
 }
 
 /*
- * Issues rebuild I/Os for all ranges in the provided vr->vr_tree range tree.
+ * Issues rebuild I/Os for all ranges in the worker's vrw_scan_tree.
  */
 static int
-vdev_rebuild_ranges(vdev_rebuild_t *vr)
+vdev_rebuild_ranges(vdev_rebuild_worker_t *vrw)
 {
-	vdev_t *vd = vr->vr_top_vdev;
-	zfs_btree_t *t = &vr->vr_scan_tree->rt_root;
+	vdev_t *vd = vrw->vrw_rebuild->vr_top_vdev;
+	zfs_btree_t *t = &vrw->vrw_scan_tree->rt_root;
 	zfs_btree_index_t idx;
 	int error;
 
 	for (range_seg_t *rs = zfs_btree_first(t, &idx); rs != NULL;
 	    rs = zfs_btree_next(t, &idx, &idx)) {
-		uint64_t start = rs_get_start(rs, vr->vr_scan_tree);
-		uint64_t size = rs_get_end(rs, vr->vr_scan_tree) - start;
+		uint64_t start = rs_get_start(rs, vrw->vrw_scan_tree);
+		uint64_t size = rs_get_end(rs, vrw->vrw_scan_tree) - start;
 
 		/*
 		 * zfs_scan_suspend_progress can be set to disable rebuild
@@ -660,7 +727,7 @@ vdev_rebuild_ranges(vdev_rebuild_t *vr)
 			chunk_size = vd->vdev_ops->vdev_op_rebuild_asize(vd,
 			    start, size, zfs_rebuild_max_segment);
 
-			error = vdev_rebuild_range(vr, start, chunk_size);
+			error = vdev_rebuild_range(vrw, start, chunk_size);
 			if (error != 0)
 				return (error);
 
@@ -746,80 +813,121 @@ vdev_rebuild_load(vdev_t *vd)
 }
 
 /*
- * Each scan thread is responsible for rebuilding a top-level vdev.  The
- * rebuild progress in tracked on-disk in VDEV_TOP_ZAP_VDEV_REBUILD_PHYS.
+ * Returns the number of workers used to rebuild a top-level vdev.  The
+ * redundancy groups of a dRAID vdev are spread across all of its children,
+ * so it gets one worker per group's worth of children.
  */
-static __attribute__((noreturn)) void
-vdev_rebuild_thread(void *arg)
+static int
+vdev_rebuild_nworkers(vdev_t *vd)
 {
-	vdev_t *vd = arg;
-	spa_t *spa = vd->vdev_spa;
-	int error = 0;
+	uint64_t nworkers = 1;
+
+	if (vd->vdev_ops == &vdev_draid_ops) {
+		vdev_draid_config_t *vdc = vd->vdev_tsd;
+
+		nworkers = vdc->vdc_ndisks / vdc->vdc_groupwidth;
+	}
 
 	/*
-	 * If there's a scrub in process request that it be stopped.  This
-	 * is not required for a correct rebuild, but we do want rebuilds to
-	 * emulate the resilver behavior as much as possible.
+	 * Each worker disables the metaslab it is scanning, leave most of
+	 * the metaslabs on small vdevs available for allocation.
 	 */
-	dsl_pool_t *dsl = spa_get_dsl(spa);
-	if (dsl_scan_scrubbing(dsl))
-		dsl_scan_cancel(dsl);
+	nworkers = MIN(nworkers, MIN(zfs_rebuild_max_workers,
+	    REBUILD_MAX_WORKERS));
+	nworkers = MIN(nworkers, vd->vdev_ms_count / 4);
+
+	return (MAX(nworkers, 1));
+}
+
+/*
+ * Hands the next metaslab to be scanned to a worker.  Returns NULL when
+ * every metaslab has been handed out or the rebuild has been stopped.
+ */
+static metaslab_t *
+vdev_rebuild_next_metaslab(vdev_rebuild_worker_t *vrw)
+{
+	vdev_rebuild_t *vr = vrw->vrw_rebuild;
+	vdev_t *vd = vr->vr_top_vdev;
+	metaslab_t *msp;
+	boolean_t update_est = B_FALSE;
+	uint64_t est_ms_id = 0;
 
-	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
 	mutex_enter(&vd->vdev_rebuild_lock);
+	vrw->vrw_active = B_FALSE;
+	vrw->vrw_scan_msp = NULL;
 
-	ASSERT3P(vd->vdev_top, ==, vd);
-	ASSERT3P(vd->vdev_rebuild_thread, !=, NULL);
-	ASSERT(vd->vdev_rebuilding);
-	ASSERT(spa_feature_is_active(spa, SPA_FEATURE_DEVICE_REBUILD));
-	ASSERT3B(vd->vdev_rebuild_cancel_wanted, ==, B_FALSE);
+	if (vr->vr_error != 0 || vr->vr_next_ms >= vd->vdev_ms_count) {
+		mutex_exit(&vd->vdev_rebuild_lock);
+		return (NULL);
+	}
 
-	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
-	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
-	vr->vr_top_vdev = vd;
-	vr->vr_scan_msp = NULL;
-	vr->vr_scan_tree = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
-	mutex_init(&vr->vr_io_lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&vr->vr_io_cv, NULL, CV_DEFAULT, NULL);
+	/*
+	 * Removal of vdevs from the vdev tree may eliminate the need
+	 * for the rebuild, in which case it should be canceled.  The
+	 * vdev_rebuild_cancel_wanted flag is set until the sync task
+	 * completes.  This may be after the rebuild thread exits.
+	 */
+	if (vdev_rebuild_should_cancel(vd)) {
+		vd->vdev_rebuild_cancel_wanted = B_TRUE;
+		vr->vr_error = SET_ERROR(EINTR);
+		mutex_exit(&vd->vdev_rebuild_lock);
+		return (NULL);
+	}
 
-	vr->vr_pass_start_time = gethrtime();
-	vr->vr_pass_bytes_scanned = 0;
-	vr->vr_pass_bytes_issued = 0;
+	msp = vd->vdev_ms[vr->vr_next_ms++];
+	vrw->vrw_scan_msp = msp;
+	vrw->vrw_offset = MAX(msp->ms_start,
+	    vr->vr_rebuild_phys.vrp_last_offset);
+	vrw->vrw_active = B_TRUE;
 
-	vr->vr_bytes_inflight_max = MAX(1ULL << 20,
-	    zfs_rebuild_vdev_limit * vd->vdev_children);
+	/*
+	 * To provide an accurate estimate re-calculate the estimated
+	 * size every 5 minutes to account for recent allocations and
+	 * frees made to space maps which have not yet been rebuilt.
+	 */
+	if (gethrtime() > vr->vr_update_est_time + SEC2NSEC(300)) {
+		vr->vr_update_est_time = gethrtime();
+		est_ms_id = MIN(msp->ms_id,
+		    vdev_rebuild_issued_offset(vr) >> vd->vdev_ms_shift);
+		update_est = B_TRUE;
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
 
-	uint64_t update_est_time = gethrtime();
-	vdev_rebuild_update_bytes_est(vd, 0);
+	if (update_est)
+		vdev_rebuild_update_bytes_est(vd, est_ms_id);
 
-	clear_rebuild_bytes(vr->vr_top_vdev);
+	return (msp);
+}
 
-	mutex_exit(&vd->vdev_rebuild_lock);
+/*
+ * Each rebuild worker repeatedly takes the next metaslab to be scanned and
+ * issues rebuild I/Os for all of its allocated ranges.  Because metaslabs
+ * are handed out in order the workers together still walk the vdev in
+ * roughly LBA order.
+ */
+static void
+vdev_rebuild_worker(void *arg)
+{
+	vdev_rebuild_worker_t *vrw = arg;
+	vdev_rebuild_t *vr = vrw->vrw_rebuild;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	vdev_t *vd = vr->vr_top_vdev;
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dsl = spa_get_dsl(spa);
+	metaslab_t *msp;
+	int error = 0;
+
+	spa_config_enter(spa, SCL_CONFIG, vrw, RW_READER);
 
 	/*
 	 * Systematically walk the metaslabs and issue rebuild I/Os for
 	 * all ranges in the allocated space map.
 	 */
-	for (uint64_t i = 0; i < vd->vdev_ms_count; i++) {
-		metaslab_t *msp = vd->vdev_ms[i];
-		vr->vr_scan_msp = msp;
-
-		/*
-		 * Removal of vdevs from the vdev tree may eliminate the need
-		 * for the rebuild, in which case it should be canceled.  The
-		 * vdev_rebuild_cancel_wanted flag is set until the sync task
-		 * completes.  This may be after the rebuild thread exits.
-		 */
-		if (vdev_rebuild_should_cancel(vd)) {
-			vd->vdev_rebuild_cancel_wanted = B_TRUE;
-			error = EINTR;
-			break;
-		}
-
-		ASSERT0(range_tree_space(vr->vr_scan_tree));
+	while ((msp = vdev_rebuild_next_metaslab(vrw)) != NULL) {
+		ASSERT0(range_tree_space(vrw->vrw_scan_tree));
 
 		/* Disable any new allocations to this metaslab */
-		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		spa_config_exit(spa, SCL_CONFIG, vrw);
 		metaslab_disable(msp);
 
 		mutex_enter(&msp->ms_sync_lock);
@@ -843,13 +951,13 @@ vdev_rebuild_thread(void *arg)
 
 		/*
 		 * When a metaslab has been allocated from read its allocated
-		 * ranges from the space map object into the vr_scan_tree.
+		 * ranges from the space map object into the vrw_scan_tree.
 		 * Then add inflight / unflushed ranges and remove inflight /
 		 * unflushed frees.  This is the minimum range to be rebuilt.
 		 */
 		if (msp->ms_sm != NULL) {
 			VERIFY0(space_map_load(msp->ms_sm,
-			    vr->vr_scan_tree, SM_ALLOC));
+			    vrw->vrw_scan_tree, SM_ALLOC));
 
 			for (int i = 0; i < TXG_SIZE; i++) {
 				ASSERT0(range_tree_space(
@@ -857,48 +965,137 @@ vdev_rebuild_thread(void *arg)
 			}
 
 			range_tree_walk(msp->ms_unflushed_allocs,
-			    range_tree_add, vr->vr_scan_tree);
+			    range_tree_add, vrw->vrw_scan_tree);
 			range_tree_walk(msp->ms_unflushed_frees,
-			    range_tree_remove, vr->vr_scan_tree);
+			    range_tree_remove, vrw->vrw_scan_tree);
 
 			/*
 			 * Remove ranges which have already been rebuilt based
 			 * on the last offset.  This can happen when restarting
 			 * a scan after exporting and re-importing the pool.
 			 */
-			range_tree_clear(vr->vr_scan_tree, 0,
+			range_tree_clear(vrw->vrw_scan_tree, 0,
 			    vrp->vrp_last_offset);
 		}
 
 		mutex_exit(&msp->ms_lock);
 		mutex_exit(&msp->ms_sync_lock);
 
-		/*
-		 * To provide an accurate estimate re-calculate the estimated
-		 * size every 5 minutes to account for recent allocations and
-		 * frees made to space maps which have not yet been rebuilt.
-		 */
-		if (gethrtime() > update_est_time + SEC2NSEC(300)) {
-			update_est_time = gethrtime();
-			vdev_rebuild_update_bytes_est(vd, i);
-		}
-
 		/*
 		 * Walk the allocated space map and issue the rebuild I/O.
 		 */
-		error = vdev_rebuild_ranges(vr);
-		range_tree_vacate(vr->vr_scan_tree, NULL, NULL);
+		error = vdev_rebuild_ranges(vrw);
+		range_tree_vacate(vrw->vrw_scan_tree, NULL, NULL);
 
-		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+		spa_config_enter(spa, SCL_CONFIG, vrw, RW_READER);
 		metaslab_enable(msp, B_FALSE, B_FALSE);
 
-		if (error != 0)
+		/*
+		 * Stop handing out metaslabs.  The worker is left active so
+		 * its offset continues to bound the recorded progress.
+		 */
+		if (error != 0) {
+			mutex_enter(&vd->vdev_rebuild_lock);
+			if (vr->vr_error == 0)
+				vr->vr_error = error;
+			mutex_exit(&vd->vdev_rebuild_lock);
 			break;
+		}
 	}
 
-	range_tree_destroy(vr->vr_scan_tree);
+	spa_config_exit(spa, SCL_CONFIG, vrw);
+}
+
+/*
+ * Each scan thread is responsible for rebuilding a top-level vdev.  The
+ * rebuild progress in tracked on-disk in VDEV_TOP_ZAP_VDEV_REBUILD_PHYS.
+ * The metaslabs are scanned by a taskq of vdev_rebuild_worker()s.
+ */
+static __attribute__((noreturn)) void
+vdev_rebuild_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	int error = 0;
+
+	/*
+	 * If there's a scrub in process request that it be stopped.  This
+	 * is not required for a correct rebuild, but we do want rebuilds to
+	 * emulate the resilver behavior as much as possible.
+	 */
+	dsl_pool_t *dsl = spa_get_dsl(spa);
+	if (dsl_scan_scrubbing(dsl))
+		dsl_scan_cancel(dsl);
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	ASSERT3P(vd->vdev_top, ==, vd);
+	ASSERT3P(vd->vdev_rebuild_thread, !=, NULL);
+	ASSERT(vd->vdev_rebuilding);
+	ASSERT(spa_feature_is_active(spa, SPA_FEATURE_DEVICE_REBUILD));
+	ASSERT3B(vd->vdev_rebuild_cancel_wanted, ==, B_FALSE);
+
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	vr->vr_top_vdev = vd;
+	vr->vr_next_ms = 0;
+	vr->vr_error = 0;
+	vr->vr_scan_txg = 0;
+	mutex_init(&vr->vr_io_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vr->vr_io_cv, NULL, CV_DEFAULT, NULL);
+
+	vr->vr_nworkers = vdev_rebuild_nworkers(vd);
+	vr->vr_workers = kmem_zalloc(vr->vr_nworkers *
+	    sizeof (vdev_rebuild_worker_t), KM_SLEEP);
+	for (int i = 0; i < vr->vr_nworkers; i++) {
+		vdev_rebuild_worker_t *vrw = &vr->vr_workers[i];
+
+		vrw->vrw_rebuild = vr;
+		vrw->vrw_scan_tree = range_tree_create(NULL, RANGE_SEG64,
+		    NULL, 0, 0);
+	}
+
+	vr->vr_pass_start_time = gethrtime();
+	vr->vr_pass_bytes_scanned = 0;
+	vr->vr_pass_bytes_issued = 0;
+
+	vr->vr_bytes_inflight_max = MAX(1ULL << 20,
+	    zfs_rebuild_vdev_limit * vd->vdev_children);
+
+	vr->vr_update_est_time = gethrtime();
+	vdev_rebuild_update_bytes_est(vd, 0);
+
+	clear_rebuild_bytes(vr->vr_top_vdev);
+
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	/*
+	 * The workers take SCL_CONFIG themselves, it must not be held here
+	 * while waiting for them or a pending writer would deadlock.
+	 */
 	spa_config_exit(spa, SCL_CONFIG, FTAG);
 
+	taskq_t *tq = taskq_create("z_rebuild", vr->vr_nworkers, maxclsyspri,
+	    vr->vr_nworkers, vr->vr_nworkers, TASKQ_PREPOPULATE);
+	for (int i = 0; i < vr->vr_nworkers; i++) {
+		VERIFY(taskq_dispatch(tq, vdev_rebuild_worker,
+		    &vr->vr_workers[i], TQ_SLEEP) != TASKQID_INVALID);
+	}
+	taskq_wait(tq);
+	taskq_destroy(tq);
+
+	error = vr->vr_error;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	for (int i = 0; i < vr->vr_nworkers; i++)
+		range_tree_destroy(vr->vr_workers[i].vrw_scan_tree);
+	kmem_free(vr->vr_workers, vr->vr_nworkers *
+	    sizeof (vdev_rebuild_worker_t));
+	vr->vr_workers = NULL;
+	vr->vr_nworkers = 0;
+	mutex_exit(&vd->vdev_rebuild_lock);
+
 	/* Wait for any remaining rebuild I/O to complete */
 	mutex_enter(&vr->vr_io_lock);
 	while (vr->vr_bytes_inflight > 0)
@@ -1156,5 +1353,8 @@ ZFS_MODULE_PARAM(zfs, zfs_, rebuild_max_segment, U64, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs, zfs_, rebuild_vdev_limit, U64, ZMOD_RW,
 	"Max bytes in flight per leaf vdev for sequential resilvers");
 
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_max_workers, UINT, ZMOD_RW,
+	"Max number of workers rebuilding a dRAID top-level vdev");
+
 ZFS_MODULE_PARAM(zfs, zfs_, rebuild_scrub_enabled, INT, ZMOD_RW,
 	"Automatically scrub after sequential resilver completes");
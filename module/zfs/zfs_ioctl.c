@@ -204,6 +204,8 @@
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_bookmark.h>
 #include <sys/dsl_userhold.h>
+#include <sys/dsl_rewrite.h>
+#include <sys/ddt.h>
 #include <sys/zfeature.h>
 #include <sys/zcp.h>
 #include <sys/zio_checksum.h>
@@ -1678,6 +1680,11 @@ zfs_ioc_pool_scan(zfs_cmd_t *zc)
 		error = spa_scrub_pause_resume(spa, POOL_SCRUB_PAUSE);
 	else if (zc->zc_cookie == POOL_SCAN_NONE)
 		error = spa_scan_stop(spa);
+	else if (zc->zc_flags == POOL_SCRUB_FROM_LAST_TXG &&
+	    zc->zc_cookie == POOL_SCAN_SCRUB)
+		error = spa_scan_from_last_txg(spa);
+	else if (zc->zc_flags == POOL_SCRUB_FROM_LAST_TXG)
+		error = SET_ERROR(EINVAL);
 	else
 		error = spa_scan(spa, zc->zc_cookie);
 
@@ -4245,6 +4252,76 @@ zfs_ioc_wait(const char *name, nvlist_t *innvl, nvlist_t *outnvl)
 	return (error);
 }
 
+/*
+ * Start or stop rewriting the blocks of a filesystem or volume in the
+ * background.
+ *
+ * innvl: {
+ *     "rewrite_command" -> uint64_t	(zfs_rewrite_func_t)
+ * }
+ *
+ * outnvl: empty
+ */
+static const zfs_ioc_key_t zfs_keys_rewrite[] = {
+	{ZFS_REWRITE_COMMAND,	DATA_TYPE_UINT64,		0},
+};
+
+static int
+zfs_ioc_rewrite(const char *name, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	(void) outnvl;
+	uint64_t cmd;
+
+	if (nvlist_lookup_uint64(innvl, ZFS_REWRITE_COMMAND, &cmd) != 0)
+		return (SET_ERROR(EINVAL));
+
+	switch (cmd) {
+	case ZFS_REWRITE_START:
+		return (dsl_rewrite_start(name));
+	case ZFS_REWRITE_STOP:
+		return (dsl_rewrite_stop(name));
+	default:
+		return (SET_ERROR(EINVAL));
+	}
+}
+
+/*
+ * Remove the unique entries of blocks written more than the given number of
+ * days ago from the dedup tables of a pool.
+ *
+ * innvl: {
+ *     "ddt_prune_days" -> uint64_t
+ * }
+ *
+ * outnvl: empty
+ */
+static const zfs_ioc_key_t zfs_keys_ddt_prune[] = {
+	{DDT_PRUNE_DAYS,	DATA_TYPE_UINT64,		0},
+};
+
+static int
+zfs_ioc_ddt_prune(const char *poolname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	(void) outnvl;
+	uint64_t days;
+	spa_t *spa;
+	int error;
+
+	if (nvlist_lookup_uint64(innvl, DDT_PRUNE_DAYS, &days) != 0)
+		return (SET_ERROR(EINVAL));
+	if (days > DDT_PRUNE_DAYS_MAX)
+		return (SET_ERROR(EINVAL));
+
+	if ((error = spa_open(poolname, &spa, FTAG)) != 0)
+		return (error);
+
+	error = ddt_prune_unique_entries(spa, days);
+
+	spa_close(spa, FTAG);
+
+	return (error);
+}
+
 /*
  * This ioctl waits for activity of a particular type to complete. If there is
  * no activity of that type in progress, it returns immediately, and the
@@ -5524,6 +5601,9 @@ zfs_ioc_send(zfs_cmd_t *zc)
 	boolean_t compressok = (zc->zc_flags & 0x4);
 	boolean_t rawok = (zc->zc_flags & 0x8);
 	boolean_t savedok = (zc->zc_flags & 0x10);
+	enum zio_compress stream_compress = (zc->zc_flags & 0x20) ?
+	    ZIO_COMPRESS_LZ4 : (zc->zc_flags & 0x40) ?
+	    ZIO_COMPRESS_ZSTD : ZIO_COMPRESS_OFF;
 
 	if (zc->zc_obj != 0) {
 		dsl_pool_t *dp;
@@ -5592,7 +5672,7 @@ zfs_ioc_send(zfs_cmd_t *zc)
 		out.dso_dryrun = B_FALSE;
 		error = dmu_send_obj(zc->zc_name, zc->zc_sendobj,
 		    zc->zc_fromobj, embedok, large_block_ok, compressok,
-		    rawok, savedok, zc->zc_cookie, &off, &out);
+		    rawok, savedok, stream_compress, zc->zc_cookie, &off, &out);
 
 		zfs_file_put(fp);
 	}
@@ -6513,6 +6593,9 @@ zfs_ioc_space_snaps(const char *lastsnap, nvlist_t *innvl, nvlist_t *outnvl)
  *         presence indicates raw encrypted records should be used.
  *     (optional) "savedok" -> (value ignored)
  *         presence indicates we should send a partially received snapshot
+ *     (optional) "stream_compress" -> (uint64)
+ *         ZIO_COMPRESS_LZ4 or ZIO_COMPRESS_ZSTD; compress the payloads of
+ *         WRITE records which would otherwise be sent uncompressed
  *     (optional) "resume_object" and "resume_offset" -> (uint64)
  *         if present, resume send stream from specified object and offset.
  *     (optional) "redactbook" -> (string)
@@ -6530,6 +6613,7 @@ static const zfs_ioc_key_t zfs_keys_send_new[] = {
 	{"compressok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
 	{"rawok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
 	{"savedok",		DATA_TYPE_BOOLEAN,	ZK_OPTIONAL},
+	{"stream_compress",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
 	{"resume_object",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
 	{"resume_offset",	DATA_TYPE_UINT64,	ZK_OPTIONAL},
 	{"redactbook",		DATA_TYPE_STRING,	ZK_OPTIONAL},
@@ -6549,6 +6633,7 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	boolean_t compressok;
 	boolean_t rawok;
 	boolean_t savedok;
+	uint64_t stream_compress = ZIO_COMPRESS_OFF;
 	uint64_t resumeobj = 0;
 	uint64_t resumeoff = 0;
 	char *redactbook = NULL;
@@ -6563,6 +6648,12 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	rawok = nvlist_exists(innvl, "rawok");
 	savedok = nvlist_exists(innvl, "savedok");
 
+	(void) nvlist_lookup_uint64(innvl, "stream_compress", &stream_compress);
+	if (stream_compress != ZIO_COMPRESS_OFF &&
+	    stream_compress != ZIO_COMPRESS_LZ4 &&
+	    stream_compress != ZIO_COMPRESS_ZSTD)
+		return (SET_ERROR(EINVAL));
+
 	(void) nvlist_lookup_uint64(innvl, "resume_object", &resumeobj);
 	(void) nvlist_lookup_uint64(innvl, "resume_offset", &resumeoff);
 
@@ -6578,7 +6669,7 @@ zfs_ioc_send_new(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 	out.dso_arg = fp;
 	out.dso_dryrun = B_FALSE;
 	error = dmu_send(snapname, fromname, embedok, largeblockok,
-	    compressok, rawok, savedok, resumeobj, resumeoff,
+	    compressok, rawok, savedok, stream_compress, resumeobj, resumeoff,
 	    redactbook, fd, &off, &out);
 
 	zfs_file_put(fp);
@@ -6746,8 +6837,8 @@ zfs_ioc_send_space(const char *snapname, nvlist_t *innvl, nvlist_t *outnvl)
 		dsl_dataset_rele(tosnap, FTAG);
 		dsl_pool_rele(dp, FTAG);
 		error = dmu_send(snapname, fromname, embedok, largeblockok,
-		    compressok, rawok, savedok, resumeobj, resumeoff,
-		    redactlist_book, fd, &off, &out);
+		    compressok, rawok, savedok, ZIO_COMPRESS_OFF, resumeobj,
+		    resumeoff, redactlist_book, fd, &off, &out);
 	} else {
 		error = dmu_send_estimate_fast(tosnap, fromsnap,
 		    (from && strchr(fromname, '#') != NULL ? &zbm : NULL),
@@ -7205,6 +7296,16 @@ zfs_ioctl_init(void)
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_FALSE,
 	    zfs_keys_fs_wait, ARRAY_SIZE(zfs_keys_fs_wait));
 
+	zfs_ioctl_register("rewrite", ZFS_IOC_REWRITE,
+	    zfs_ioc_rewrite, zfs_secpolicy_config, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_TRUE,
+	    zfs_keys_rewrite, ARRAY_SIZE(zfs_keys_rewrite));
+
+	zfs_ioctl_register("ddt_prune", ZFS_IOC_DDT_PRUNE,
+	    zfs_ioc_ddt_prune, zfs_secpolicy_config, POOL_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_TRUE, B_TRUE,
+	    zfs_keys_ddt_prune, ARRAY_SIZE(zfs_keys_ddt_prune));
+
 	zfs_ioctl_register("set_bootenv", ZFS_IOC_SET_BOOTENV,
 	    zfs_ioc_set_bootenv, zfs_secpolicy_config, POOL_NAME,
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_TRUE,
@@ -3186,7 +3186,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 			if (psize != zio->io_size)
 				return (B_TRUE);
 
-			ddt_exit(ddt);
+			ddt_exit(ddt, &dde->dde_key);
 
 			tmpabd = abd_alloc_for_io(psize, B_TRUE);
 
@@ -3201,7 +3201,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 			}
 
 			abd_free(tmpabd);
-			ddt_enter(ddt);
+			ddt_enter(ddt, &dde->dde_key);
 			return (error != 0);
 		} else if (ddp->ddp_phys_birth != 0) {
 			arc_buf_t *abuf = NULL;
@@ -3214,7 +3214,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 			if (BP_GET_LSIZE(&blk) != zio->io_orig_size)
 				return (B_TRUE);
 
-			ddt_exit(ddt);
+			ddt_exit(ddt, &dde->dde_key);
 
 			error = arc_read(NULL, spa, &blk,
 			    arc_getbuf_func, &abuf, ZIO_PRIORITY_SYNC_READ,
@@ -3228,7 +3228,7 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 				arc_buf_destroy(abuf, &abuf);
 			}
 
-			ddt_enter(ddt);
+			ddt_enter(ddt, &dde->dde_key);
 			return (error != 0);
 		}
 	}
@@ -3248,7 +3248,7 @@ zio_ddt_child_write_ready(zio_t *zio)
 	if (zio->io_error)
 		return;
 
-	ddt_enter(ddt);
+	ddt_enter(ddt, &dde->dde_key);
 
 	ASSERT(dde->dde_lead_zio[p] == zio);
 
@@ -3258,7 +3258,7 @@ zio_ddt_child_write_ready(zio_t *zio)
 	while ((pio = zio_walk_parents(zio, &zl)) != NULL)
 		ddt_bp_fill(ddp, pio->io_bp, zio->io_txg);
 
-	ddt_exit(ddt);
+	ddt_exit(ddt, &dde->dde_key);
 }
 
 static void
@@ -3269,7 +3269,7 @@ zio_ddt_child_write_done(zio_t *zio)
 	ddt_entry_t *dde = zio->io_private;
 	ddt_phys_t *ddp = &dde->dde_phys[p];
 
-	ddt_enter(ddt);
+	ddt_enter(ddt, &dde->dde_key);
 
 	ASSERT(ddp->ddp_refcnt == 0);
 	ASSERT(dde->dde_lead_zio[p] == zio);
@@ -3283,7 +3283,7 @@ zio_ddt_child_write_done(zio_t *zio)
 		ddt_phys_clear(ddp);
 	}
 
-	ddt_exit(ddt);
+	ddt_exit(ddt, &dde->dde_key);
 }
 
 static zio_t *
@@ -3298,16 +3298,33 @@ zio_ddt_write(zio_t *zio)
 	ddt_t *ddt = ddt_select(spa, bp);
 	ddt_entry_t *dde;
 	ddt_phys_t *ddp;
+	ddt_key_t ddk;
 
 	ASSERT(BP_GET_DEDUP(bp));
 	ASSERT(BP_GET_CHECKSUM(bp) == zp->zp_checksum);
 	ASSERT(BP_IS_HOLE(bp) || zio->io_bp_override);
 	ASSERT(!(zio->io_bp_override && (zio->io_flags & ZIO_FLAG_RAW)));
 
-	ddt_enter(ddt);
+	/* The bp may be zeroed below, so remember which shard is locked. */
+	ddt_key_fill(&ddk, bp);
+	ddt_enter(ddt, &ddk);
 	dde = ddt_lookup(ddt, bp, B_TRUE);
 	ddp = &dde->dde_phys[p];
 
+	if (dde->dde_type == DDT_TYPES && ddp->ddp_phys_birth == 0 &&
+	    dde->dde_lead_zio[p] == NULL && ddt_over_quota(spa)) {
+		/*
+		 * The DDT has reached its quota, so don't add an entry for
+		 * this block; write it as an ordinary block instead.
+		 */
+		zp->zp_dedup = B_FALSE;
+		BP_SET_DEDUP(bp, B_FALSE);
+		if (zio->io_bp_override == NULL)
+			zio->io_pipeline = ZIO_WRITE_PIPELINE;
+		ddt_exit(ddt, &ddk);
+		return (zio);
+	}
+
 	if (zp->zp_dedup_verify && zio_ddt_collision(zio, ddt, dde)) {
 		/*
 		 * If we're using a weak checksum, upgrade to a strong checksum
@@ -3327,7 +3344,7 @@ zio_ddt_write(zio_t *zio)
 		}
 		ASSERT(!BP_GET_DEDUP(bp));
 		zio->io_pipeline = ZIO_WRITE_PIPELINE;
-		ddt_exit(ddt);
+		ddt_exit(ddt, &ddk);
 		return (zio);
 	}
 
@@ -3354,7 +3371,7 @@ zio_ddt_write(zio_t *zio)
 		dde->dde_lead_zio[p] = cio;
 	}
 
-	ddt_exit(ddt);
+	ddt_exit(ddt, &ddk);
 
 	zio_nowait(cio);
 
@@ -3371,18 +3388,29 @@ zio_ddt_free(zio_t *zio)
 	ddt_t *ddt = ddt_select(spa, bp);
 	ddt_entry_t *dde;
 	ddt_phys_t *ddp;
+	ddt_key_t ddk;
 
 	ASSERT(BP_GET_DEDUP(bp));
 	ASSERT(zio->io_child_type == ZIO_CHILD_LOGICAL);
 
-	ddt_enter(ddt);
+	ddt_key_fill(&ddk, bp);
+	ddt_enter(ddt, &ddk);
 	freedde = dde = ddt_lookup(ddt, bp, B_TRUE);
-	if (dde) {
-		ddp = ddt_phys_select(dde, bp);
-		if (ddp)
-			ddt_phys_decref(ddp);
+	ddp = ddt_phys_select(dde, bp);
+	if (ddp)
+		ddt_phys_decref(ddp);
+	ddt_exit(ddt, &ddk);
+
+	/*
+	 * If the block has no DDT entry, its entry was pruned and it is an
+	 * ordinary block now, so free it directly.
+	 */
+	if (ddp == NULL) {
+		BP_SET_DEDUP(bp, B_FALSE);
+		zio->io_pipeline |= ZIO_STAGE_DVA_FREE;
+		if (BP_IS_GANG(bp))
+			zio->io_pipeline |= ZIO_GANG_STAGES;
 	}
-	ddt_exit(ddt);
 
 	return (zio);
 }
@@ -4491,6 +4519,9 @@ zio_dva_throttle_done(zio_t *zio)
 	    pio->io_allocator, B_TRUE);
 	mutex_exit(&pio->io_lock);
 
+	metaslab_group_latency_update(vd->vdev_mg,
+	    gethrtime() - zio->io_queued_timestamp);
+
 	metaslab_class_throttle_unreserve(zio->io_metaslab_class, 1,
 	    pio->io_allocator, pio);
 
@@ -18,6 +18,9 @@
 #include <string.h>
 #include <sys/avl.h>
 #include <sys/btree.h>
+#include <sys/metaslab_impl.h>
+#include <sys/range_tree.h>
+#include <sys/vdev_impl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
@@ -28,6 +31,8 @@ static int stress_timeout = 180;
 static int contents_frequency = 100;
 static int tree_limit = 64 * 1024;
 static boolean_t stress_only = B_FALSE;
+static boolean_t df_bench = B_FALSE;
+static int df_bench_allocs = 1024 * 1024;
 
 static void
 usage(int exit_value)
@@ -37,13 +42,18 @@ usage(int exit_value)
 	    "[-t timeout>] [-c check_contents]\n");
 	(void) fprintf(stderr, "\tbtree_test [-r <seed>] [-l <limit>] "
 	    "[-t timeout>] [-c check_contents]\n");
+	(void) fprintf(stderr, "\tbtree_test -b [-r <seed>] "
+	    "[-a allocations]\n");
 	(void) fprintf(stderr, "\n    With the -n option, run the named "
 	    "negative test. With the -s option,\n");
 	(void) fprintf(stderr, "    run the stress test according to the "
 	    "other options passed. With\n");
 	(void) fprintf(stderr, "    neither, run all the positive tests, "
 	    "including the stress test with\n");
-	(void) fprintf(stderr, "    the default options.\n");
+	(void) fprintf(stderr, "    the default options. With the -b "
+	    "option, time metaslab_df_alloc()\n");
+	(void) fprintf(stderr, "    with the generic and specialized "
+	    "B-tree searches.\n");
 	(void) fprintf(stderr, "\n    Options that control the stress test\n");
 	(void) fprintf(stderr, "\t-c stress iterations after which to compare "
 	    "tree contents [default: 100]\n");
@@ -53,6 +63,9 @@ usage(int exit_value)
 	    "gettimeofday()]\n");
 	(void) fprintf(stderr, "\t-t seconds to let the stress test run "
 	    "[default: 180]\n");
+	(void) fprintf(stderr, "\n    Options that control the -b "
+	    "benchmark\n");
+	(void) fprintf(stderr, "\t-a allocations to time [default: 1M]\n");
 	exit(exit_value);
 }
 
@@ -85,6 +98,9 @@ zfs_btree_compare(const void *v1, const void *v2)
 	return (TREE_CMP(*a, *b));
 }
 
+ZFS_BTREE_FIND_IN_BUF_FUNC(btree_test_find_in_buf, uint64_t,
+    zfs_btree_compare)
+
 static void
 verify_contents(avl_tree_t *avl, zfs_btree_t *bt)
 {
@@ -288,6 +304,88 @@ drain_tree(zfs_btree_t *bt, char *why)
 	return (0);
 }
 
+/*
+ * Compare the specialized search against the generic one. First check
+ * btree_test_find_in_buf() directly against a linear scan for every buffer
+ * length up to 64 elements. Then fill bt and a tree created without a
+ * bt_find_in_buf function, which uses the generic search, with the same
+ * values in the same order. Both trees end up with the same shape, so
+ * every lookup must agree on the result, the index and the next element.
+ */
+static int
+find_in_buf(zfs_btree_t *bt, char *why)
+{
+	zfs_btree_t generic;
+	uint64_t buf[64];
+	int i;
+
+	for (uint32_t n = 0; n <= ARRAY_SIZE(buf); n++) {
+		for (uint32_t j = 0; j < n; j++)
+			buf[j] = 2 * j + 2;
+		for (uint64_t v = 0; v <= 2 * n + 2; v++) {
+			zfs_btree_index_t where = {0};
+			uint32_t off = 0;
+			while (off < n && buf[off] < v)
+				off++;
+			boolean_t before = off == n || buf[off] != v;
+			void *rv = btree_test_find_in_buf(bt, (uint8_t *)buf,
+			    n, &v, &where);
+
+			if (rv != (before ? NULL : &buf[off]) ||
+			    where.bti_offset != off ||
+			    where.bti_before != before) {
+				(void) snprintf(why, BUFSIZE, "Search for "
+				    "%llu in %u elements returned offset %u "
+				    "before %d\n", (u_longlong_t)v, n,
+				    where.bti_offset, where.bti_before);
+				return (1);
+			}
+		}
+	}
+
+	zfs_btree_create(&generic, zfs_btree_compare, NULL,
+	    sizeof (uint64_t));
+
+	for (i = 0; i < 16 * 1024; i++) {
+		zfs_btree_index_t bt_idx = {0};
+		uint64_t randval = random() % (64 * 1024);
+
+		if (zfs_btree_find(bt, &randval, &bt_idx) != NULL)
+			continue;
+		zfs_btree_add_idx(bt, &randval, &bt_idx);
+		VERIFY3P(zfs_btree_find(&generic, &randval, &bt_idx), ==,
+		    NULL);
+		zfs_btree_add_idx(&generic, &randval, &bt_idx);
+	}
+
+	for (i = 0; i < 64 * 1024; i++) {
+		zfs_btree_index_t idx1 = {0}, idx2 = {0}, next = {0};
+		uint64_t randval = random() % (68 * 1024);
+		uint64_t *rv1 = zfs_btree_find(bt, &randval, &idx1);
+		uint64_t *rv2 = zfs_btree_find(&generic, &randval, &idx2);
+		uint64_t *nx1 = zfs_btree_next(bt, &idx1, &next);
+		uint64_t *nx2 = zfs_btree_next(&generic, &idx2, &next);
+
+		if ((rv1 == NULL) != (rv2 == NULL) ||
+		    (rv1 != NULL && *rv1 != *rv2) ||
+		    idx1.bti_offset != idx2.bti_offset ||
+		    idx1.bti_before != idx2.bti_before ||
+		    (nx1 == NULL) != (nx2 == NULL) ||
+		    (nx1 != NULL && *nx1 != *nx2)) {
+			(void) snprintf(why, BUFSIZE, "Searches for %llu "
+			    "disagree\n", (u_longlong_t)randval);
+			break;
+		}
+	}
+
+	zfs_btree_index_t *cookie = NULL;
+	while (zfs_btree_destroy_nodes(&generic, &cookie) != NULL)
+		;
+	zfs_btree_destroy(&generic);
+
+	return (i == 64 * 1024 ? 0 : 1);
+}
+
 /*
  * This test uses an avl and btree, and continually processes new random
  * values. Each value is either removed or inserted, depending on whether
@@ -445,6 +543,163 @@ do_negative_test(zfs_btree_t *bt, char *test_name)
 	return (0);
 }
 
+/*
+ * metaslab_df_alloc() microbenchmark. A 16G metaslab is filled with free
+ * segments of 4K to 128K separated by gaps of the same sizes, then random
+ * 4K to 64K allocations are made, each freed again once 4096 newer ones
+ * are outstanding. Only the time spent in the allocator is counted. The
+ * run is made once with every tree using the generic search and once with
+ * the specialized searches; both must hand out the same offsets.
+ */
+#define	DF_BENCH_MS_SIZE	(16ULL << 30)
+#define	DF_BENCH_LIVE		4096
+
+static int
+df_bench_size_compare(const void *x1, const void *x2)
+{
+	const range_seg64_t *r1 = x1;
+	const range_seg64_t *r2 = x2;
+
+	uint64_t rs_size1 = r1->rs_end - r1->rs_start;
+	uint64_t rs_size2 = r2->rs_end - r2->rs_start;
+
+	int cmp = TREE_CMP(rs_size1, rs_size2);
+	if (likely(cmp))
+		return (cmp);
+
+	return (TREE_CMP(r1->rs_start, r2->rs_start));
+}
+
+ZFS_BTREE_FIND_IN_BUF_FUNC(df_bench_size_find_in_buf, range_seg64_t,
+    df_bench_size_compare)
+
+static int
+df_bench_seg_compare(const void *x1, const void *x2)
+{
+	const range_seg64_t *r1 = x1;
+	const range_seg64_t *r2 = x2;
+
+	return ((r1->rs_start >= r2->rs_end) - (r1->rs_end <= r2->rs_start));
+}
+
+ZFS_BTREE_FIND_IN_BUF_FUNC(df_bench_seg_find_in_buf, range_seg64_t,
+    df_bench_seg_compare)
+
+static void
+df_bench_rt_add(range_tree_t *rt, range_seg_t *rs, void *arg)
+{
+	(void) rt;
+	metaslab_t *msp = arg;
+
+	zfs_btree_add(&msp->ms_allocatable_by_size, rs);
+}
+
+static void
+df_bench_rt_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
+{
+	(void) rt;
+	metaslab_t *msp = arg;
+
+	zfs_btree_remove(&msp->ms_allocatable_by_size, rs);
+}
+
+static const range_tree_ops_t df_bench_rt_ops = {
+	.rtop_add = df_bench_rt_add,
+	.rtop_remove = df_bench_rt_remove,
+};
+
+static hrtime_t
+df_bench_run(boolean_t specialized, uint64_t *sum)
+{
+	uint64_t live_off[DF_BENCH_LIVE], live_size[DF_BENCH_LIVE];
+	vdev_t *vd = kmem_zalloc(sizeof (vdev_t), KM_SLEEP);
+	metaslab_group_t *mg = kmem_zalloc(sizeof (metaslab_group_t),
+	    KM_SLEEP);
+	metaslab_t *msp = kmem_zalloc(sizeof (metaslab_t), KM_SLEEP);
+	hrtime_t elapsed = 0;
+	int nlive = 0;
+
+	mg->mg_vd = vd;
+	mutex_init(&msp->ms_lock, NULL, MUTEX_DEFAULT, NULL);
+	msp->ms_group = mg;
+	msp->ms_start = 0;
+	msp->ms_size = DF_BENCH_MS_SIZE;
+	zfs_btree_create(&msp->ms_allocatable_by_size, df_bench_size_compare,
+	    specialized ? df_bench_size_find_in_buf : NULL,
+	    sizeof (range_seg64_t));
+	msp->ms_allocatable = range_tree_create(&df_bench_rt_ops, RANGE_SEG64,
+	    msp, 0, 0);
+	/* range_tree_create() always picks the generic search. */
+	if (specialized) {
+		msp->ms_allocatable->rt_root.bt_find_in_buf =
+		    df_bench_seg_find_in_buf;
+	}
+
+	srandom(seed);
+	for (uint64_t off = 0; off < DF_BENCH_MS_SIZE; ) {
+		uint64_t size = (1 + random() % 32) << 12;
+
+		size = MIN(size, DF_BENCH_MS_SIZE - off);
+		range_tree_add(msp->ms_allocatable, off, size);
+		off += size + ((1 + random() % 32) << 12);
+	}
+
+	*sum = 0;
+	mutex_enter(&msp->ms_lock);
+	for (int i = 0; i < df_bench_allocs; i++) {
+		uint64_t size = (1 + random() % 16) << 12;
+		hrtime_t start = gethrtime();
+		uint64_t off = zfs_metaslab_ops.msop_alloc(msp, size);
+		elapsed += gethrtime() - start;
+
+		*sum = *sum * 31 + off;
+		if (off == -1ULL)
+			continue;
+		range_tree_remove(msp->ms_allocatable, off, size);
+
+		int slot = nlive++ % DF_BENCH_LIVE;
+		if (nlive > DF_BENCH_LIVE) {
+			range_tree_add(msp->ms_allocatable, live_off[slot],
+			    live_size[slot]);
+		}
+		live_off[slot] = off;
+		live_size[slot] = size;
+	}
+	mutex_exit(&msp->ms_lock);
+
+	range_tree_vacate(msp->ms_allocatable, NULL, NULL);
+	range_tree_destroy(msp->ms_allocatable);
+	zfs_btree_clear(&msp->ms_allocatable_by_size);
+	zfs_btree_destroy(&msp->ms_allocatable_by_size);
+	mutex_destroy(&msp->ms_lock);
+	kmem_free(msp, sizeof (metaslab_t));
+	kmem_free(mg, sizeof (metaslab_group_t));
+	kmem_free(vd, sizeof (vdev_t));
+
+	return (elapsed);
+}
+
+static int
+df_bench_test(void)
+{
+	uint64_t sum_generic, sum_specialized;
+	hrtime_t generic = df_bench_run(B_FALSE, &sum_generic);
+	hrtime_t specialized = df_bench_run(B_TRUE, &sum_specialized);
+
+	(void) fprintf(stdout, "%-20s%llu ns/alloc\n", "generic",
+	    (u_longlong_t)(generic / df_bench_allocs));
+	(void) fprintf(stdout, "%-20s%llu ns/alloc\n", "specialized",
+	    (u_longlong_t)(specialized / df_bench_allocs));
+
+	if (sum_generic != sum_specialized) {
+		(void) fprintf(stdout, "Allocations differ between the "
+		    "generic and specialized searches\n");
+		return (1);
+	}
+
+	return (0);
+}
+
 typedef struct btree_test {
 	const char	*name;
 	int		(*func)(zfs_btree_t *, char *);
@@ -454,6 +709,7 @@ static btree_test_t test_table[] = {
 	{ "insert_find_remove",		insert_find_remove	},
 	{ "find_without_index",		find_without_index	},
 	{ "drain_tree",			drain_tree		},
+	{ "find_in_buf",		find_in_buf		},
 	{ "stress_tree",		stress_tree		},
 	{ NULL,				NULL			}
 };
@@ -467,8 +723,14 @@ main(int argc, char *argv[])
 	zfs_btree_t bt;
 	int c;
 
-	while ((c = getopt(argc, argv, "c:l:n:r:st:")) != -1) {
+	while ((c = getopt(argc, argv, "a:bc:l:n:r:st:")) != -1) {
 		switch (c) {
+		case 'a':
+			df_bench_allocs = atoi(optarg);
+			break;
+		case 'b':
+			df_bench = B_TRUE;
+			break;
 		case 'c':
 			contents_frequency = atoi(optarg);
 			break;
@@ -501,7 +763,8 @@ main(int argc, char *argv[])
 	srandom(seed);
 
 	zfs_btree_init();
-	zfs_btree_create(&bt, zfs_btree_compare, sizeof (uint64_t));
+	zfs_btree_create(&bt, zfs_btree_compare, btree_test_find_in_buf,
+	    sizeof (uint64_t));
 
 	/*
 	 * This runs the named negative test. None of them should
@@ -522,6 +785,10 @@ main(int argc, char *argv[])
 		return (stress_tree(&bt, NULL));
 	}
 
+	if (df_bench) {
+		return (df_bench_test());
+	}
+
 	/* Do the positive tests */
 	btree_test_t *test = &test_table[0];
 	while (test->name) {
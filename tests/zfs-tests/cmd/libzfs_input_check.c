@@ -757,6 +757,30 @@ test_wait_fs(const char *dataset)
 	nvlist_free(required);
 }
 
+static void
+test_rewrite(const char *dataset)
+{
+	nvlist_t *required = fnvlist_alloc();
+
+	fnvlist_add_uint64(required, "rewrite_command", ZFS_REWRITE_STOP);
+
+	IOC_INPUT_TEST(ZFS_IOC_REWRITE, dataset, required, NULL, ENOENT);
+
+	nvlist_free(required);
+}
+
+static void
+test_ddt_prune(const char *pool)
+{
+	nvlist_t *required = fnvlist_alloc();
+
+	fnvlist_add_uint64(required, "ddt_prune_days", 365);
+
+	IOC_INPUT_TEST(ZFS_IOC_DDT_PRUNE, pool, required, NULL, 0);
+
+	nvlist_free(required);
+}
+
 static void
 test_get_bootenv(const char *pool)
 {
@@ -865,6 +889,9 @@ zfs_ioc_input_tests(const char *pool)
 	test_wait(pool);
 	test_wait_fs(dataset);
 
+	test_rewrite(dataset);
+	test_ddt_prune(pool);
+
 	test_set_bootenv(pool);
 	test_get_bootenv(pool);
 
@@ -1022,6 +1049,8 @@ validate_ioc_values(void)
 	CHECK(ZFS_IOC_BASE + 82 == ZFS_IOC_GET_BOOKMARK_PROPS);
 	CHECK(ZFS_IOC_BASE + 83 == ZFS_IOC_WAIT);
 	CHECK(ZFS_IOC_BASE + 84 == ZFS_IOC_WAIT_FS);
+	CHECK(ZFS_IOC_BASE + 87 == ZFS_IOC_REWRITE);
+	CHECK(ZFS_IOC_BASE + 88 == ZFS_IOC_DDT_PRUNE);
 	CHECK(ZFS_IOC_PLATFORM_BASE + 1 == ZFS_IOC_EVENTS_NEXT);
 	CHECK(ZFS_IOC_PLATFORM_BASE + 2 == ZFS_IOC_EVENTS_CLEAR);
 	CHECK(ZFS_IOC_PLATFORM_BASE + 3 == ZFS_IOC_EVENTS_SEEK);
@@ -0,0 +1,175 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Round-trip and micro-benchmark for zio_do_crypt_data().
+ *
+ * Every supported cipher encrypts and decrypts blocks of several sizes
+ * three ways: with the key's current salt, with a previous salt whose
+ * key and context template are cached, and with a fresh salt for every
+ * block (so the key must be derived and scheduled per block). The
+ * per-block cost of the last case is what the template cache saves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/zfs_context.h>
+#include <sys/zio_crypt.h>
+
+#define	BENCH_BYTES	(64ULL << 20)
+
+static const uint_t blocksizes[] = { 4096, 16384, 131072 };
+
+typedef enum salt_mode {
+	SALT_CURRENT,
+	SALT_CACHED,
+	SALT_UNIQUE,
+} salt_mode_t;
+
+static const char *salt_mode_names[] = { "current", "cached", "unique" };
+
+static int
+crypt_block(boolean_t encrypt, zio_crypt_key_t *key, uint8_t *salt,
+    uint8_t *iv, uint8_t *mac, uint_t len, uint8_t *plain, uint8_t *cipher)
+{
+	boolean_t no_crypt = B_FALSE;
+
+	return (zio_do_crypt_data(encrypt, key, DMU_OT_PLAIN_FILE_CONTENTS,
+	    B_FALSE, salt, iv, mac, len, plain, cipher, &no_crypt));
+}
+
+static int
+run_roundtrip(zio_crypt_key_t *key, salt_mode_t mode, uint_t len,
+    uint8_t *plain, uint8_t *cipher, uint8_t *check)
+{
+	uint8_t salt[ZIO_DATA_SALT_LEN], iv[ZIO_DATA_IV_LEN];
+	uint8_t mac[ZIO_DATA_MAC_LEN];
+	int ret;
+
+	if (mode == SALT_CURRENT)
+		VERIFY0(zio_crypt_key_get_salt(key, salt));
+	else
+		VERIFY0(random_get_bytes(salt, sizeof (salt)));
+	VERIFY0(zio_crypt_generate_iv(iv));
+
+	ret = crypt_block(B_TRUE, key, salt, iv, mac, len, plain, cipher);
+	if (ret != 0) {
+		printf("encryption failed with error code %d\n", ret);
+		return (ret);
+	}
+
+	/* decrypt twice so the second pass uses any cached template */
+	for (int i = 0; i < 2; i++) {
+		memset(check, 0, len);
+		ret = crypt_block(B_FALSE, key, salt, iv, mac, len, check,
+		    cipher);
+		if (ret != 0) {
+			printf("decryption failed with error code %d\n", ret);
+			return (ret);
+		}
+		if (memcmp(plain, check, len) != 0) {
+			printf("plaintext mismatch (%s salt, %u bytes)\n",
+			    salt_mode_names[mode], len);
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+static void
+run_bench(zio_crypt_key_t *key, salt_mode_t mode, uint_t len,
+    uint8_t *plain, uint8_t *cipher)
+{
+	uint8_t salt[ZIO_DATA_SALT_LEN], iv[ZIO_DATA_IV_LEN];
+	uint8_t mac[ZIO_DATA_MAC_LEN];
+	uint64_t iters = BENCH_BYTES / len;
+	hrtime_t start, elapsed;
+
+	VERIFY0(zio_crypt_generate_iv(iv));
+	if (mode == SALT_CURRENT) {
+		VERIFY0(zio_crypt_key_get_salt(key, salt));
+	} else {
+		VERIFY0(random_get_bytes(salt, sizeof (salt)));
+		if (mode == SALT_CACHED)
+			VERIFY0(crypt_block(B_TRUE, key, salt, iv, mac, len,
+			    plain, cipher));
+	}
+
+	start = gethrtime();
+	for (uint64_t i = 0; i < iters; i++) {
+		if (mode == SALT_UNIQUE)
+			salt[i % ZIO_DATA_SALT_LEN]++;
+		VERIFY0(crypt_block(B_TRUE, key, salt, iv, mac, len, plain,
+		    cipher));
+	}
+	elapsed = MAX(gethrtime() - start, 1);
+
+	printf("    %-8s %6u bytes: %8.1f MB/s %8llu ns/block\n",
+	    salt_mode_names[mode], len,
+	    (double)(iters * len) * NANOSEC / elapsed / (1024 * 1024),
+	    (u_longlong_t)(elapsed / iters));
+}
+
+int
+main(void)
+{
+	uint_t maxlen = blocksizes[ARRAY_SIZE(blocksizes) - 1];
+	uint8_t *plain, *cipher, *check;
+	int ret = 0;
+
+	kernel_init(SPA_MODE_READ);
+
+	plain = umem_alloc(maxlen, UMEM_NOFAIL);
+	cipher = umem_alloc(maxlen, UMEM_NOFAIL);
+	check = umem_alloc(maxlen, UMEM_NOFAIL);
+	VERIFY0(random_get_pseudo_bytes(plain, maxlen));
+
+	for (uint64_t crypt = ZIO_CRYPT_AES_128_CCM;
+	    crypt < ZIO_CRYPT_FUNCTIONS && ret == 0; crypt++) {
+		zio_crypt_key_t key;
+
+		VERIFY0(zio_crypt_key_init(crypt, &key));
+		printf("%s:\n", zio_crypt_table[crypt].ci_name);
+
+		for (int m = SALT_CURRENT; m <= SALT_UNIQUE && ret == 0; m++) {
+			for (int b = 0; b < ARRAY_SIZE(blocksizes); b++) {
+				ret = run_roundtrip(&key, m, blocksizes[b],
+				    plain, cipher, check);
+				if (ret != 0)
+					break;
+				run_bench(&key, m, blocksizes[b], plain,
+				    cipher);
+			}
+		}
+
+		zio_crypt_key_destroy(&key);
+	}
+
+	umem_free(plain, maxlen);
+	umem_free(cipher, maxlen);
+	umem_free(check, maxlen);
+
+	kernel_fini();
+
+	if (ret == 0) {
+		printf("All tests passed successfully.\n");
+		return (0);
+	} else {
+		printf("Test failed.\n");
+		return (1);
+	}
+}